@@ -0,0 +1,373 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-align.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+/**
+ * The kernel cutoff as a fraction of the lower of the input and output Nyquist frequencies,
+ * leaving a transition band for the window.
+ */
+#define MMA8451_ALIGN_BANDWIDTH 0.9
+
+#define MMA8451_ALIGN_MASK (MMA8451_ALIGN_HISTORY - 1)
+
+typedef struct mma8451_align_channel {
+    float data[3][MMA8451_ALIGN_HISTORY];
+    uint64_t timestamps[MMA8451_ALIGN_HISTORY];
+    /**
+     * The number of samples ever pushed, the index of the next sample.
+     */
+    uint64_t count;
+    double nominal_ns;
+    /**
+     * The fitted clock, sample n was taken at base + fit_t + (n - fit_n) * fit_period.
+     */
+    uint64_t base;
+    double fit_t;
+    double fit_n;
+    double fit_period;
+    int dirty;
+    /**
+     * MMA8451_ALIGN_PHASES + 1 rows of 2 * half_taps coefficients.
+     */
+    float* kernel;
+} mma8451_align_channel;
+
+struct mma8451_align {
+    mma8451_align_config config;
+    mma8451_align_channel channels[MMA8451_ALIGN_MAX_CHANNELS];
+    double out_period_ns;
+    uint64_t next_frame;
+    int started;
+};
+
+/**
+ * Builds the polyphase table for a channel: row p interpolates at p / MMA8451_ALIGN_PHASES of
+ * a sample past the tap at half_taps - 1, with a Blackman windowed sinc.
+ */
+static int mma8451_align_build_kernel(mma8451_align_channel* channel, unsigned int half_taps, double out_period_ns) {
+    unsigned int taps = half_taps * 2, p, j;
+    double cutoff = MMA8451_ALIGN_BANDWIDTH * ((channel->nominal_ns < out_period_ns) ? channel->nominal_ns / out_period_ns : 1.0);
+
+    channel->kernel = (float*)malloc(sizeof(float) * taps * (MMA8451_ALIGN_PHASES + 1));
+    if(channel->kernel == NULL) {
+        return 0;
+    }
+
+    for(p = 0; p <= MMA8451_ALIGN_PHASES; p++) {
+        float* row = channel->kernel + p * taps;
+        double frac = (double)p / MMA8451_ALIGN_PHASES, sum = 0;
+
+        for(j = 0; j < taps; j++) {
+            double x = (double)j - (half_taps - 1) - frac;
+            double u = cutoff * x;
+            double sinc = (fabs(u) < 1e-9) ? 1.0 : sin(M_PI * u) / (M_PI * u);
+            double window = 0.42 + 0.5 * cos(M_PI * x / half_taps) + 0.08 * cos(2 * M_PI * x / half_taps);
+            row[j] = (float)(cutoff * sinc * window);
+            sum += row[j];
+        }
+        //Unity gain at DC so gravity passes through unchanged.
+        for(j = 0; j < taps; j++) {
+            row[j] = (float)(row[j] / sum);
+        }
+    }
+    return 1;
+}
+
+mma8451_align* mma8451_align_create(const mma8451_align_config* config) {
+    mma8451_align* align;
+    unsigned int i;
+
+    if(config->channels < 1 || config->channels > MMA8451_ALIGN_MAX_CHANNELS || config->output_rate_hz <= 0 ||
+       config->half_taps < 2 || config->half_taps > MMA8451_ALIGN_MAX_HALF_TAPS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for(i = 0; i < config->channels; i++) {
+        if(config->input_rate_hz[i] <= 0) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    align = (mma8451_align*)calloc(1, sizeof(mma8451_align));
+    if(align == NULL) {
+        return NULL;
+    }
+    align->config = *config;
+    align->out_period_ns = 1e9 / config->output_rate_hz;
+
+    for(i = 0; i < config->channels; i++) {
+        align->channels[i].nominal_ns = 1e9 / config->input_rate_hz[i];
+        align->channels[i].fit_period = align->channels[i].nominal_ns;
+        if(!mma8451_align_build_kernel(&align->channels[i], config->half_taps, align->out_period_ns)) {
+            mma8451_align_destroy(align);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    return align;
+}
+
+void mma8451_align_destroy(mma8451_align* align) {
+    unsigned int i;
+
+    if(align == NULL) {
+        return;
+    }
+    for(i = 0; i < MMA8451_ALIGN_MAX_CHANNELS; i++) {
+        free(align->channels[i].kernel);
+    }
+    free(align);
+}
+
+static uint64_t mma8451_align_oldest(const mma8451_align_channel* channel) {
+    return (channel->count > MMA8451_ALIGN_HISTORY) ? channel->count - MMA8451_ALIGN_HISTORY : 0;
+}
+
+static void mma8451_align_store(mma8451_align_channel* channel, uint64_t timestamp, float x, float y, float z) {
+    unsigned int slot = channel->count & MMA8451_ALIGN_MASK;
+
+    if(channel->count == 0) {
+        channel->base = timestamp;
+    }
+    channel->data[0][slot] = x;
+    channel->data[1][slot] = y;
+    channel->data[2][slot] = z;
+    channel->timestamps[slot] = timestamp;
+    channel->count++;
+    channel->dirty = 1;
+}
+
+int mma8451_align_push(mma8451_align* align, unsigned int channel, const uint64_t* timestamps, const mma8451_raw_sample* samples, unsigned int count) {
+    mma8451_align_channel* c;
+    unsigned int i;
+
+    if(channel >= align->config.channels) {
+        errno = EINVAL;
+        return 0;
+    }
+    c = &align->channels[channel];
+
+    for(i = 0; i < count; i++) {
+        if(c->count > 0) {
+            unsigned int last = (c->count - 1) & MMA8451_ALIGN_MASK;
+            uint64_t previous = c->timestamps[last];
+            double dt;
+
+            if(timestamps[i] <= previous) {
+                errno = EINVAL;
+                return 0;
+            }
+            dt = (double)(timestamps[i] - previous);
+            if(dt > 1.5 * c->nominal_ns) {
+                //Hold the previous sample across lost samples so sample indices keep tracking time.
+                unsigned int missing = (unsigned int)fmin(llround(dt / c->nominal_ns) - 1, MMA8451_ALIGN_HISTORY);
+                float x = c->data[0][last], y = c->data[1][last], z = c->data[2][last];
+                unsigned int k;
+
+                for(k = 1; k <= missing; k++) {
+                    mma8451_align_store(c, previous + (uint64_t)(dt * k / (missing + 1)), x, y, z);
+                }
+            }
+        }
+        mma8451_align_store(c, timestamps[i], samples[i].x, samples[i].y, samples[i].z);
+    }
+
+    return 1;
+}
+
+/**
+ * Fits the channel's sample clock by least squares over its history, which averages out the
+ * timestamp jitter while tracking the device's real rate.
+ */
+static void mma8451_align_fit(mma8451_align_channel* channel) {
+    uint64_t oldest = mma8451_align_oldest(channel), n;
+    double m = (double)(channel->count - oldest), mean_n, mean_t = 0, cross = 0, period;
+
+    mean_n = (double)oldest + (m - 1) / 2;
+    for(n = oldest; n < channel->count; n++) {
+        mean_t += (double)(channel->timestamps[n & MMA8451_ALIGN_MASK] - channel->base);
+    }
+    mean_t /= m;
+
+    period = channel->nominal_ns;
+    if(m >= 2) {
+        for(n = oldest; n < channel->count; n++) {
+            cross += ((double)n - mean_n) * ((double)(channel->timestamps[n & MMA8451_ALIGN_MASK] - channel->base) - mean_t);
+        }
+        period = cross / (m * (m * m - 1) / 12);
+        //Fall back to the nominal rate rather than trusting a nonsensical fit.
+        if(period < channel->nominal_ns / 2 || period > channel->nominal_ns * 2) {
+            period = channel->nominal_ns;
+        }
+    }
+
+    channel->fit_n = mean_n;
+    channel->fit_t = mean_t;
+    channel->fit_period = period;
+    channel->dirty = 0;
+}
+
+/**
+ * Gets a channel's fractional sample index at time t.
+ */
+static double mma8451_align_index(const mma8451_align_channel* channel, uint64_t t) {
+    return channel->fit_n + (((double)t - (double)channel->base) - channel->fit_t) / channel->fit_period;
+}
+
+/**
+ * Gets the newest timestamp pushed to any channel.
+ */
+static uint64_t mma8451_align_newest(const mma8451_align* align) {
+    uint64_t newest = 0;
+    unsigned int i;
+
+    for(i = 0; i < align->config.channels; i++) {
+        const mma8451_align_channel* c = &align->channels[i];
+        if(c->count > 0 && c->timestamps[(c->count - 1) & MMA8451_ALIGN_MASK] > newest) {
+            newest = c->timestamps[(c->count - 1) & MMA8451_ALIGN_MASK];
+        }
+    }
+    return newest;
+}
+
+/**
+ * Picks the first frame: the first multiple of the output period at which every channel with
+ * data has half_taps samples of history.
+ */
+static int mma8451_align_start(mma8451_align* align) {
+    unsigned int half = align->config.half_taps, i;
+    uint64_t newest = mma8451_align_newest(align), start = 0;
+    int missing = 0, any = 0;
+
+    for(i = 0; i < align->config.channels; i++) {
+        mma8451_align_channel* c = &align->channels[i];
+        uint64_t first;
+
+        if(c->count < 2 * half) {
+            missing = 1;
+            continue;
+        }
+        if(c->dirty) {
+            mma8451_align_fit(c);
+        }
+        first = c->base + (uint64_t)(c->fit_t + ((double)(mma8451_align_oldest(c) + half) - c->fit_n) * c->fit_period);
+        if(!any || first > start) {
+            start = first;
+        }
+        any = 1;
+    }
+
+    if(!any || (missing && (align->config.max_latency_ns == 0 || newest < start + align->config.max_latency_ns))) {
+        return 0;
+    }
+
+    align->next_frame = (uint64_t)ceil((double)start / align->out_period_ns);
+    align->started = 1;
+    return 1;
+}
+
+unsigned int mma8451_align_pull(mma8451_align* align, mma8451_align_frame* frames, unsigned int max) {
+    unsigned int half = align->config.half_taps, taps = half * 2, written = 0, i, j;
+    uint64_t newest;
+
+    if(!align->started && !mma8451_align_start(align)) {
+        return 0;
+    }
+
+    for(i = 0; i < align->config.channels; i++) {
+        if(align->channels[i].dirty && align->channels[i].count >= 2) {
+            mma8451_align_fit(&align->channels[i]);
+        }
+    }
+    newest = mma8451_align_newest(align);
+
+    while(written < max) {
+        mma8451_align_frame* frame = &frames[written];
+        uint64_t t = (uint64_t)llround(align->next_frame * align->out_period_ns);
+        int late = (align->config.max_latency_ns != 0 && newest > t + align->config.max_latency_ns);
+        int ready = 1;
+
+        frame->timestamp_ns = t;
+        frame->valid = 0;
+
+        for(i = 0; i < align->config.channels && ready; i++) {
+            mma8451_align_channel* c = &align->channels[i];
+            double index, phase, weight;
+            const float *row0, *row1;
+            int64_t first;
+            float acc[3] = { 0, 0, 0 };
+            unsigned int p, axis;
+
+            frame->samples[i][0] = frame->samples[i][1] = frame->samples[i][2] = 0;
+            if(c->count < 2) {
+                ready = late;
+                continue;
+            }
+
+            index = mma8451_align_index(c, t);
+            first = (int64_t)floor(index) - (int64_t)half + 1;
+            if(first + (int64_t)taps > (int64_t)c->count) {
+                //The future taps haven't arrived yet.
+                ready = late;
+                continue;
+            }
+            if(first < (int64_t)mma8451_align_oldest(c)) {
+                //Before the channel's data or already out of its history.
+                continue;
+            }
+
+            phase = (index - floor(index)) * MMA8451_ALIGN_PHASES;
+            p = (unsigned int)phase;
+            if(p >= MMA8451_ALIGN_PHASES) {
+                p = MMA8451_ALIGN_PHASES - 1;
+            }
+            weight = phase - p;
+            row0 = c->kernel + p * taps;
+            row1 = row0 + taps;
+
+            for(j = 0; j < taps; j++) {
+                float coefficient = row0[j] + (float)weight * (row1[j] - row0[j]);
+                unsigned int slot = (unsigned int)(first + j) & MMA8451_ALIGN_MASK;
+                for(axis = 0; axis < 3; axis++) {
+                    acc[axis] += coefficient * c->data[axis][slot];
+                }
+            }
+
+            frame->samples[i][0] = acc[0];
+            frame->samples[i][1] = acc[1];
+            frame->samples[i][2] = acc[2];
+            frame->valid |= (1U << i);
+        }
+
+        if(!ready) {
+            break;
+        }
+        align->next_frame++;
+        written++;
+    }
+
+    return written;
+}
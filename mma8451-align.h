@@ -0,0 +1,138 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_ALIGN_H
+#define MMA8451_ALIGN_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The maximum number of devices aligned together.
+ */
+#define MMA8451_ALIGN_MAX_CHANNELS 8
+/**
+ * The maximum interpolation half-width in input samples.
+ */
+#define MMA8451_ALIGN_MAX_HALF_TAPS 16
+/**
+ * Samples of history kept per channel, a power of two. Also the window the channel's clock
+ * is estimated over.
+ */
+#define MMA8451_ALIGN_HISTORY 1024
+/**
+ * Interpolation kernel phases per input sample.
+ */
+#define MMA8451_ALIGN_PHASES 256
+
+/**
+ * This structure configures an alignment stage.
+ */
+typedef struct mma8451_align_config {
+	/**
+	 * The number of channels (devices), 1 to MMA8451_ALIGN_MAX_CHANNELS.
+	 */
+	unsigned int channels;
+	/**
+	 * The nominal data rate of each channel in hz. The real rate is estimated from the
+	 * timestamps.
+	 */
+	double input_rate_hz[MMA8451_ALIGN_MAX_CHANNELS];
+	/**
+	 * The rate of the shared output timeline in hz.
+	 */
+	double output_rate_hz;
+	/**
+	 * The windowed-sinc half-width in input samples, 2 to MMA8451_ALIGN_MAX_HALF_TAPS. Wider
+	 * is sharper but adds half_taps input periods of latency.
+	 */
+	unsigned int half_taps;
+	/**
+	 * How far the newest sample of any channel may run ahead of an output frame before the
+	 * frame is emitted without channels that haven't caught up, in nanoseconds. 0 waits for
+	 * every channel indefinitely.
+	 */
+	uint64_t max_latency_ns;
+} mma8451_align_config;
+
+/**
+ * This structure contains one time-aligned output frame.
+ */
+typedef struct mma8451_align_frame {
+	/**
+	 * CLOCK_MONOTONIC time of the frame in nanoseconds, a multiple of the output period.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * Bit n is set if channel n is present in the frame.
+	 */
+	uint32_t valid;
+	/**
+	 * X, Y and Z of each channel in counts, interpolated to timestamp_ns.
+	 */
+	float samples[MMA8451_ALIGN_MAX_CHANNELS][3];
+} mma8451_align_frame;
+
+/**
+ * An opaque alignment stage.
+ */
+typedef struct mma8451_align mma8451_align;
+
+/**
+ * This function creates an alignment stage.
+ * @param config The configuration.
+ * @return The stage or NULL if there was an error.
+ */
+mma8451_align* mma8451_align_create(const mma8451_align_config* config);
+/**
+ * This function frees an alignment stage.
+ * @param align The stage to free.
+ */
+void mma8451_align_destroy(mma8451_align* align);
+/**
+ * This function adds samples from one device. A timestamp jump of more than one and a half
+ * periods is treated as lost samples, which are filled by holding the previous sample.
+ * @param align The stage.
+ * @param channel The channel index.
+ * @param timestamps CLOCK_MONOTONIC time of each sample in nanoseconds, increasing.
+ * @param samples The samples in counts.
+ * @param count Number of samples.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_align_push(mma8451_align* align, unsigned int channel, const uint64_t* timestamps, const mma8451_raw_sample* samples, unsigned int count);
+/**
+ * This function emits every output frame that can be computed from the samples pushed so
+ * far. A frame is ready once each channel has half_taps samples past it, or once the latency
+ * bound excludes the channels that don't.
+ * @param align The stage.
+ * @param frames Frames to fill.
+ * @param max Size of frames.
+ * @return The number of frames written.
+ */
+unsigned int mma8451_align_pull(mma8451_align* align, mma8451_align_frame* frames, unsigned int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,376 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * C++20 coroutine layer over mma8451.hpp. Blocking bus I/O runs on a small IoExecutor
+ * while coroutines are resumed on a single-threaded EventLoop, so one loop thread can
+ * serve many sensors:
+ *
+ *   libmma8451::Task consume(libmma8451::AsyncDevice<>& dev) {
+ *       for(;;) {
+ *           auto batch = co_await dev.next_batch();
+ *           ...
+ *       }
+ *   }
+ */
+#ifndef MMA8451_ASYNC_HPP
+#define MMA8451_ASYNC_HPP
+
+#include "mma8451.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace libmma8451 {
+
+/**
+ * A small pool of threads that runs blocking bus I/O, optionally after a delay. Delayed
+ * jobs don't occupy a thread while waiting, so a few threads can poll many devices.
+ */
+class IoExecutor {
+public:
+	using clock = std::chrono::steady_clock;
+
+	explicit IoExecutor(unsigned int threads = 1) {
+		for(unsigned int i = 0; i < threads; i++) {
+			threads_.emplace_back([this] { worker(); });
+		}
+	}
+
+	~IoExecutor() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cond_.notify_all();
+		for(std::thread& thread : threads_) {
+			thread.join();
+		}
+	}
+
+	IoExecutor(const IoExecutor&) = delete;
+	IoExecutor& operator=(const IoExecutor&) = delete;
+
+	/**
+	 * Runs a job as soon as a thread is free.
+	 */
+	void post(std::function<void()> job) {
+		post_at(clock::now(), std::move(job));
+	}
+
+	/**
+	 * Runs a job no earlier than when.
+	 */
+	void post_at(clock::time_point when, std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push(Job{ when, sequence_++, std::move(job) });
+		}
+		cond_.notify_one();
+	}
+
+private:
+	struct Job {
+		clock::time_point when;
+		unsigned long long sequence;
+		std::function<void()> run;
+
+		bool operator>(const Job& other) const {
+			return when != other.when ? when > other.when : sequence > other.sequence;
+		}
+	};
+
+	void worker() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for(;;) {
+			if(stopping_) {
+				return;
+			}
+			if(jobs_.empty()) {
+				cond_.wait(lock);
+				continue;
+			}
+			if(jobs_.top().when > clock::now()) {
+				cond_.wait_until(lock, jobs_.top().when);
+				continue;
+			}
+			std::function<void()> job = std::move(const_cast<Job&>(jobs_.top()).run);
+			jobs_.pop();
+			lock.unlock();
+			job();
+			lock.lock();
+		}
+	}
+
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::priority_queue<Job, std::vector<Job>, std::greater<Job>> jobs_;
+	std::vector<std::thread> threads_;
+	unsigned long long sequence_ = 0;
+	bool stopping_ = false;
+};
+
+/**
+ * A single-threaded loop that resumes coroutines. run() returns once stop() is called or
+ * nothing is waiting on I/O and there is nothing left to resume, which makes it usable
+ * standalone in tests.
+ */
+class EventLoop {
+public:
+	/**
+	 * Queues a coroutine to be resumed on the loop thread. Thread safe.
+	 */
+	void post(std::coroutine_handle<> handle) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			ready_.push_back(handle);
+		}
+		cond_.notify_one();
+	}
+
+	/**
+	 * Marks a coroutine as suspended on I/O, keeping run() alive until it is posted back.
+	 */
+	void begin_wait() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		waiting_++;
+	}
+
+	/**
+	 * Posts a coroutine that was registered with begin_wait(). Thread safe.
+	 */
+	void complete_wait(std::coroutine_handle<> handle) {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			waiting_--;
+			ready_.push_back(handle);
+		}
+		cond_.notify_one();
+	}
+
+	/**
+	 * Resumes coroutines until stopped or idle.
+	 */
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		stopping_ = false;
+		for(;;) {
+			cond_.wait(lock, [this] { return stopping_ || !ready_.empty() || waiting_ == 0; });
+			if(stopping_ || ready_.empty()) {
+				return;
+			}
+			std::coroutine_handle<> handle = ready_.front();
+			ready_.pop_front();
+			lock.unlock();
+			handle.resume();
+			lock.lock();
+		}
+	}
+
+	/**
+	 * Makes run() return. Thread safe.
+	 */
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stopping_ = true;
+		}
+		cond_.notify_one();
+	}
+
+private:
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::deque<std::coroutine_handle<>> ready_;
+	unsigned int waiting_ = 0;
+	bool stopping_ = false;
+};
+
+/**
+ * A detached, eagerly started coroutine. Exceptions that escape it terminate the program.
+ */
+struct Task {
+	struct promise_type {
+		Task get_return_object() noexcept {
+			return {};
+		}
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept {
+			std::terminate();
+		}
+	};
+};
+
+/**
+ * Asynchronous sample reader for a Device. With the FIFO enabled a batch is delivered once
+ * the FIFO reaches its watermark (or fills, if no watermark is set). With the FIFO disabled
+ * STATUS and the output registers are read together on each data-ready and a batch is
+ * delivered once batch_size new samples have been collected.
+ */
+template<Range R = Range::Dynamic, Resolution S = Resolution::Dynamic>
+class AsyncDevice {
+public:
+	/**
+	 * @param device Device to read, must outlive this object.
+	 * @param loop Loop the awaiting coroutines are resumed on.
+	 * @param io Executor the bus I/O runs on.
+	 * @param batch_size Samples per batch when the FIFO is disabled, at most 32.
+	 * @throws std::system_error if the device configuration can't be read.
+	 */
+	AsyncDevice(Device<R, S>& device, EventLoop& loop, IoExecutor& io, std::size_t batch_size = 32)
+		: device_(device), loop_(loop), io_(io), samples_(32) {
+		mma8451_register_f_setup setup;
+		mma8451_register_ctrl_reg1 ctrl;
+
+		if(!mma8451_get_f_setup(device_.get(), &setup) || !mma8451_get_ctrl_reg1(device_.get(), &ctrl)) {
+			detail::throw_errno("mma8451 async configure");
+		}
+		fifo_ = (setup.f_mode != MMA8451_FIFO_MODE_DISABLED);
+		threshold_ = fifo_ ? (setup.f_wmrk ? setup.f_wmrk : 32) : (batch_size > 32 ? 32 : (batch_size ? batch_size : 1));
+		period_ = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::nanoseconds(mma8451_data_rate_period_ns((mma8451_data_rate)ctrl.dr)));
+	}
+
+	AsyncDevice(const AsyncDevice&) = delete;
+	AsyncDevice& operator=(const AsyncDevice&) = delete;
+
+	/**
+	 * Awaitable returned by next_batch(), resumes with the samples of one batch. The span is
+	 * valid until the next call to next_batch().
+	 */
+	class BatchAwaiter {
+	public:
+		explicit BatchAwaiter(AsyncDevice& owner) : owner_(owner) {}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> handle) {
+			owner_.count_ = 0;
+			owner_.error_ = std::error_code();
+			owner_.loop_.begin_wait();
+			AsyncDevice* owner = &owner_;
+			owner_.io_.post([owner, handle] { owner->poll(handle); });
+		}
+
+		std::span<const RawSample> await_resume() const {
+			if(owner_.error_) {
+				throw std::system_error(owner_.error_, "mma8451 next_batch");
+			}
+			return std::span<const RawSample>(owner_.samples_.data(), owner_.count_);
+		}
+
+	private:
+		AsyncDevice& owner_;
+	};
+
+	/**
+	 * Suspends until a batch of samples is available. Only one next_batch() may be
+	 * outstanding per device.
+	 */
+	BatchAwaiter next_batch() {
+		return BatchAwaiter(*this);
+	}
+
+	/**
+	 * The device this reader wraps.
+	 */
+	Device<R, S>& device() noexcept {
+		return device_;
+	}
+
+private:
+	/**
+	 * Runs on the I/O executor: checks for data once and either completes the batch or
+	 * reschedules itself for when the missing samples are expected.
+	 */
+	void poll(std::coroutine_handle<> handle) {
+		std::size_t missing;
+
+		try {
+			missing = fifo_ ? poll_fifo() : poll_data_ready();
+		} catch(const std::system_error& e) {
+			error_ = e.code();
+			missing = 0;
+		}
+
+		if(missing == 0) {
+			loop_.complete_wait(handle);
+			return;
+		}
+		io_.post_at(IoExecutor::clock::now() + period_ * missing, [this, handle] { poll(handle); });
+	}
+
+	std::size_t poll_fifo() {
+		mma8451_register_f_status status;
+
+		if(!mma8451_get_f_status(device_.get(), &status)) {
+			detail::throw_errno("mma8451_get_f_status");
+		}
+		if(status.f_cnt < threshold_ && !status.f_wmrk_flag) {
+			return threshold_ - status.f_cnt;
+		}
+		device_.drain_fifo(samples_.data(), status.f_cnt);
+		count_ = status.f_cnt;
+		return 0;
+	}
+
+	std::size_t poll_data_ready() {
+		mma8451_sample sample;
+
+		if(mma8451_read_sample(device_.get(), &sample)) {
+			samples_[count_].x = sample.raw.x;
+			samples_[count_].y = sample.raw.y;
+			samples_[count_].z = sample.raw.z;
+			count_++;
+		} else if(errno != EAGAIN) {
+			detail::throw_errno("mma8451_read_sample");
+		}
+		return (count_ < threshold_) ? 1 : 0;
+	}
+
+	Device<R, S>& device_;
+	EventLoop& loop_;
+	IoExecutor& io_;
+	std::vector<RawSample> samples_;
+	std::size_t count_ = 0;
+	std::size_t threshold_;
+	std::chrono::microseconds period_;
+	bool fifo_;
+	std::error_code error_;
+};
+
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-event.h"
+#include <errno.h>
+#include <time.h>
+
+static uint64_t mma8451_event_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void mma8451_event_sleep_ns(uint64_t ns) {
+    struct timespec wait;
+    wait.tv_sec = ns / 1000000000ULL;
+    wait.tv_nsec = ns % 1000000000ULL;
+    nanosleep(&wait, NULL);
+}
+
+/**
+ * Runs a register write with the device in standby, restoring ACTIVE afterwards.
+ */
+static int mma8451_event_in_standby(mma8451* device, mma8451_register reg, unsigned char value, mma8451_register reg2, unsigned char value2) {
+    unsigned char ctrl;
+
+    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, &ctrl)) {
+        return 0;
+    }
+    if((ctrl & MMA8451_CTRL_REG1_ACTIVE_MASK) &&
+       !mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, ctrl & ~MMA8451_CTRL_REG1_ACTIVE_MASK)) {
+        return 0;
+    }
+    if(!mma8451_set_register(device, reg, NULL, value) || !mma8451_set_register(device, reg2, NULL, value2)) {
+        return 0;
+    }
+    if((ctrl & MMA8451_CTRL_REG1_ACTIVE_MASK) && !mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, ctrl)) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Reads the source registers of the trigger sources, which releases their event latches.
+ */
+static int mma8451_event_clear_sources(mma8451* device, unsigned char sources) {
+    unsigned char value;
+
+    if((sources & MMA8451_TRIG_CFG_TRIG_TRANS_MASK) && !mma8451_get_register(device, MMA8451_REGISTER_TRANSIENT_SCR, NULL, &value)) {
+        return 0;
+    }
+    if((sources & MMA8451_TRIG_CFG_TRIG_LNDPRT_MASK) && !mma8451_get_register(device, MMA8451_REGISTER_PL_STATUS, NULL, &value)) {
+        return 0;
+    }
+    if((sources & MMA8451_TRIG_CFG_TRIG_PULSE_MASK) && !mma8451_get_register(device, MMA8451_REGISTER_PULSE_SRC, NULL, &value)) {
+        return 0;
+    }
+    if((sources & MMA8451_TRIG_CFG_TRIG_FF_MT_MASK) && !mma8451_get_register(device, MMA8451_REGISTER_FF_MT_SRC, NULL, &value)) {
+        return 0;
+    }
+    return 1;
+}
+
+int mma8451_event_arm(mma8451* device, const mma8451_event_config* config) {
+    unsigned char setup = 0;
+
+    if(config->pre_trigger < 1 || config->pre_trigger > 31 || (config->sources & ~(MMA8451_TRIG_CFG_TRIG_TRANS_MASK |
+       MMA8451_TRIG_CFG_TRIG_LNDPRT_MASK | MMA8451_TRIG_CFG_TRIG_PULSE_MASK | MMA8451_TRIG_CFG_TRIG_FF_MT_MASK)) != 0) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    setup = MMA8451_FIELD_SET(setup, MMA8451_F_SETUP_F_MODE, MMA8451_FIFO_MODE_TRIGGER);
+    setup = MMA8451_FIELD_SET(setup, MMA8451_F_SETUP_F_WMRK, config->pre_trigger);
+
+    //Circular or fill mode can only be left for trigger mode through disabled.
+    if(!mma8451_event_clear_sources(device, config->sources) ||
+       !mma8451_set_register(device, MMA8451_REGISTER_F_SETUP, NULL, 0)) {
+        return 0;
+    }
+    return mma8451_event_in_standby(device, MMA8451_REGISTER_TRIG_CFG, config->sources, MMA8451_REGISTER_F_SETUP, setup);
+}
+
+int mma8451_event_disarm(mma8451* device) {
+    return mma8451_event_in_standby(device, MMA8451_REGISTER_F_SETUP, 0, MMA8451_REGISTER_TRIG_CFG, 0);
+}
+
+int mma8451_event_wait(mma8451* device, const mma8451_event_config* config, mma8451_event* event, int timeout_ms) {
+    unsigned char ctrl, status, setup = 0;
+    unsigned int wanted, first = 1;
+    uint64_t period, poll, deadline = 0;
+
+    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, &ctrl)) {
+        return 0;
+    }
+    period = mma8451_data_rate_period_ns(MMA8451_FIELD_GET(ctrl, MMA8451_CTRL_REG1_DR));
+    poll = (period < 1000000) ? 1000000 : period;
+    if(timeout_ms >= 0) {
+        deadline = mma8451_event_now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    }
+
+    //Wait for the trigger, in trigger mode F_WMRK_FLAG reports that it fired.
+    for(;;) {
+        if(!mma8451_get_register(device, MMA8451_REGISTER_F_STATUS, NULL, &status)) {
+            return 0;
+        }
+        if(MMA8451_FIELD_GET(status, MMA8451_F_STATUS_F_WMRK_FLAG)) {
+            break;
+        }
+        if(timeout_ms >= 0 && mma8451_event_now_ns() >= deadline) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        mma8451_event_sleep_ns(poll);
+    }
+
+    if(!mma8451_get_register(device, MMA8451_REGISTER_INT_SOURCE, NULL, &event->int_source)) {
+        return 0;
+    }
+
+    event->overflow = 0;
+    event->count = 0;
+    event->pre_trigger = config->pre_trigger;
+    wanted = config->pre_trigger + config->post_trigger;
+    if(wanted > event->capacity) {
+        wanted = event->capacity;
+    }
+
+    //Drain the frozen history and keep draining while the FIFO fills behind the trigger.
+    while(event->count < wanted) {
+        unsigned int count = MMA8451_FIELD_GET(status, MMA8451_F_STATUS_F_CNT);
+
+        if(MMA8451_FIELD_GET(status, MMA8451_F_STATUS_F_OVF) && !first) {
+            event->overflow = 1;
+        }
+        if(count > wanted - event->count) {
+            count = wanted - event->count;
+        }
+        if(count > 0) {
+            uint64_t now = mma8451_event_now_ns();
+
+            if(!mma8451_drain_fifo(device, event->samples + event->count, count)) {
+                return 0;
+            }
+            if(first) {
+                //The newest sample in the first burst was taken about now.
+                if(event->pre_trigger > count) {
+                    event->pre_trigger = count;
+                }
+                event->timestamp_ns = now - (uint64_t)(count - 1) * period + (uint64_t)event->pre_trigger * period;
+                first = 0;
+            }
+            event->count += count;
+        } else {
+            mma8451_event_sleep_ns(period);
+        }
+
+        if(event->count < wanted && !mma8451_get_register(device, MMA8451_REGISTER_F_STATUS, NULL, &status)) {
+            return 0;
+        }
+    }
+
+    //Re-arm: leaving trigger mode through disabled is allowed while active and clears the FIFO.
+    setup = MMA8451_FIELD_SET(setup, MMA8451_F_SETUP_F_MODE, MMA8451_FIFO_MODE_TRIGGER);
+    setup = MMA8451_FIELD_SET(setup, MMA8451_F_SETUP_F_WMRK, config->pre_trigger);
+    if(!mma8451_event_clear_sources(device, config->sources) ||
+       !mma8451_set_register(device, MMA8451_REGISTER_F_SETUP, NULL, 0) ||
+       !mma8451_set_register(device, MMA8451_REGISTER_F_SETUP, NULL, setup)) {
+        return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,115 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_EVENT_H
+#define MMA8451_EVENT_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This structure configures FIFO trigger mode event capture.
+ */
+typedef struct mma8451_event_config {
+	/**
+	 * The trigger sources, any combination of MMA8451_TRIG_CFG_TRIG_TRANS_MASK,
+	 * MMA8451_TRIG_CFG_TRIG_LNDPRT_MASK, MMA8451_TRIG_CFG_TRIG_PULSE_MASK and
+	 * MMA8451_TRIG_CFG_TRIG_FF_MT_MASK. The matching detection functions must be configured
+	 * and enabled separately.
+	 */
+	unsigned char sources;
+	/**
+	 * The number of samples to keep from before the trigger, 1 to 31. Written to F_WMRK.
+	 */
+	unsigned char pre_trigger;
+	/**
+	 * The number of samples to capture from the trigger onwards. Values beyond what the FIFO
+	 * holds are captured by draining it in bursts while it keeps filling.
+	 */
+	unsigned int post_trigger;
+} mma8451_event_config;
+
+/**
+ * This structure contains one captured event.
+ */
+typedef struct mma8451_event {
+	/**
+	 * Estimated CLOCK_MONOTONIC time of the first post-trigger sample, in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * INT_SOURCE when the trigger was seen.
+	 */
+	unsigned char int_source;
+	/**
+	 * Set if the FIFO overflowed during the capture, samples after the gap are missing.
+	 */
+	unsigned char overflow;
+	/**
+	 * The number of samples before the trigger at the start of samples.
+	 */
+	unsigned int pre_trigger;
+	/**
+	 * The number of samples captured.
+	 */
+	unsigned int count;
+	/**
+	 * Caller supplied storage for the samples, at least pre_trigger + post_trigger entries.
+	 */
+	mma8451_raw_sample* samples;
+	/**
+	 * The number of entries in samples.
+	 */
+	unsigned int capacity;
+} mma8451_event;
+
+/**
+ * This function puts the FIFO in trigger mode for the configured sources. The device is put in
+ * standby while the FIFO is configured and returned to its previous mode afterwards.
+ * @param device Device to arm.
+ * @param config The capture configuration.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_event_arm(mma8451* device, const mma8451_event_config* config);
+/**
+ * This function waits for a trigger and captures the event around it. The trigger sources'
+ * latches are read afterwards so the next event can trigger.
+ * @param device Device armed with mma8451_event_arm().
+ * @param config The configuration the device was armed with.
+ * @param event The event to fill, samples and capacity must be set.
+ * @param timeout_ms Milliseconds to wait for a trigger, negative to wait forever.
+ * @return 1 if an event was captured, 0 if failure (errno is ETIMEDOUT on timeout).
+ */
+int mma8451_event_wait(mma8451* device, const mma8451_event_config* config, mma8451_event* event, int timeout_ms);
+/**
+ * This function disables the FIFO and trigger sources.
+ * @param device Device to disarm.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_event_disarm(mma8451* device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
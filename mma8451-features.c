@@ -0,0 +1,301 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-features.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+/**
+ * Axes are processed as lanes of one vector, the fourth lane is padding.
+ */
+#define MMA8451_FEATURES_LANES 4
+
+struct mma8451_features {
+    mma8451_features_config config;
+    unsigned int bits;
+    float (*window)[MMA8451_FEATURES_LANES];
+    float (*re)[MMA8451_FEATURES_LANES];
+    float (*im)[MMA8451_FEATURES_LANES];
+    float* hann;
+    float* twiddle_re;
+    float* twiddle_im;
+    uint16_t* reverse;
+    double hann_power;
+    unsigned int fill;
+    uint64_t start_ns;
+    uint32_t sequence;
+};
+
+mma8451_features* mma8451_features_create(const mma8451_features_config* config) {
+    mma8451_features* features;
+    unsigned int n = config->window, i, b;
+
+    if(n < MMA8451_FEATURES_MIN_WINDOW || n > MMA8451_FEATURES_MAX_WINDOW || (n & (n - 1)) != 0 ||
+       config->sample_rate_hz <= 0 || config->scale <= 0 || config->bands > MMA8451_FEATURES_MAX_BANDS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    for(i = 0; i < config->bands; i++) {
+        if(config->band_edges_hz[i] < 0 || config->band_edges_hz[i + 1] <= config->band_edges_hz[i]) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    features = (mma8451_features*)calloc(1, sizeof(mma8451_features));
+    if(features == NULL) {
+        return NULL;
+    }
+    features->config = *config;
+    features->window = calloc(n, sizeof(*features->window));
+    features->re = calloc(n, sizeof(*features->re));
+    features->im = calloc(n, sizeof(*features->im));
+    features->hann = (float*)calloc(n, sizeof(float));
+    features->twiddle_re = (float*)calloc(n / 2, sizeof(float));
+    features->twiddle_im = (float*)calloc(n / 2, sizeof(float));
+    features->reverse = (uint16_t*)calloc(n, sizeof(uint16_t));
+    if(features->window == NULL || features->re == NULL || features->im == NULL || features->hann == NULL ||
+       features->twiddle_re == NULL || features->twiddle_im == NULL || features->reverse == NULL) {
+        mma8451_features_destroy(features);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(config->bands == 0) {
+        //ISO 10816 rates broadband vibration over 10-1000 hz, split it by decade.
+        static const float decades[] = { 2, 10, 100, 1000 };
+        float nyquist = (float)(config->sample_rate_hz / 2);
+
+        for(i = 0; i < 4 && decades[i] < nyquist; i++) {
+            features->config.band_edges_hz[i] = decades[i];
+        }
+        if(i < 4) {
+            features->config.band_edges_hz[i++] = nyquist;
+        }
+        features->config.bands = i - 1;
+    }
+
+    while((1U << features->bits) < n) {
+        features->bits++;
+    }
+    for(i = 0; i < n; i++) {
+        unsigned int r = 0;
+        for(b = 0; b < features->bits; b++) {
+            r |= ((i >> b) & 1) << (features->bits - 1 - b);
+        }
+        features->reverse[i] = (uint16_t)r;
+        features->hann[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / n));
+        features->hann_power += (double)features->hann[i] * features->hann[i];
+    }
+    for(i = 0; i < n / 2; i++) {
+        features->twiddle_re[i] = (float)cos(-2 * M_PI * i / n);
+        features->twiddle_im[i] = (float)sin(-2 * M_PI * i / n);
+    }
+
+    return features;
+}
+
+void mma8451_features_destroy(mma8451_features* features) {
+    if(features == NULL) {
+        return;
+    }
+    free(features->window);
+    free(features->re);
+    free(features->im);
+    free(features->hann);
+    free(features->twiddle_re);
+    free(features->twiddle_im);
+    free(features->reverse);
+    free(features);
+}
+
+/**
+ * In-place radix-2 FFT of the bit-reversed input in re and im, all lanes at once.
+ */
+static void mma8451_features_fft(mma8451_features* features) {
+    unsigned int n = features->config.window;
+    float (*re)[MMA8451_FEATURES_LANES] = features->re;
+    float (*im)[MMA8451_FEATURES_LANES] = features->im;
+    unsigned int size, start, k, l;
+
+    for(size = 2; size <= n; size <<= 1) {
+        unsigned int half = size / 2, step = n / size;
+
+        for(start = 0; start < n; start += size) {
+            for(k = 0; k < half; k++) {
+                float wr = features->twiddle_re[k * step];
+                float wi = features->twiddle_im[k * step];
+                float* ar = re[start + k];
+                float* ai = im[start + k];
+                float* br = re[start + k + half];
+                float* bi = im[start + k + half];
+
+                float xr[MMA8451_FEATURES_LANES], xi[MMA8451_FEATURES_LANES];
+                float tr[MMA8451_FEATURES_LANES], ti[MMA8451_FEATURES_LANES];
+
+                //Load every lane before storing any, so the lanes map onto one vector.
+                for(l = 0; l < MMA8451_FEATURES_LANES; l++) {
+                    tr[l] = br[l] * wr - bi[l] * wi;
+                    ti[l] = br[l] * wi + bi[l] * wr;
+                    xr[l] = ar[l];
+                    xi[l] = ai[l];
+                }
+                for(l = 0; l < MMA8451_FEATURES_LANES; l++) {
+                    br[l] = xr[l] - tr[l];
+                    bi[l] = xi[l] - ti[l];
+                    ar[l] = xr[l] + tr[l];
+                    ai[l] = xi[l] + ti[l];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Computes the features of the full window.
+ */
+static void mma8451_features_compute(mma8451_features* features, mma8451_feature_record* record) {
+    const mma8451_features_config* config = &features->config;
+    unsigned int n = config->window, i, l, band;
+    float (*window)[MMA8451_FEATURES_LANES] = features->window;
+    float mean[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    float peak[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double m2[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double m3[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double m4[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double power[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double weighted[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double velocity[MMA8451_FEATURES_LANES] = { 0, 0, 0, 0 };
+    double bands[MMA8451_FEATURES_MAX_BANDS][MMA8451_FEATURES_LANES];
+    double bin_hz = config->sample_rate_hz / n;
+    double norm = 1.0 / (n * features->hann_power);
+
+    //First pass, the mean.
+    for(i = 0; i < n; i++) {
+        for(l = 0; l < MMA8451_FEATURES_LANES; l++) {
+            mean[l] += window[i][l];
+        }
+    }
+    for(l = 0; l < MMA8451_FEATURES_LANES; l++) {
+        mean[l] /= n;
+    }
+
+    //Second pass, central moments and peak, and the windowed signal in FFT order.
+    for(i = 0; i < n; i++) {
+        float* re = features->re[features->reverse[i]];
+        float* im = features->im[features->reverse[i]];
+        float w = features->hann[i];
+
+        for(l = 0; l < MMA8451_FEATURES_LANES; l++) {
+            float d = window[i][l] - mean[l];
+            double d2 = (double)d * d;
+
+            m2[l] += d2;
+            m3[l] += d2 * d;
+            m4[l] += d2 * d2;
+            peak[l] = fmaxf(peak[l], fabsf(d));
+            re[l] = d * w;
+            im[l] = 0;
+        }
+    }
+
+    mma8451_features_fft(features);
+
+    //One-sided power spectrum, normalized so the bins sum to the mean square.
+    memset(bands, 0, sizeof(bands));
+    for(i = 1; i <= n / 2; i++) {
+        double f = i * bin_hz;
+        double k = (i == n / 2) ? norm : 2 * norm;
+        double omega2 = (2 * M_PI * f) * (2 * M_PI * f);
+        int in_velocity = (f >= 10.0);
+
+        for(band = 0; band < config->bands; band++) {
+            if(f >= config->band_edges_hz[band] && f < config->band_edges_hz[band + 1]) {
+                break;
+            }
+        }
+        for(l = 0; l < MMA8451_FEATURES_LANES; l++) {
+            double p = k * ((double)features->re[i][l] * features->re[i][l] + (double)features->im[i][l] * features->im[i][l]);
+
+            power[l] += p;
+            weighted[l] += p * f;
+            velocity[l] += in_velocity ? p / omega2 : 0;
+            if(band < config->bands) {
+                bands[band][l] += p;
+            }
+        }
+    }
+
+    record->samples = (uint16_t)n;
+    record->bands = (uint16_t)config->bands;
+    for(l = 0; l < 3; l++) {
+        mma8451_feature_axis* axis = &record->axes[l];
+        double variance = m2[l] / n;
+        double rms = sqrt(variance);
+
+        memset(axis, 0, sizeof(*axis));
+        axis->mean = mean[l];
+        axis->rms = (float)rms;
+        axis->peak = peak[l];
+        if(variance > 0) {
+            axis->crest_factor = (float)(peak[l] / rms);
+            axis->skewness = (float)((m3[l] / n) / (variance * rms));
+            axis->kurtosis = (float)((m4[l] / n) / (variance * variance));
+        }
+        axis->centroid_hz = (power[l] > 0) ? (float)(weighted[l] / power[l]) : 0;
+        axis->velocity_rms = (float)(sqrt(velocity[l]) * 1000.0);
+        for(band = 0; band < config->bands; band++) {
+            axis->bands[band] = (float)bands[band][l];
+        }
+    }
+}
+
+unsigned int mma8451_features_process(mma8451_features* features, const mma8451_raw_sample* samples, unsigned int count, uint64_t timestamp_ns, mma8451_feature_record* records, unsigned int max) {
+    float scale = (float)features->config.scale;
+    double period_ns = 1e9 / features->config.sample_rate_hz;
+    unsigned int produced = 0, i;
+
+    for(i = 0; i < count; i++) {
+        float* slot = features->window[features->fill];
+
+        if(features->fill == 0) {
+            features->start_ns = timestamp_ns + (uint64_t)(i * period_ns);
+        }
+        slot[0] = samples[i].x * scale;
+        slot[1] = samples[i].y * scale;
+        slot[2] = samples[i].z * scale;
+        slot[3] = 0;
+
+        if(++features->fill == features->config.window) {
+            features->fill = 0;
+            if(produced < max) {
+                mma8451_feature_record* record = &records[produced++];
+                record->timestamp_ns = features->start_ns;
+                record->sequence = features->sequence;
+                mma8451_features_compute(features, record);
+            }
+            features->sequence++;
+        }
+    }
+
+    return produced;
+}
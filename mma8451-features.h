@@ -0,0 +1,175 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_FEATURES_H
+#define MMA8451_FEATURES_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The smallest window, a power of two.
+ */
+#define MMA8451_FEATURES_MIN_WINDOW 64
+/**
+ * The largest window, a power of two.
+ */
+#define MMA8451_FEATURES_MAX_WINDOW 4096
+/**
+ * The maximum number of frequency bands per record.
+ */
+#define MMA8451_FEATURES_MAX_BANDS 8
+
+/**
+ * This structure configures a feature extractor.
+ */
+typedef struct mma8451_features_config {
+	/**
+	 * Samples per window, a power of two from MMA8451_FEATURES_MIN_WINDOW to
+	 * MMA8451_FEATURES_MAX_WINDOW. Windows don't overlap.
+	 */
+	unsigned int window;
+	/**
+	 * The sample rate in hz, e.g. the device's data rate.
+	 */
+	double sample_rate_hz;
+	/**
+	 * Meters per second squared per count.
+	 */
+	double scale;
+	/**
+	 * The number of bands, 0 for the ISO 10816 style decades 2-10, 10-100 and 100-1000 hz
+	 * cut off at the Nyquist frequency.
+	 */
+	unsigned int bands;
+	/**
+	 * The band edges in hz, bands + 1 ascending values. Band i covers
+	 * [band_edges_hz[i], band_edges_hz[i + 1]).
+	 */
+	float band_edges_hz[MMA8451_FEATURES_MAX_BANDS + 1];
+} mma8451_features_config;
+
+/**
+ * This structure contains the features of one axis over one window.
+ */
+typedef struct mma8451_feature_axis {
+	/**
+	 * The mean (static) acceleration in m/s^2.
+	 */
+	float mean;
+	/**
+	 * RMS of the acceleration around the mean in m/s^2.
+	 */
+	float rms;
+	/**
+	 * The largest deviation from the mean in m/s^2.
+	 */
+	float peak;
+	/**
+	 * peak / rms, 0 for a constant signal.
+	 */
+	float crest_factor;
+	/**
+	 * The third standardized moment, 0 for symmetric signals.
+	 */
+	float skewness;
+	/**
+	 * The fourth standardized moment, 3 for Gaussian noise, higher for impacts.
+	 */
+	float kurtosis;
+	/**
+	 * Power weighted mean frequency of the spectrum in hz.
+	 */
+	float centroid_hz;
+	/**
+	 * RMS vibration velocity from 10 hz up in mm/s, integrated in the frequency domain as
+	 * ISO 10816 severity is rated.
+	 */
+	float velocity_rms;
+	/**
+	 * Mean square acceleration per band in (m/s^2)^2, the bands sum to rms^2 over the
+	 * frequencies they cover.
+	 */
+	float bands[MMA8451_FEATURES_MAX_BANDS];
+} mma8451_feature_axis;
+
+/**
+ * This structure contains a fixed-size feature record for one window.
+ */
+typedef struct mma8451_feature_record {
+	/**
+	 * Time of the window's first sample in nanoseconds, from the block timestamps.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * The window number, counting from 0.
+	 */
+	uint32_t sequence;
+	/**
+	 * Samples in the window.
+	 */
+	uint16_t samples;
+	/**
+	 * The number of valid entries in each axis' bands.
+	 */
+	uint16_t bands;
+	/**
+	 * Features for X, Y and Z.
+	 */
+	mma8451_feature_axis axes[3];
+} mma8451_feature_record;
+
+/**
+ * An opaque feature extractor.
+ */
+typedef struct mma8451_features mma8451_features;
+
+/**
+ * This function creates a feature extractor.
+ * @param config The configuration.
+ * @return The extractor or NULL if there was an error.
+ */
+mma8451_features* mma8451_features_create(const mma8451_features_config* config);
+/**
+ * This function frees a feature extractor.
+ * @param features The extractor to free.
+ */
+void mma8451_features_destroy(mma8451_features* features);
+/**
+ * This function adds a block of samples, emitting a record for each window it completes.
+ * @param features The extractor.
+ * @param samples The samples in counts.
+ * @param count Number of samples.
+ * @param timestamp_ns Time of the first sample in nanoseconds, later samples are placed at
+ *                     the configured rate.
+ * @param records Records to fill.
+ * @param max Size of records, a block completes at most count / window + 1 windows.
+ * @return The number of records written. Windows that don't fit are dropped.
+ */
+unsigned int mma8451_features_process(mma8451_features* features, const mma8451_raw_sample* samples, unsigned int count, uint64_t timestamp_ns, mma8451_feature_record* records, unsigned int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
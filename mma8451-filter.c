@@ -0,0 +1,105 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-filter.h"
+#include <stddef.h>
+#include <errno.h>
+#include <math.h>
+
+int mma8451_highpass_init(mma8451_highpass* filter, double cutoff_hz, double sample_rate_hz) {
+    double w0, alpha, cosw, a0;
+
+    if(cutoff_hz <= 0 || sample_rate_hz <= 0 || cutoff_hz >= sample_rate_hz / 2) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    w0 = 2 * M_PI * cutoff_hz / sample_rate_hz;
+    cosw = cos(w0);
+    //Q of 1/sqrt(2) for a Butterworth response.
+    alpha = sin(w0) * M_SQRT1_2;
+    a0 = 1 + alpha;
+
+    filter->b0 = (float)((1 + cosw) / 2 / a0);
+    filter->b1 = (float)(-(1 + cosw) / a0);
+    filter->b2 = filter->b0;
+    filter->a1 = (float)(-2 * cosw / a0);
+    filter->a2 = (float)((1 - alpha) / a0);
+    mma8451_highpass_reset(filter);
+
+    return 1;
+}
+
+void mma8451_highpass_reset(mma8451_highpass* filter) {
+    unsigned int lane;
+
+    for(lane = 0; lane < 4; lane++) {
+        filter->z1[lane] = 0;
+        filter->z2[lane] = 0;
+    }
+    filter->primed = 0;
+}
+
+void mma8451_highpass_process(mma8451_highpass* filter, const mma8451_raw_sample* samples, unsigned int count, float* ac, float* dc) {
+    float b0 = filter->b0, b1 = filter->b1, b2 = filter->b2, a1 = filter->a1, a2 = filter->a2;
+    float z1[4], z2[4];
+    unsigned int i, lane;
+
+    for(lane = 0; lane < 4; lane++) {
+        z1[lane] = filter->z1[lane];
+        z2[lane] = filter->z2[lane];
+    }
+
+    if(!filter->primed && count > 0) {
+        //The steady state for a constant input x with zero output.
+        float first[4] = { samples[0].x, samples[0].y, samples[0].z, 0 };
+        for(lane = 0; lane < 4; lane++) {
+            z2[lane] = b2 * first[lane];
+            z1[lane] = b1 * first[lane] + z2[lane];
+        }
+        filter->primed = 1;
+    }
+
+    for(i = 0; i < count; i++) {
+        float x[4] = { samples[i].x, samples[i].y, samples[i].z, 0 };
+        float y[4];
+
+        //One sample of all axes at a time, the lanes map onto a single vector register.
+        for(lane = 0; lane < 4; lane++) {
+            y[lane] = b0 * x[lane] + z1[lane];
+            z1[lane] = b1 * x[lane] - a1 * y[lane] + z2[lane];
+            z2[lane] = b2 * x[lane] - a2 * y[lane];
+        }
+
+        ac[i * 3] = y[0];
+        ac[i * 3 + 1] = y[1];
+        ac[i * 3 + 2] = y[2];
+        if(dc != NULL) {
+            dc[i * 3] = x[0] - y[0];
+            dc[i * 3 + 1] = x[1] - y[1];
+            dc[i * 3 + 2] = x[2] - y[2];
+        }
+    }
+
+    for(lane = 0; lane < 4; lane++) {
+        filter->z1[lane] = z1[lane];
+        filter->z2[lane] = z2[lane];
+    }
+}
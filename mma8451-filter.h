@@ -0,0 +1,77 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_FILTER_H
+#define MMA8451_FILTER_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This structure contains a second order (biquad) high-pass filter applied to X, Y and Z.
+ * The axes are processed as lanes of one vector, the fourth lane is padding.
+ */
+typedef struct mma8451_highpass {
+	/**
+	 * Normalized coefficients.
+	 */
+	float b0, b1, b2, a1, a2;
+	/**
+	 * Transposed direct form II state per axis.
+	 */
+	float z1[4], z2[4];
+	/**
+	 * Whether or not the state has been set from a first sample.
+	 */
+	unsigned char primed;
+} mma8451_highpass;
+
+/**
+ * This function initializes a Butterworth high-pass filter.
+ * @param filter The filter to initialize.
+ * @param cutoff_hz The -3dB cutoff.
+ * @param sample_rate_hz The sample rate, e.g. the device's data rate.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_highpass_init(mma8451_highpass* filter, double cutoff_hz, double sample_rate_hz);
+/**
+ * This function clears a filter's state, the next sample is treated as the first.
+ * @param filter The filter to reset.
+ */
+void mma8451_highpass_reset(mma8451_highpass* filter);
+/**
+ * This function filters a block of samples. The state starts settled on the first sample so
+ * gravity doesn't cause a start-up transient.
+ * @param filter The filter.
+ * @param samples The samples in counts.
+ * @param count Number of samples.
+ * @param ac The high-pass (vibration) component in counts, x, y, z interleaved, 3 * count values.
+ * @param dc The remaining low frequency (gravity) component, same layout, optional.
+ */
+void mma8451_highpass_process(mma8451_highpass* filter, const mma8451_raw_sample* samples, unsigned int count, float* ac, float* dc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
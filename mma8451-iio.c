@@ -0,0 +1,548 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-iio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <limits.h>
+
+/**
+ * The scan elements used, in the order they are decoded.
+ */
+enum {
+    MMA8451_IIO_X = 0,
+    MMA8451_IIO_Y,
+    MMA8451_IIO_Z,
+    MMA8451_IIO_TIMESTAMP,
+    MMA8451_IIO_CHANNELS
+};
+
+static const char* mma8451_iio_channel_names[MMA8451_IIO_CHANNELS] = {
+    "in_accel_x", "in_accel_y", "in_accel_z", "in_timestamp"
+};
+
+/**
+ * Values written to in_accel_sampling_frequency for each mma8451_data_rate.
+ */
+static const char* mma8451_iio_rates[] = {
+    "800", "400", "200", "100", "50", "12.5", "6.25", "1.56"
+};
+
+/**
+ * The layout of one scan element, from its _index and _type attributes.
+ */
+typedef struct mma8451_iio_channel {
+    unsigned int index;
+    unsigned int offset;
+    unsigned int bytes;
+    unsigned int bits;
+    unsigned int shift;
+    int big_endian;
+    int is_signed;
+} mma8451_iio_channel;
+
+struct mma8451_iio {
+    char sysfs[PATH_MAX];
+    char dev[PATH_MAX];
+    int fd;
+    mma8451_iio_channel channels[MMA8451_IIO_CHANNELS];
+    unsigned int record;
+    unsigned char* buf;
+    unsigned int capacity;
+    unsigned int have;
+    uint64_t period_ns;
+    uint64_t last_ns;
+    uint64_t sequence;
+};
+
+static int mma8451_iio_write(mma8451_iio* iio, const char* attr, const char* value) {
+    char path[PATH_MAX];
+    size_t len = strlen(value);
+    ssize_t written;
+    int fd;
+
+    if(snprintf(path, sizeof(path), "%s/%s", iio->sysfs, attr) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    fd = open(path, O_WRONLY | O_TRUNC);
+    if(fd < 0) {
+        return 0;
+    }
+    written = write(fd, value, len);
+    close(fd);
+    if(written != (ssize_t)len) {
+        if(written >= 0) {
+            errno = EIO;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static int mma8451_iio_write_uint(mma8451_iio* iio, const char* attr, unsigned int value) {
+    char text[16];
+
+    snprintf(text, sizeof(text), "%u", value);
+    return mma8451_iio_write(iio, attr, text);
+}
+
+/**
+ * Reads an attribute, without its trailing newline.
+ */
+static int mma8451_iio_read_attr(const char* dir, const char* attr, char* buf, size_t size) {
+    char path[PATH_MAX];
+    ssize_t len;
+    int fd;
+
+    if(snprintf(path, sizeof(path), "%s/%s", dir, attr) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if(len < 0) {
+        return 0;
+    }
+    while(len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ')) {
+        len--;
+    }
+    buf[len] = '\0';
+    return 1;
+}
+
+mma8451_iio* mma8451_iio_open(const char* sysfs, const char* dev) {
+    mma8451_iio* iio;
+    char name[64];
+    const char* base;
+    int length;
+
+    iio = (mma8451_iio*)calloc(1, sizeof(mma8451_iio));
+    if(iio == NULL) {
+        return NULL;
+    }
+    iio->fd = -1;
+
+    base = strrchr(sysfs, '/');
+    base = (base != NULL) ? base + 1 : sysfs;
+    length = dev != NULL ? snprintf(iio->dev, sizeof(iio->dev), "%s", dev) : snprintf(iio->dev, sizeof(iio->dev), "/dev/%s", base);
+    if(length >= (int)sizeof(iio->dev) || snprintf(iio->sysfs, sizeof(iio->sysfs), "%s", sysfs) >= (int)sizeof(iio->sysfs)) {
+        free(iio);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    //The mma8452 driver names the device after the part.
+    if(!mma8451_iio_read_attr(iio->sysfs, "name", name, sizeof(name))) {
+        free(iio);
+        return NULL;
+    }
+    if(strcmp(name, "mma8451") != 0) {
+        free(iio);
+        errno = EOPNOTSUPP;
+        return NULL;
+    }
+
+    return iio;
+}
+
+int mma8451_iio_set_data_rate(mma8451_iio* iio, mma8451_data_rate rate) {
+    if((unsigned int)rate >= sizeof(mma8451_iio_rates) / sizeof(mma8451_iio_rates[0])) {
+        errno = EINVAL;
+        return 0;
+    }
+    return mma8451_iio_write(iio, "in_accel_sampling_frequency", mma8451_iio_rates[rate]);
+}
+
+int mma8451_iio_get_data_rate(mma8451_iio* iio, mma8451_data_rate* rate) {
+    char text[32];
+    double hz, best = 0;
+    unsigned int i;
+
+    if(!mma8451_iio_read_attr(iio->sysfs, "in_accel_sampling_frequency", text, sizeof(text))) {
+        return 0;
+    }
+    hz = strtod(text, NULL);
+    *rate = MMA8451_DATA_RATE_800HZ;
+    for(i = 0; i < sizeof(mma8451_iio_rates) / sizeof(mma8451_iio_rates[0]); i++) {
+        double rate_hz = 1e9 / mma8451_data_rate_period_ns((mma8451_data_rate)i);
+        double error = hz > rate_hz ? hz - rate_hz : rate_hz - hz;
+        if(i == 0 || error < best) {
+            best = error;
+            *rate = (mma8451_data_rate)i;
+        }
+    }
+    return 1;
+}
+
+int mma8451_iio_set_range(mma8451_iio* iio, mma8451_range_scale range) {
+    char available[128];
+    char* token;
+    char* save;
+    unsigned int i = 0;
+
+    //The driver lists its scales from 2G to 8G.
+    if(!mma8451_iio_read_attr(iio->sysfs, "in_accel_scale_available", available, sizeof(available))) {
+        return 0;
+    }
+    for(token = strtok_r(available, " ", &save); token != NULL; token = strtok_r(NULL, " ", &save), i++) {
+        if(i == (unsigned int)range) {
+            return mma8451_iio_write(iio, "in_accel_scale", token);
+        }
+    }
+    errno = EINVAL;
+    return 0;
+}
+
+double mma8451_iio_scale(mma8451_iio* iio) {
+    char text[32];
+
+    if(!mma8451_iio_read_attr(iio->sysfs, "in_accel_scale", text, sizeof(text))) {
+        return 0;
+    }
+    return strtod(text, NULL);
+}
+
+/**
+ * Reads a scan element's _index and _type, e.g. "be:s14/16>>2".
+ */
+static int mma8451_iio_read_channel(mma8451_iio* iio, const char* name, mma8451_iio_channel* channel) {
+    char attr[64];
+    char text[32];
+    char endian, sign;
+
+    snprintf(attr, sizeof(attr), "scan_elements/%s_index", name);
+    if(!mma8451_iio_read_attr(iio->sysfs, attr, text, sizeof(text))) {
+        return 0;
+    }
+    channel->index = (unsigned int)strtoul(text, NULL, 10);
+
+    snprintf(attr, sizeof(attr), "scan_elements/%s_type", name);
+    if(!mma8451_iio_read_attr(iio->sysfs, attr, text, sizeof(text))) {
+        return 0;
+    }
+    channel->shift = 0;
+    if(sscanf(text, "%ce:%c%u/%u>>%u", &endian, &sign, &channel->bits, &channel->bytes, &channel->shift) < 4 ||
+       (channel->bytes != 8 && channel->bytes != 16 && channel->bytes != 32 && channel->bytes != 64) ||
+       channel->bits == 0 || channel->bits > channel->bytes) {
+        errno = EPROTO;
+        return 0;
+    }
+    channel->bytes /= 8;
+    channel->big_endian = (endian == 'b');
+    channel->is_signed = (sign == 's');
+    return 1;
+}
+
+/**
+ * Lays out the enabled scan elements by index, each aligned to its own size and the record
+ * padded to the largest.
+ */
+static void mma8451_iio_layout(mma8451_iio* iio) {
+    unsigned int offset = 0, align = 1, placed, i;
+    int last = -1;
+
+    for(placed = 0; placed < MMA8451_IIO_CHANNELS; placed++) {
+        mma8451_iio_channel* next = NULL;
+
+        for(i = 0; i < MMA8451_IIO_CHANNELS; i++) {
+            mma8451_iio_channel* channel = &iio->channels[i];
+            if((int)channel->index > last && (next == NULL || channel->index < next->index)) {
+                next = channel;
+            }
+        }
+        offset = (offset + next->bytes - 1) / next->bytes * next->bytes;
+        next->offset = offset;
+        offset += next->bytes;
+        align = next->bytes > align ? next->bytes : align;
+        last = (int)next->index;
+    }
+    iio->record = (offset + align - 1) / align * align;
+}
+
+/**
+ * Finds the trigger the driver registered for the device, named "<name>-dev<N>".
+ */
+static int mma8451_iio_find_trigger(mma8451_iio* iio, char* trigger, size_t size) {
+    char parent[PATH_MAX];
+    char dir[PATH_MAX];
+    char name[64];
+    char* slash;
+    struct dirent* entry;
+    DIR* listing;
+
+    if(!mma8451_iio_read_attr(iio->sysfs, "name", name, sizeof(name))) {
+        return 0;
+    }
+    strcpy(parent, iio->sysfs);
+    slash = strrchr(parent, '/');
+    if(slash != NULL) {
+        *slash = '\0';
+    } else {
+        strcpy(parent, ".");
+    }
+
+    listing = opendir(parent);
+    if(listing == NULL) {
+        return 0;
+    }
+    while((entry = readdir(listing)) != NULL) {
+        if(strncmp(entry->d_name, "trigger", 7) != 0 ||
+           snprintf(dir, sizeof(dir), "%s/%s", parent, entry->d_name) >= (int)sizeof(dir) ||
+           !mma8451_iio_read_attr(dir, "name", trigger, size)) {
+            continue;
+        }
+        if(strncmp(trigger, name, strlen(name)) == 0 && strncmp(trigger + strlen(name), "-dev", 4) == 0) {
+            closedir(listing);
+            return 1;
+        }
+    }
+    closedir(listing);
+    errno = ENOENT;
+    return 0;
+}
+
+/**
+ * Disables the first count scan elements, keeping errno.
+ */
+static void mma8451_iio_disable_scan(mma8451_iio* iio, unsigned int count) {
+    char attr[64];
+    int err = errno;
+    unsigned int i;
+
+    for(i = 0; i < count; i++) {
+        snprintf(attr, sizeof(attr), "scan_elements/%s_en", mma8451_iio_channel_names[i]);
+        mma8451_iio_write(iio, attr, "0");
+    }
+    errno = err;
+}
+
+/**
+ * Sets up the trigger, timestamps and buffer once the scan elements are enabled.
+ */
+static int mma8451_iio_start_buffer(mma8451_iio* iio, unsigned int length, unsigned int watermark) {
+    char trigger[64];
+    mma8451_data_rate rate;
+
+    if(!mma8451_iio_read_attr(iio->sysfs, "trigger/current_trigger", trigger, sizeof(trigger))) {
+        return 0;
+    }
+    if(trigger[0] == '\0' && (!mma8451_iio_find_trigger(iio, trigger, sizeof(trigger)) || !mma8451_iio_write(iio, "trigger/current_trigger", trigger))) {
+        return 0;
+    }
+
+    //Timestamps default to CLOCK_REALTIME, the rest of the library uses CLOCK_MONOTONIC. Older
+    //kernels don't have the attribute and always use CLOCK_REALTIME.
+    mma8451_iio_write(iio, "current_timestamp_clock", "monotonic");
+
+    if(!mma8451_iio_get_data_rate(iio, &rate)) {
+        return 0;
+    }
+    iio->period_ns = mma8451_data_rate_period_ns(rate);
+
+    if(!mma8451_iio_write_uint(iio, "buffer/length", length)) {
+        return 0;
+    }
+    if(watermark != 0 && !mma8451_iio_write_uint(iio, "buffer/watermark", watermark) && errno != ENOENT) {
+        return 0;
+    }
+
+    free(iio->buf);
+    iio->buf = (unsigned char*)malloc((size_t)length * iio->record);
+    if(iio->buf == NULL) {
+        return 0;
+    }
+    iio->capacity = length;
+    iio->have = 0;
+    iio->last_ns = 0;
+
+    if(!mma8451_iio_write(iio, "buffer/enable", "1")) {
+        return 0;
+    }
+    iio->fd = open(iio->dev, O_RDONLY | O_NONBLOCK);
+    if(iio->fd < 0) {
+        int err = errno;
+        mma8451_iio_write(iio, "buffer/enable", "0");
+        errno = err;
+        return 0;
+    }
+    return 1;
+}
+
+int mma8451_iio_start(mma8451_iio* iio, unsigned int length, unsigned int watermark) {
+    char attr[64];
+    unsigned int i;
+
+    if(iio->fd >= 0 || length == 0) {
+        errno = (iio->fd >= 0) ? EBUSY : EINVAL;
+        return 0;
+    }
+
+    for(i = 0; i < MMA8451_IIO_CHANNELS; i++) {
+        snprintf(attr, sizeof(attr), "scan_elements/%s_en", mma8451_iio_channel_names[i]);
+        if(!mma8451_iio_write(iio, attr, "1")) {
+            mma8451_iio_disable_scan(iio, i);
+            return 0;
+        }
+        if(!mma8451_iio_read_channel(iio, mma8451_iio_channel_names[i], &iio->channels[i])) {
+            mma8451_iio_disable_scan(iio, i + 1);
+            return 0;
+        }
+    }
+    mma8451_iio_layout(iio);
+
+    //Leave the device as it was found if the buffer can't be started.
+    if(!mma8451_iio_start_buffer(iio, length, watermark)) {
+        mma8451_iio_disable_scan(iio, MMA8451_IIO_CHANNELS);
+        return 0;
+    }
+    return 1;
+}
+
+static int64_t mma8451_iio_value(const mma8451_iio_channel* channel, const unsigned char* record) {
+    const unsigned char* p = record + channel->offset;
+    uint64_t value = 0;
+    unsigned int i;
+
+    for(i = 0; i < channel->bytes; i++) {
+        if(channel->big_endian) {
+            value = (value << 8) | p[i];
+        } else {
+            value |= (uint64_t)p[i] << (8 * i);
+        }
+    }
+    value >>= channel->shift;
+    if(channel->bits < 64) {
+        value &= (1ULL << channel->bits) - 1;
+        if(channel->is_signed && (value >> (channel->bits - 1))) {
+            value |= ~((1ULL << channel->bits) - 1);
+        }
+    }
+    return (int64_t)value;
+}
+
+unsigned int mma8451_iio_read(mma8451_iio* iio, mma8451_sample* samples, uint64_t* timestamps, unsigned int max, int timeout_ms) {
+    unsigned int want, count, i;
+
+    if(iio->fd < 0 || max == 0) {
+        errno = EINVAL;
+        return 0;
+    }
+    want = (max < iio->capacity ? max : iio->capacity) * iio->record;
+
+    while(iio->have < iio->record) {
+        struct pollfd pfd;
+        ssize_t n;
+        int ready;
+
+        pfd.fd = iio->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ready = poll(&pfd, 1, timeout_ms);
+        if(ready == 0) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        if(ready < 0) {
+            return 0;
+        }
+
+        //The kernel hands over whole scans, a pipe may split them.
+        n = read(iio->fd, iio->buf + iio->have, want - iio->have);
+        if(n < 0) {
+            if(errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        if(n == 0) {
+            errno = EPIPE;
+            return 0;
+        }
+        iio->have += (unsigned int)n;
+    }
+
+    count = iio->have / iio->record;
+    if(count > max) {
+        count = max;
+    }
+    for(i = 0; i < count; i++) {
+        const unsigned char* record = iio->buf + (size_t)i * iio->record;
+        uint64_t timestamp = (uint64_t)mma8451_iio_value(&iio->channels[MMA8451_IIO_TIMESTAMP], record);
+        mma8451_sample* sample = &samples[i];
+
+        sample->flags = 0;
+        if(iio->last_ns != 0 && timestamp > iio->last_ns && iio->period_ns != 0) {
+            //The kernel drops scans silently when its buffer is full, find the gaps by time.
+            uint64_t periods = (timestamp - iio->last_ns + iio->period_ns / 2) / iio->period_ns;
+            if(periods > 1) {
+                iio->sequence += periods - 1;
+                sample->flags |= MMA8451_SAMPLE_GAP;
+            }
+        }
+        iio->last_ns = timestamp;
+
+        sample->raw.x = (int16_t)mma8451_iio_value(&iio->channels[MMA8451_IIO_X], record);
+        sample->raw.y = (int16_t)mma8451_iio_value(&iio->channels[MMA8451_IIO_Y], record);
+        sample->raw.z = (int16_t)mma8451_iio_value(&iio->channels[MMA8451_IIO_Z], record);
+        sample->status = MMA8451_STATUS_ZYXDR_MASK;
+        sample->sequence = iio->sequence++;
+        if(timestamps != NULL) {
+            timestamps[i] = timestamp;
+        }
+    }
+
+    iio->have -= count * iio->record;
+    memmove(iio->buf, iio->buf + (size_t)count * iio->record, iio->have);
+    return count;
+}
+
+int mma8451_iio_fd(mma8451_iio* iio) {
+    return iio->fd;
+}
+
+int mma8451_iio_stop(mma8451_iio* iio) {
+    if(iio->fd < 0) {
+        return 1;
+    }
+    close(iio->fd);
+    iio->fd = -1;
+    iio->have = 0;
+    return mma8451_iio_write(iio, "buffer/enable", "0");
+}
+
+void mma8451_iio_close(mma8451_iio* iio) {
+    if(iio == NULL) {
+        return;
+    }
+    mma8451_iio_stop(iio);
+    free(iio->buf);
+    free(iio);
+}
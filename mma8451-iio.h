@@ -0,0 +1,123 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_IIO_H
+#define MMA8451_IIO_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The default sysfs directory of IIO devices.
+ */
+#define MMA8451_IIO_SYSFS "/sys/bus/iio/devices"
+
+/**
+ * An opaque handle to an accelerometer driven by the kernel's mma8452 IIO driver. It is not a
+ * mma8451 handle: the kernel owns the bus and the registers, so the register level mma8451_*
+ * functions, the pacer and mma8451_read_sample() have nothing to act on. The same data rate,
+ * range and sample types are used so code above the read loop is shared.
+ */
+typedef struct mma8451_iio mma8451_iio;
+
+/**
+ * This function opens an accelerometer bound to the mma8452 IIO driver. Nothing is changed
+ * until it is configured or started.
+ * @param sysfs The device's sysfs directory, e.g. "/sys/bus/iio/devices/iio:device0".
+ * @param dev The buffer character device, or NULL for "/dev/" followed by the sysfs
+ *            directory's name.
+ * @return The handle or NULL if there was an error.
+ */
+mma8451_iio* mma8451_iio_open(const char* sysfs, const char* dev);
+/**
+ * This function sets the output data rate through in_accel_sampling_frequency.
+ * @param iio Device to configure, the buffer must be stopped.
+ * @param rate The data rate.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_iio_set_data_rate(mma8451_iio* iio, mma8451_data_rate rate);
+/**
+ * This function gets the output data rate from in_accel_sampling_frequency.
+ * @param iio Device to query.
+ * @param rate Set to the nearest data rate.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_iio_get_data_rate(mma8451_iio* iio, mma8451_data_rate* rate);
+/**
+ * This function sets the range through in_accel_scale.
+ * @param iio Device to configure, the buffer must be stopped.
+ * @param range The range.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_iio_set_range(mma8451_iio* iio, mma8451_range_scale range);
+/**
+ * This function gets the scale the driver reports for the samples.
+ * @param iio Device to query.
+ * @return Meters per second squared per count, 0 if there was an error.
+ */
+double mma8451_iio_scale(mma8451_iio* iio);
+/**
+ * This function enables the X, Y, Z and timestamp scan elements with the device's own
+ * trigger and CLOCK_MONOTONIC timestamps, then enables the buffer and opens its character
+ * device. If any step fails the scan elements are disabled again.
+ * @param iio Device to start.
+ * @param length The kernel buffer length in samples.
+ * @param watermark Samples the kernel collects before waking a reader, 0 for the driver's
+ *                  default. Ignored by kernels without buffer watermarks.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_iio_start(mma8451_iio* iio, unsigned int length, unsigned int watermark);
+/**
+ * This function reads as many buffered samples as are available, up to max, with one read().
+ * Sequence numbers count samples and skip over gaps seen in the timestamps.
+ * @param iio Started device.
+ * @param samples Samples to fill.
+ * @param timestamps Set to each sample's CLOCK_MONOTONIC timestamp in nanoseconds, may be NULL.
+ * @param max Size of the buffers.
+ * @param timeout_ms Milliseconds to wait for a sample, negative to wait forever.
+ * @return The number of samples read, 0 if failure (errno is ETIMEDOUT on timeout).
+ */
+unsigned int mma8451_iio_read(mma8451_iio* iio, mma8451_sample* samples, uint64_t* timestamps, unsigned int max, int timeout_ms);
+/**
+ * This function gets the buffer character device's file descriptor, e.g. for poll().
+ * @param iio Started device.
+ * @return The file descriptor or -1 if not started.
+ */
+int mma8451_iio_fd(mma8451_iio* iio);
+/**
+ * This function disables the buffer and closes its character device.
+ * @param iio Device to stop.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_iio_stop(mma8451_iio* iio);
+/**
+ * This function stops the device if needed and frees the handle.
+ * @param iio Device to close.
+ */
+void mma8451_iio_close(mma8451_iio* iio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-plan.h"
+#include <stddef.h>
+#include <errno.h>
+
+/**
+ * Output data rate in hz of a mma8451_data_rate.
+ */
+static double mma8451_plan_rate(int rate) {
+    return 1e9 / mma8451_data_rate_period_ns((mma8451_data_rate)rate);
+}
+
+/**
+ * Bits on the wire for a register read of n bytes: start, address, register, repeated start,
+ * address, n data bytes (each with its acknowledge bit) and stop.
+ */
+static double mma8451_plan_read_bits(unsigned int n) {
+    return 1 + 9 + 9 + 1 + 9 + 9.0 * n + 1;
+}
+
+/**
+ * Computes the cost of a device's configuration. Each drain is one F_STATUS read followed by
+ * one burst read of watermark samples.
+ */
+static void mma8451_plan_cost(const mma8451_plan_bus* bus, mma8451_plan_device* planned) {
+    double odr = mma8451_plan_rate(planned->data_rate);
+    unsigned int bytes = (planned->output_size == MMA8451_8BIT_OUTPUT) ? 3 : 6;
+    double drain_us;
+
+    drain_us = (mma8451_plan_read_bits(1) + mma8451_plan_read_bits(planned->watermark * bytes)) * 1e6 / bus->clock_hz;
+    drain_us += 2 * bus->overhead_us;
+
+    planned->drain_period_us = planned->watermark * 1e6 / odr;
+    planned->latency_us = planned->drain_period_us + drain_us;
+    planned->utilization = drain_us / planned->drain_period_us;
+}
+
+/**
+ * Picks the largest watermark whose drain period plus drain time fits the latency budget.
+ */
+static void mma8451_plan_fit(const mma8451_plan_bus* bus, const mma8451_plan_request* request, mma8451_plan_device* planned) {
+    double depth = request->latency_us * mma8451_plan_rate(planned->data_rate) / 1e6;
+
+    if(depth > 32 - MMA8451_PLAN_FIFO_HEADROOM) {
+        depth = 32 - MMA8451_PLAN_FIFO_HEADROOM;
+    }
+    planned->watermark = (depth < 1) ? 1 : (unsigned char)depth;
+
+    mma8451_plan_cost(bus, planned);
+    while(planned->latency_us > request->latency_us && planned->watermark > 1) {
+        planned->watermark--;
+        mma8451_plan_cost(bus, planned);
+    }
+}
+
+int mma8451_plan_create(const mma8451_plan_bus* bus, const mma8451_plan_request* requests, unsigned int count, mma8451_plan* plan) {
+    unsigned int i;
+    int rate, unmet = 0;
+
+    if(bus->clock_hz == 0 || count > MMA8451_PLAN_MAX_DEVICES) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    plan->count = count;
+    plan->utilization = 0;
+    plan->feasible = 0;
+
+    for(i = 0; i < count; i++) {
+        mma8451_plan_device* planned = &plan->devices[i];
+
+        planned->device = requests[i].device;
+        planned->output_size = MMA8451_14BIT_OUTPUT;
+
+        //Slowest rate that still meets the request.
+        for(rate = MMA8451_DATA_RATE_1_56HZ; rate > MMA8451_DATA_RATE_800HZ; rate--) {
+            if(mma8451_plan_rate(rate) >= requests[i].odr_hz) {
+                break;
+            }
+        }
+        planned->data_rate = (mma8451_data_rate)rate;
+        mma8451_plan_fit(bus, &requests[i], planned);
+
+        //Faster rates fill the FIFO sooner, so step up until the latency budget is met.
+        while(planned->latency_us > requests[i].latency_us && rate > MMA8451_DATA_RATE_800HZ) {
+            planned->data_rate = (mma8451_data_rate)--rate;
+            mma8451_plan_fit(bus, &requests[i], planned);
+        }
+        if(mma8451_plan_rate(rate) < requests[i].odr_hz || planned->latency_us > requests[i].latency_us) {
+            unmet = 1;
+        }
+        plan->utilization += planned->utilization;
+    }
+
+    //Trade resolution for bandwidth, busiest device first.
+    while(plan->utilization > bus->max_utilization) {
+        mma8451_plan_device* busiest = NULL;
+        unsigned int index = 0;
+
+        for(i = 0; i < count; i++) {
+            if(requests[i].allow_8bit && plan->devices[i].output_size == MMA8451_14BIT_OUTPUT &&
+               (busiest == NULL || plan->devices[i].utilization > busiest->utilization)) {
+                busiest = &plan->devices[i];
+                index = i;
+            }
+        }
+        if(busiest == NULL) {
+            break;
+        }
+
+        plan->utilization -= busiest->utilization;
+        busiest->output_size = MMA8451_8BIT_OUTPUT;
+        mma8451_plan_fit(bus, &requests[index], busiest);
+        plan->utilization += busiest->utilization;
+    }
+
+    if(unmet) {
+        errno = ERANGE;
+        return 0;
+    }
+    if(plan->utilization > bus->max_utilization) {
+        errno = ENOSPC;
+        return 0;
+    }
+
+    plan->feasible = 1;
+    return 1;
+}
+
+int mma8451_plan_apply(const mma8451_plan* plan) {
+    unsigned int i;
+
+    for(i = 0; i < plan->count; i++) {
+        const mma8451_plan_device* planned = &plan->devices[i];
+        mma8451_register_f_setup setup;
+
+        if(!mma8451_set_active(planned->device, 0)) return 0;
+        if(!mma8451_set_output_size(planned->device, planned->output_size)) return 0;
+        if(!mma8451_set_data_rate(planned->device, planned->data_rate)) return 0;
+        if(!mma8451_get_f_setup(planned->device, &setup)) return 0;
+        setup.f_mode = MMA8451_FIFO_MODE_RING_BUFFER;
+        setup.f_wmrk = planned->watermark;
+        if(!mma8451_set_f_setup(planned->device, &setup)) return 0;
+        if(!mma8451_set_active(planned->device, 1)) return 0;
+    }
+
+    return 1;
+}
@@ -0,0 +1,162 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_PLAN_H
+#define MMA8451_PLAN_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The maximum number of devices in one plan.
+ */
+#define MMA8451_PLAN_MAX_DEVICES 16
+/**
+ * FIFO slots kept free above the watermark to absorb drain scheduling jitter.
+ */
+#define MMA8451_PLAN_FIFO_HEADROOM 4
+
+/**
+ * This structure describes the bus being planned for.
+ */
+typedef struct mma8451_plan_bus {
+	/**
+	 * The adapter's SCL clock in hz, e.g. 100000 or 400000.
+	 */
+	unsigned int clock_hz;
+	/**
+	 * Time the adapter is busy per transfer beyond the bits on the wire (driver setup,
+	 * clock stretching, gaps between messages), in microseconds.
+	 */
+	double overhead_us;
+	/**
+	 * The largest fraction of bus time the plan may use, e.g. 0.7.
+	 */
+	double max_utilization;
+} mma8451_plan_bus;
+
+/**
+ * This structure contains one device's requirements.
+ */
+typedef struct mma8451_plan_request {
+	/**
+	 * The device.
+	 */
+	mma8451* device;
+	/**
+	 * The minimum output data rate needed, in hz.
+	 */
+	double odr_hz;
+	/**
+	 * The longest a sample may wait before it has been read, in microseconds.
+	 */
+	double latency_us;
+	/**
+	 * Whether or not 8-bit output is acceptable if the bus needs the bandwidth.
+	 */
+	unsigned char allow_8bit;
+} mma8451_plan_request;
+
+/**
+ * This structure contains the planned configuration of one device.
+ */
+typedef struct mma8451_plan_device {
+	/**
+	 * The device.
+	 */
+	mma8451* device;
+	/**
+	 * The output data rate, the slowest that meets the request.
+	 */
+	mma8451_data_rate data_rate;
+	/**
+	 * The output size.
+	 */
+	mma8451_output_size output_size;
+	/**
+	 * The FIFO watermark, the FIFO should be drained when it is reached.
+	 */
+	unsigned char watermark;
+	/**
+	 * The interval between FIFO drains, in microseconds.
+	 */
+	double drain_period_us;
+	/**
+	 * The worst case time from a sample being taken to it being read, in microseconds.
+	 */
+	double latency_us;
+	/**
+	 * The fraction of bus time used by this device.
+	 */
+	double utilization;
+} mma8451_plan_device;
+
+/**
+ * This structure contains a bus plan.
+ */
+typedef struct mma8451_plan {
+	/**
+	 * The number of entries in devices.
+	 */
+	unsigned int count;
+	/**
+	 * The planned devices, in request order.
+	 */
+	mma8451_plan_device devices[MMA8451_PLAN_MAX_DEVICES];
+	/**
+	 * The projected fraction of bus time used by all devices.
+	 */
+	double utilization;
+	/**
+	 * Whether or not every request is met within max_utilization.
+	 */
+	unsigned char feasible;
+} mma8451_plan;
+
+/**
+ * This function plans output size, data rate and FIFO watermark for a set of devices sharing
+ * a bus. Each device gets the slowest data rate that meets its request and the largest
+ * watermark its latency budget allows, which minimizes transfers. If even a watermark of one
+ * misses the latency budget, faster data rates are tried in turn. If the bus is still
+ * oversubscribed devices that allow it are switched to 8-bit output, busiest first.
+ * @param bus The bus.
+ * @param requests The devices' requirements.
+ * @param count Number of requests, at most MMA8451_PLAN_MAX_DEVICES.
+ * @param plan The plan to fill. It is filled even if infeasible so the shortfall can be seen.
+ * @return 1 if the plan is feasible, 0 if not (errno ENOSPC if the bus is oversubscribed,
+ *         ERANGE if a request can't be met by any configuration, EINVAL for bad arguments).
+ */
+int mma8451_plan_create(const mma8451_plan_bus* bus, const mma8451_plan_request* requests, unsigned int count, mma8451_plan* plan);
+/**
+ * This function applies a plan: each device is put in standby, configured with the planned
+ * output size, data rate and a ring buffer FIFO with the planned watermark, and activated.
+ * @param plan The plan to apply.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_plan_apply(const mma8451_plan* plan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-proto.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+
+int mma8451_proto_connect(const char* path, mma8451_msg_hello* hello) {
+    struct sockaddr_un addr;
+    mma8451_frame frame;
+    int fd, err;
+
+    if(path == NULL) {
+        path = MMA8451_PROTO_SOCKET;
+    }
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if(!mma8451_proto_recv(fd, &frame, 0)) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if(frame.header.type != MMA8451_MSG_HELLO || frame.payload.hello.version != MMA8451_PROTO_VERSION) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    if(hello != NULL) {
+        *hello = frame.payload.hello;
+    }
+
+    return fd;
+}
+
+int mma8451_proto_send(int fd, uint16_t type, uint16_t device, const void* payload, uint32_t length, int flags) {
+    mma8451_frame_header header;
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t sent;
+
+    header.length = length;
+    header.type = type;
+    header.device = device;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (length > 0) ? 2 : 1;
+
+    do {
+        sent = sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+    } while(sent < 0 && errno == EINTR);
+
+    return sent == (ssize_t)(sizeof(header) + length);
+}
+
+int mma8451_proto_recv(int fd, mma8451_frame* frame, int flags) {
+    ssize_t received;
+
+    do {
+        received = recv(fd, frame, sizeof(*frame), flags);
+    } while(received < 0 && errno == EINTR);
+
+    if(received == 0) {
+        errno = ECONNRESET;
+        return 0;
+    }
+    if(received < 0) {
+        return 0;
+    }
+    if((size_t)received < sizeof(frame->header) || frame->header.length != received - sizeof(frame->header)) {
+        errno = EPROTO;
+        return 0;
+    }
+    if(frame->header.type == MMA8451_MSG_SAMPLES &&
+       (frame->header.length < offsetof(mma8451_msg_samples, data) ||
+        frame->payload.samples.count > MMA8451_PROTO_MAX_BATCH ||
+        frame->header.length < offsetof(mma8451_msg_samples, data) + frame->payload.samples.count * 3 * sizeof(int16_t))) {
+        errno = EPROTO;
+        return 0;
+    }
+
+    return 1;
+}
+
+double mma8451_proto_scale(uint8_t range, uint8_t output_size) {
+    int counts = (output_size == MMA8451_8BIT_OUTPUT) ? 0x40 : 0x1000;
+
+    if(range > MMA8451_RANGE_8G) {
+        return 0;
+    }
+    return GRAVITY_ACCEL / (counts >> range);
+}
+
+void mma8451_proto_stats(mma8451_msg_device_stats* out, const mma8451_stats* stats) {
+#if MMA8451_STATS_ERRNO_BUCKETS > 0 || MMA8451_STATS_LATENCY_BUCKETS > 0
+    unsigned int i;
+#endif
+#if MMA8451_STATS_LATENCY_BUCKETS > 0
+    unsigned int op;
+#endif
+
+    memset(out, 0, sizeof(*out));
+    out->ioctls = stats->ioctls;
+    out->bytes_read = stats->bytes_read;
+    out->bytes_written = stats->bytes_written;
+    out->errors = stats->errors;
+    out->retries = stats->retries;
+    out->fifo_overflows = stats->fifo_overflows;
+    out->samples = stats->samples;
+    out->duplicates = stats->duplicates;
+    out->overruns = stats->overruns;
+
+#if MMA8451_STATS_ERRNO_BUCKETS > 0
+    for(i = 0; i < MMA8451_STATS_ERRNO_BUCKETS; i++) {
+        unsigned int bucket = (i < MMA8451_PROTO_ERRNO_BUCKETS) ? i : MMA8451_PROTO_ERRNO_BUCKETS - 1;
+        out->errors_by_errno[bucket] += stats->errors_by_errno[i];
+    }
+#endif
+#if MMA8451_STATS_LATENCY_BUCKETS > 0
+    for(op = 0; op < MMA8451_STATS_OP_COUNT && op < MMA8451_PROTO_LATENCY_OPS; op++) {
+        for(i = 0; i < MMA8451_STATS_LATENCY_BUCKETS; i++) {
+            unsigned int bucket = (i < MMA8451_PROTO_LATENCY_BUCKETS) ? i : MMA8451_PROTO_LATENCY_BUCKETS - 1;
+            out->latency[op][bucket] += stats->latency[op][i];
+        }
+    }
+#endif
+}
@@ -0,0 +1,368 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_PROTO_H
+#define MMA8451_PROTO_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The protocol version reported in MMA8451_MSG_HELLO.
+ */
+#define MMA8451_PROTO_VERSION 2
+/**
+ * The default path of the daemon's socket.
+ */
+#define MMA8451_PROTO_SOCKET "/run/mma8451d.sock"
+/**
+ * The maximum number of samples in one MMA8451_MSG_SAMPLES frame.
+ */
+#define MMA8451_PROTO_MAX_BATCH 512
+/**
+ * The maximum number of devices a daemon serves.
+ */
+#define MMA8451_PROTO_MAX_DEVICES 8
+/**
+ * The number of errno buckets in mma8451_msg_device_stats, fixed by the protocol version.
+ */
+#define MMA8451_PROTO_ERRNO_BUCKETS 128
+/**
+ * The number of latency buckets per operation in mma8451_msg_device_stats, fixed by the
+ * protocol version.
+ */
+#define MMA8451_PROTO_LATENCY_BUCKETS 24
+/**
+ * The number of operations with a latency histogram in mma8451_msg_device_stats.
+ */
+#define MMA8451_PROTO_LATENCY_OPS 3
+/**
+ * Set in mma8451_msg_samples.flags when samples were lost between this batch and the previous
+ * one, e.g. because the FIFO overflowed.
+ */
+#define MMA8451_SAMPLES_GAP 0x0001
+
+/**
+ * The message types. Every message is a single SOCK_SEQPACKET datagram starting with a
+ * mma8451_frame_header, all fields are in host byte order.
+ */
+typedef enum mma8451_msg_type {
+	/**
+	 * Daemon to client on connect, payload mma8451_msg_hello.
+	 */
+	MMA8451_MSG_HELLO = 1,
+	/**
+	 * Client to daemon, start receiving MMA8451_MSG_SAMPLES for header.device. No payload.
+	 */
+	MMA8451_MSG_SUBSCRIBE = 2,
+	/**
+	 * Client to daemon, stop receiving samples for header.device. No payload.
+	 */
+	MMA8451_MSG_UNSUBSCRIBE = 3,
+	/**
+	 * Daemon to subscribers, payload mma8451_msg_samples.
+	 */
+	MMA8451_MSG_SAMPLES = 4,
+	/**
+	 * Client to daemon, request MMA8451_MSG_CONFIG for header.device. No payload.
+	 */
+	MMA8451_MSG_GET_CONFIG = 5,
+	/**
+	 * Client to daemon, reconfigure header.device, payload mma8451_msg_config (scale ignored).
+	 */
+	MMA8451_MSG_SET_CONFIG = 6,
+	/**
+	 * Daemon to client, payload mma8451_msg_config. Sent in reply to MMA8451_MSG_GET_CONFIG
+	 * and to the requester and every subscriber after a MMA8451_MSG_SET_CONFIG.
+	 */
+	MMA8451_MSG_CONFIG = 7,
+	/**
+	 * Client to daemon, request MMA8451_MSG_STATS for header.device. No payload.
+	 */
+	MMA8451_MSG_GET_STATS = 8,
+	/**
+	 * Daemon to client, payload mma8451_msg_stats.
+	 */
+	MMA8451_MSG_STATS = 9,
+	/**
+	 * Daemon to client when a request failed, payload mma8451_msg_error.
+	 */
+	MMA8451_MSG_ERROR = 10
+} mma8451_msg_type;
+
+/**
+ * The header at the start of every message.
+ */
+typedef struct mma8451_frame_header {
+	/**
+	 * The number of payload bytes following the header.
+	 */
+	uint32_t length;
+	/**
+	 * A mma8451_msg_type.
+	 */
+	uint16_t type;
+	/**
+	 * The index of the device the message refers to.
+	 */
+	uint16_t device;
+} mma8451_frame_header;
+
+/**
+ * Payload of MMA8451_MSG_HELLO.
+ */
+typedef struct mma8451_msg_hello {
+	/**
+	 * MMA8451_PROTO_VERSION of the daemon.
+	 */
+	uint16_t version;
+	/**
+	 * The number of devices, indexed from 0.
+	 */
+	uint16_t devices;
+	/**
+	 * The number of samples per MMA8451_MSG_SAMPLES frame.
+	 */
+	uint32_t batch;
+} mma8451_msg_hello;
+
+/**
+ * Payload of MMA8451_MSG_SAMPLES.
+ */
+typedef struct mma8451_msg_samples {
+	/**
+	 * The sequence number of the first sample, consecutive across frames unless samples were
+	 * dropped. After a FIFO overflow it skips the number of samples estimated lost from the
+	 * drain times, and the frame has MMA8451_SAMPLES_GAP set.
+	 */
+	uint64_t sequence;
+	/**
+	 * CLOCK_MONOTONIC time of the first sample in nanoseconds, sample i was taken at
+	 * timestamp_ns + i * period_ns.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * The sample period in nanoseconds.
+	 */
+	uint32_t period_ns;
+	/**
+	 * The number of samples in data.
+	 */
+	uint16_t count;
+	/**
+	 * MMA8451_SAMPLES_* flags.
+	 */
+	uint16_t flags;
+	/**
+	 * Interleaved x, y, z signed counts, count * 3 values. Multiply by the device's
+	 * mma8451_msg_config.scale for m/s^2.
+	 */
+	int16_t data[MMA8451_PROTO_MAX_BATCH * 3];
+} mma8451_msg_samples;
+
+/**
+ * Payload of MMA8451_MSG_CONFIG and MMA8451_MSG_SET_CONFIG.
+ */
+typedef struct mma8451_msg_config {
+	/**
+	 * Meters per second squared per count for the current range and output size.
+	 */
+	double scale;
+	/**
+	 * A mma8451_range_scale.
+	 */
+	uint8_t range;
+	/**
+	 * A mma8451_output_size.
+	 */
+	uint8_t output_size;
+	/**
+	 * A mma8451_data_rate.
+	 */
+	uint8_t data_rate;
+	/**
+	 * A mma8451_power_mode.
+	 */
+	uint8_t power_mode;
+	/**
+	 * Reserved, set to 0.
+	 */
+	uint32_t reserved;
+} mma8451_msg_config;
+
+/**
+ * The wire form of a device's mma8451_stats. Its layout is fixed by MMA8451_PROTO_VERSION
+ * rather than by how the library was built, see mma8451_proto_stats().
+ */
+typedef struct mma8451_msg_device_stats {
+	/**
+	 * I2C_RDWR or I2C_SMBUS ioctls issued, including retries.
+	 */
+	uint64_t ioctls;
+	/**
+	 * Bytes read from the bus.
+	 */
+	uint64_t bytes_read;
+	/**
+	 * Bytes written to the bus.
+	 */
+	uint64_t bytes_written;
+	/**
+	 * Transfers that failed after all retries.
+	 */
+	uint64_t errors;
+	/**
+	 * Transfers that were retried.
+	 */
+	uint64_t retries;
+	/**
+	 * FIFO overflows seen in F_STATUS.
+	 */
+	uint64_t fifo_overflows;
+	/**
+	 * Samples delivered.
+	 */
+	uint64_t samples;
+	/**
+	 * Reads that found no new sample.
+	 */
+	uint64_t duplicates;
+	/**
+	 * Samples overwritten before they were read.
+	 */
+	uint64_t overruns;
+	/**
+	 * Failed ioctls by errno, all zero if the daemon's library was built without them.
+	 */
+	uint32_t errors_by_errno[MMA8451_PROTO_ERRNO_BUCKETS];
+	/**
+	 * Log2 latency histograms in microseconds per mma8451_stats_op, all zero if the daemon's
+	 * library was built without them.
+	 */
+	uint32_t latency[MMA8451_PROTO_LATENCY_OPS][MMA8451_PROTO_LATENCY_BUCKETS];
+} mma8451_msg_device_stats;
+
+/**
+ * Payload of MMA8451_MSG_STATS.
+ */
+typedef struct mma8451_msg_stats {
+	/**
+	 * The sequence number of the next sample the device will publish.
+	 */
+	uint64_t sequence;
+	/**
+	 * Sample frames the daemon dropped for this client because its socket was full.
+	 */
+	uint64_t dropped_frames;
+	/**
+	 * The device's bus counters, see mma8451_get_stats().
+	 */
+	mma8451_msg_device_stats device;
+} mma8451_msg_stats;
+
+//Changing the size of a payload changes the protocol, MMA8451_PROTO_VERSION must follow.
+#ifdef __cplusplus
+static_assert(MMA8451_PROTO_VERSION != 2 || sizeof(mma8451_msg_stats) == 888, "mma8451_msg_stats changed, bump MMA8451_PROTO_VERSION");
+#else
+_Static_assert(MMA8451_PROTO_VERSION != 2 || sizeof(mma8451_msg_stats) == 888, "mma8451_msg_stats changed, bump MMA8451_PROTO_VERSION");
+#endif
+
+/**
+ * Payload of MMA8451_MSG_ERROR.
+ */
+typedef struct mma8451_msg_error {
+	/**
+	 * The errno of the failure.
+	 */
+	int32_t error;
+	/**
+	 * The mma8451_msg_type of the failed request.
+	 */
+	uint16_t request;
+	/**
+	 * Reserved, set to 0.
+	 */
+	uint16_t reserved;
+} mma8451_msg_error;
+
+/**
+ * A received message.
+ */
+typedef struct mma8451_frame {
+	mma8451_frame_header header;
+	union {
+		mma8451_msg_hello hello;
+		mma8451_msg_samples samples;
+		mma8451_msg_config config;
+		mma8451_msg_stats stats;
+		mma8451_msg_error error;
+	} payload;
+} mma8451_frame;
+
+/**
+ * This function connects to a daemon and reads its hello message.
+ * @param path Socket path, NULL for MMA8451_PROTO_SOCKET.
+ * @param hello Filled with the daemon's hello, may be NULL.
+ * @return The connected socket or -1 if there was an error.
+ */
+int mma8451_proto_connect(const char* path, mma8451_msg_hello* hello);
+/**
+ * This function sends one message.
+ * @param fd Connected socket.
+ * @param type A mma8451_msg_type.
+ * @param device Device index.
+ * @param payload Payload bytes, may be NULL if length is 0.
+ * @param length Payload length.
+ * @param flags Flags for send(), e.g. MSG_DONTWAIT.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_proto_send(int fd, uint16_t type, uint16_t device, const void* payload, uint32_t length, int flags);
+/**
+ * This function receives one message with a single system call. Sample frames carry a whole
+ * batch, so a subscriber makes one call per batch rather than per sample.
+ * @param fd Connected socket.
+ * @param frame Filled with the message.
+ * @param flags Flags for recv(), e.g. MSG_DONTWAIT.
+ * @return 1 if successful, 0 if failure or the peer closed the connection (errno ECONNRESET).
+ */
+int mma8451_proto_recv(int fd, mma8451_frame* frame, int flags);
+/**
+ * This function gets the scale for a range and output size.
+ * @param range A mma8451_range_scale.
+ * @param output_size A mma8451_output_size.
+ * @return Meters per second squared per count.
+ */
+double mma8451_proto_scale(uint8_t range, uint8_t output_size);
+/**
+ * This function converts a device's counters to their wire form. Buckets the library was
+ * built without are sent as zero, buckets past the wire's sizes are folded into the last one.
+ * @param out The wire counters to fill.
+ * @param stats Counters from mma8451_get_stats().
+ */
+void mma8451_proto_stats(mma8451_msg_device_stats* out, const mma8451_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
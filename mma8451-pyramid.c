@@ -0,0 +1,512 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-pyramid.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/stat.h>
+
+/**
+ * The number of completed buckets each level buffers before writing them.
+ */
+#define MMA8451_PYRAMID_BUFFER 64
+
+/**
+ * Running sums for a bucket being filled. Sums are kept in double so higher levels are
+ * built from exact totals rather than the rounded values stored below them.
+ */
+typedef struct mma8451_pyramid_accum {
+    uint64_t bucket;
+    uint64_t timestamp_ns;
+    uint64_t sequence;
+    uint64_t next_sequence;
+    uint64_t count;
+    uint32_t flags;
+    int16_t min[3];
+    int16_t max[3];
+    double sum[3];
+    double sum_squares[3];
+} mma8451_pyramid_accum;
+
+typedef struct mma8451_pyramid_level {
+    int fd;
+    uint64_t decimation;
+    mma8451_pyramid_accum accum;
+    uint64_t next_sequence;
+    int started;
+    mma8451_pyramid_bucket* pending;
+    unsigned int npending;
+} mma8451_pyramid_level;
+
+struct mma8451_pyramid {
+    int writing;
+    unsigned int factor;
+    unsigned int levels;
+    double scale;
+    mma8451_pyramid_level level[MMA8451_PYRAMID_MAX_LEVELS];
+};
+
+static int mma8451_pyramid_path(char* path, size_t size, const char* base, unsigned int level) {
+    if(snprintf(path, size, "%s.pyr%u", base, level) >= (int)size) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    return 1;
+}
+
+static int mma8451_pyramid_write_all(int fd, const void* buf, size_t len) {
+    const unsigned char* p = (const unsigned char*)buf;
+
+    while(len > 0) {
+        ssize_t written = write(fd, p, len);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return 1;
+}
+
+static void mma8451_pyramid_free(mma8451_pyramid* pyramid) {
+    unsigned int i;
+
+    for(i = 0; i < pyramid->levels; i++) {
+        if(pyramid->level[i].fd >= 0) {
+            close(pyramid->level[i].fd);
+        }
+        free(pyramid->level[i].pending);
+    }
+    free(pyramid);
+}
+
+mma8451_pyramid* mma8451_pyramid_create(const char* base, unsigned int factor, unsigned int levels, double scale) {
+    mma8451_pyramid* pyramid;
+    uint64_t decimation = 1;
+    unsigned int i;
+
+    if(factor < 2 || levels == 0 || levels > MMA8451_PYRAMID_MAX_LEVELS) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pyramid = (mma8451_pyramid*)calloc(1, sizeof(mma8451_pyramid));
+    if(pyramid == NULL) {
+        return NULL;
+    }
+    pyramid->writing = 1;
+    pyramid->factor = factor;
+    pyramid->scale = scale;
+
+    //Readers open levels until one is missing, remove deeper levels of an earlier pyramid.
+    for(i = levels; i < MMA8451_PYRAMID_MAX_LEVELS; i++) {
+        char path[PATH_MAX];
+
+        if(!mma8451_pyramid_path(path, sizeof(path), base, i + 1) || (unlink(path) < 0 && errno != ENOENT)) {
+            int err = errno;
+            mma8451_pyramid_free(pyramid);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    for(i = 0; i < levels; i++) {
+        mma8451_pyramid_level* level = &pyramid->level[i];
+        mma8451_pyramid_header header;
+        char path[PATH_MAX];
+        int err;
+
+        if(decimation > UINT32_MAX / factor) {
+            //Bucket counts are 32 bits.
+            mma8451_pyramid_free(pyramid);
+            errno = EOVERFLOW;
+            return NULL;
+        }
+        decimation *= factor;
+
+        level->fd = -1;
+        pyramid->levels = i + 1;
+        level->decimation = decimation;
+        level->pending = (mma8451_pyramid_bucket*)malloc(MMA8451_PYRAMID_BUFFER * sizeof(mma8451_pyramid_bucket));
+        if(level->pending == NULL || !mma8451_pyramid_path(path, sizeof(path), base, i + 1)) {
+            err = (level->pending == NULL) ? ENOMEM : errno;
+            mma8451_pyramid_free(pyramid);
+            errno = err;
+            return NULL;
+        }
+        level->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        memset(&header, 0, sizeof(header));
+        header.magic = MMA8451_PYRAMID_MAGIC;
+        header.version = MMA8451_PYRAMID_VERSION;
+        header.level = (uint16_t)(i + 1);
+        header.factor = factor;
+        header.bucket_size = sizeof(mma8451_pyramid_bucket);
+        header.decimation = decimation;
+        header.scale = scale;
+        if(level->fd < 0 || !mma8451_pyramid_write_all(level->fd, &header, sizeof(header))) {
+            err = errno;
+            mma8451_pyramid_free(pyramid);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    return pyramid;
+}
+
+static int mma8451_pyramid_write_pending(mma8451_pyramid_level* level) {
+    unsigned int n = level->npending;
+
+    level->npending = 0;
+    return mma8451_pyramid_write_all(level->fd, level->pending, n * sizeof(mma8451_pyramid_bucket));
+}
+
+static int mma8451_pyramid_fold(mma8451_pyramid* pyramid, unsigned int index, const mma8451_pyramid_accum* in);
+
+/**
+ * Ends the bucket being filled on a level, queues it for writing and folds it into the
+ * level above.
+ */
+static int mma8451_pyramid_emit(mma8451_pyramid* pyramid, unsigned int index) {
+    mma8451_pyramid_level* level = &pyramid->level[index];
+    mma8451_pyramid_accum* accum = &level->accum;
+    mma8451_pyramid_bucket* bucket = &level->pending[level->npending++];
+    int result = 1;
+    unsigned int i;
+
+    bucket->timestamp_ns = accum->timestamp_ns;
+    bucket->sequence = accum->sequence;
+    bucket->count = (uint32_t)accum->count;
+    bucket->flags = accum->flags;
+    for(i = 0; i < 3; i++) {
+        bucket->min[i] = accum->min[i];
+        bucket->max[i] = accum->max[i];
+        bucket->mean[i] = (float)(accum->sum[i] / accum->count);
+        bucket->rms[i] = (float)sqrt(accum->sum_squares[i] / accum->count);
+    }
+    bucket->reserved = 0;
+
+    if(level->npending == MMA8451_PYRAMID_BUFFER) {
+        result = mma8451_pyramid_write_pending(level);
+    }
+    if(index + 1 < pyramid->levels) {
+        result &= mma8451_pyramid_fold(pyramid, index + 1, accum);
+    }
+    accum->count = 0;
+    return result;
+}
+
+/**
+ * Adds a sample or a finished bucket from the level below to a level.
+ */
+static int mma8451_pyramid_fold(mma8451_pyramid* pyramid, unsigned int index, const mma8451_pyramid_accum* in) {
+    mma8451_pyramid_level* level = &pyramid->level[index];
+    mma8451_pyramid_accum* accum = &level->accum;
+    uint64_t bucket = in->sequence / level->decimation;
+    int gap = level->started && in->sequence != level->next_sequence;
+    int result = 1;
+    unsigned int i;
+
+    level->next_sequence = in->next_sequence;
+    level->started = 1;
+    if(accum->count > 0 && bucket != accum->bucket) {
+        result = mma8451_pyramid_emit(pyramid, index);
+    }
+
+    if(accum->count == 0) {
+        *accum = *in;
+        accum->bucket = bucket;
+        if(gap) {
+            accum->flags |= MMA8451_PYRAMID_GAP;
+        }
+        return result;
+    }
+
+    if(gap) {
+        accum->flags |= MMA8451_PYRAMID_GAP;
+    }
+    accum->flags |= in->flags;
+    accum->next_sequence = in->next_sequence;
+    accum->count += in->count;
+    for(i = 0; i < 3; i++) {
+        if(in->min[i] < accum->min[i]) {
+            accum->min[i] = in->min[i];
+        }
+        if(in->max[i] > accum->max[i]) {
+            accum->max[i] = in->max[i];
+        }
+        accum->sum[i] += in->sum[i];
+        accum->sum_squares[i] += in->sum_squares[i];
+    }
+    return result;
+}
+
+int mma8451_pyramid_add(mma8451_pyramid* pyramid, const mma8451_sample* samples, const uint64_t* timestamps_ns, unsigned int count) {
+    mma8451_pyramid_accum in;
+    int result = 1;
+    unsigned int i, axis;
+
+    if(!pyramid->writing) {
+        errno = EBADF;
+        return 0;
+    }
+
+    in.bucket = 0;
+    in.count = 1;
+    for(i = 0; i < count; i++) {
+        const int16_t values[3] = { samples[i].raw.x, samples[i].raw.y, samples[i].raw.z };
+
+        in.timestamp_ns = timestamps_ns[i];
+        in.sequence = samples[i].sequence;
+        in.next_sequence = samples[i].sequence + 1;
+        in.flags = (samples[i].flags & MMA8451_SAMPLE_GAP) ? MMA8451_PYRAMID_GAP : 0;
+        for(axis = 0; axis < 3; axis++) {
+            in.min[axis] = values[axis];
+            in.max[axis] = values[axis];
+            in.sum[axis] = values[axis];
+            in.sum_squares[axis] = (double)values[axis] * values[axis];
+        }
+        //Keep going on a write error so the sums stay right, the buckets are lost either way.
+        result &= mma8451_pyramid_fold(pyramid, 0, &in);
+    }
+    return result;
+}
+
+int mma8451_pyramid_flush(mma8451_pyramid* pyramid) {
+    int result = 1;
+    unsigned int i;
+
+    if(!pyramid->writing) {
+        return 1;
+    }
+    for(i = 0; i < pyramid->levels; i++) {
+        if(pyramid->level[i].npending > 0) {
+            result &= mma8451_pyramid_write_pending(&pyramid->level[i]);
+        }
+    }
+    return result;
+}
+
+mma8451_pyramid* mma8451_pyramid_open(const char* base) {
+    mma8451_pyramid* pyramid;
+    unsigned int i;
+
+    pyramid = (mma8451_pyramid*)calloc(1, sizeof(mma8451_pyramid));
+    if(pyramid == NULL) {
+        return NULL;
+    }
+
+    for(i = 0; i < MMA8451_PYRAMID_MAX_LEVELS; i++) {
+        mma8451_pyramid_level* level = &pyramid->level[i];
+        mma8451_pyramid_header header;
+        char path[PATH_MAX];
+        int fd;
+
+        if(!mma8451_pyramid_path(path, sizeof(path), base, i + 1)) {
+            mma8451_pyramid_free(pyramid);
+            return NULL;
+        }
+        fd = open(path, O_RDONLY);
+        if(fd < 0) {
+            break;
+        }
+        if(pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+           header.magic != MMA8451_PYRAMID_MAGIC || header.version != MMA8451_PYRAMID_VERSION ||
+           header.level != i + 1 || header.bucket_size != sizeof(mma8451_pyramid_bucket) ||
+           (i > 0 && header.factor != pyramid->factor)) {
+            close(fd);
+            mma8451_pyramid_free(pyramid);
+            errno = EINVAL;
+            return NULL;
+        }
+        level->fd = fd;
+        level->decimation = header.decimation;
+        pyramid->factor = header.factor;
+        pyramid->scale = header.scale;
+        pyramid->levels = i + 1;
+    }
+
+    if(pyramid->levels == 0) {
+        mma8451_pyramid_free(pyramid);
+        errno = ENOENT;
+        return NULL;
+    }
+    return pyramid;
+}
+
+unsigned int mma8451_pyramid_levels(mma8451_pyramid* pyramid) {
+    return pyramid->levels;
+}
+
+uint64_t mma8451_pyramid_decimation(mma8451_pyramid* pyramid, unsigned int level) {
+    if(level == 0 || level > pyramid->levels) {
+        return 0;
+    }
+    return pyramid->level[level - 1].decimation;
+}
+
+double mma8451_pyramid_scale(mma8451_pyramid* pyramid) {
+    return pyramid->scale;
+}
+
+/**
+ * Gets the number of whole buckets in a level file, which may still be growing.
+ */
+static int mma8451_pyramid_size(mma8451_pyramid_level* level, uint64_t* buckets) {
+    struct stat st;
+
+    if(fstat(level->fd, &st) != 0) {
+        return 0;
+    }
+    *buckets = (st.st_size < (off_t)sizeof(mma8451_pyramid_header)) ? 0 :
+        (uint64_t)(st.st_size - sizeof(mma8451_pyramid_header)) / sizeof(mma8451_pyramid_bucket);
+    return 1;
+}
+
+/**
+ * Binary searches a level for the first of its buckets starting at or after timestamp_ns.
+ */
+static int mma8451_pyramid_search(mma8451_pyramid_level* level, uint64_t buckets, uint64_t timestamp_ns, uint64_t* index) {
+    uint64_t lo = 0, hi = buckets;
+
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        off_t offset = (off_t)(sizeof(mma8451_pyramid_header) + mid * sizeof(mma8451_pyramid_bucket));
+        uint64_t t;
+
+        ssize_t got = pread(level->fd, &t, sizeof(t), offset + offsetof(mma8451_pyramid_bucket, timestamp_ns));
+
+        if(got != (ssize_t)sizeof(t)) {
+            if(got >= 0) {
+                errno = EIO;
+            }
+            return 0;
+        }
+        if(t < timestamp_ns) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *index = lo;
+    return 1;
+}
+
+/**
+ * Finds the buckets overlapping [start_ns, end_ns): the one containing start_ns, if any,
+ * through the last one starting before end_ns.
+ */
+static int mma8451_pyramid_range(mma8451_pyramid_level* level, uint64_t start_ns, uint64_t end_ns, uint64_t* first, uint64_t* last) {
+    uint64_t buckets;
+
+    if(!mma8451_pyramid_size(level, &buckets) ||
+       !mma8451_pyramid_search(level, buckets, start_ns == UINT64_MAX ? start_ns : start_ns + 1, first) ||
+       !mma8451_pyramid_search(level, buckets, end_ns, last)) {
+        return 0;
+    }
+    if(*first > 0) {
+        (*first)--;
+    }
+    if(*last < *first) {
+        *last = *first;
+    }
+    return 1;
+}
+
+unsigned int mma8451_pyramid_choose(mma8451_pyramid* pyramid, uint64_t start_ns, uint64_t end_ns, unsigned int points) {
+    unsigned int i;
+
+    if(pyramid->writing) {
+        errno = EBADF;
+        return 0;
+    }
+    for(i = 0; i < pyramid->levels; i++) {
+        uint64_t first, last;
+
+        if(!mma8451_pyramid_range(&pyramid->level[i], start_ns, end_ns, &first, &last)) {
+            return 0;
+        }
+        if(last - first <= points) {
+            return i + 1;
+        }
+    }
+    return pyramid->levels;
+}
+
+int mma8451_pyramid_query(mma8451_pyramid* pyramid, unsigned int level, uint64_t start_ns, uint64_t end_ns, mma8451_pyramid_bucket* buckets, unsigned int max, unsigned int* count) {
+    mma8451_pyramid_level* l;
+    uint64_t first, last, n;
+    size_t len;
+    ssize_t got;
+
+    *count = 0;
+    if(pyramid->writing || level == 0 || level > pyramid->levels) {
+        errno = pyramid->writing ? EBADF : EINVAL;
+        return 0;
+    }
+    l = &pyramid->level[level - 1];
+
+    if(!mma8451_pyramid_range(l, start_ns, end_ns, &first, &last)) {
+        return 0;
+    }
+    n = (last - first < max) ? last - first : max;
+    if(n == 0) {
+        return 1;
+    }
+
+    len = (size_t)n * sizeof(mma8451_pyramid_bucket);
+    got = pread(l->fd, buckets, len, (off_t)(sizeof(mma8451_pyramid_header) + first * sizeof(mma8451_pyramid_bucket)));
+    if(got < 0) {
+        return 0;
+    }
+    *count = (unsigned int)((size_t)got / sizeof(mma8451_pyramid_bucket));
+    return 1;
+}
+
+int mma8451_pyramid_close(mma8451_pyramid* pyramid) {
+    int result = 1;
+    unsigned int i;
+
+    if(pyramid == NULL) {
+        return 1;
+    }
+    if(pyramid->writing) {
+        //Lower levels first, each one folds its last bucket into the next.
+        for(i = 0; i < pyramid->levels; i++) {
+            if(pyramid->level[i].accum.count > 0) {
+                result &= mma8451_pyramid_emit(pyramid, i);
+            }
+        }
+        result &= mma8451_pyramid_flush(pyramid);
+    }
+    mma8451_pyramid_free(pyramid);
+    return result;
+}
@@ -0,0 +1,224 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_PYRAMID_H
+#define MMA8451_PYRAMID_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Identifies a libmma8451 pyramid level file ("MMAP").
+ */
+#define MMA8451_PYRAMID_MAGIC 0x50414D4D
+/**
+ * The layout version of pyramid level files.
+ */
+#define MMA8451_PYRAMID_VERSION 1
+/**
+ * The maximum number of levels in a pyramid.
+ */
+#define MMA8451_PYRAMID_MAX_LEVELS 16
+/**
+ * Set in mma8451_pyramid_bucket.flags when samples are missing inside or just before the
+ * bucket.
+ */
+#define MMA8451_PYRAMID_GAP 0x0001
+
+/**
+ * This structure is at the start of every level file. Level files are named
+ * "<base>.pyr<level>" and hold a header followed by buckets in time order, all fields in
+ * host byte order.
+ */
+typedef struct mma8451_pyramid_header {
+	/**
+	 * MMA8451_PYRAMID_MAGIC.
+	 */
+	uint32_t magic;
+	/**
+	 * MMA8451_PYRAMID_VERSION.
+	 */
+	uint16_t version;
+	/**
+	 * The level, counting from 1.
+	 */
+	uint16_t level;
+	/**
+	 * The decimation factor between levels.
+	 */
+	uint32_t factor;
+	/**
+	 * sizeof(mma8451_pyramid_bucket).
+	 */
+	uint32_t bucket_size;
+	/**
+	 * Samples per bucket, factor to the power of level.
+	 */
+	uint64_t decimation;
+	/**
+	 * Meters per second squared per count.
+	 */
+	double scale;
+} mma8451_pyramid_header;
+
+/**
+ * This structure summarizes the samples of one bucket. Buckets cover aligned ranges of
+ * sequence numbers, bucket i of a level holds sequences i * decimation to
+ * (i + 1) * decimation - 1, and buckets with no samples are left out.
+ */
+typedef struct mma8451_pyramid_bucket {
+	/**
+	 * Timestamp of the bucket's first sample in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * Sequence number of the bucket's first sample.
+	 */
+	uint64_t sequence;
+	/**
+	 * The number of samples summarized, less than the decimation if samples were lost or
+	 * the capture started or ended inside the bucket.
+	 */
+	uint32_t count;
+	/**
+	 * MMA8451_PYRAMID_* flags.
+	 */
+	uint32_t flags;
+	/**
+	 * The smallest X, Y and Z in counts.
+	 */
+	int16_t min[3];
+	/**
+	 * The largest X, Y and Z in counts.
+	 */
+	int16_t max[3];
+	/**
+	 * The mean X, Y and Z in counts.
+	 */
+	float mean[3];
+	/**
+	 * The root mean square of X, Y and Z in counts. Together with mean this gives the
+	 * standard deviation, sqrt(rms^2 - mean^2).
+	 */
+	float rms[3];
+	/**
+	 * Reserved, set to 0.
+	 */
+	uint32_t reserved;
+} mma8451_pyramid_bucket;
+
+/**
+ * An opaque handle to a pyramid being built or read.
+ */
+typedef struct mma8451_pyramid mma8451_pyramid;
+
+/**
+ * This function creates (or replaces) the level files of a pyramid for writing. Level files
+ * above levels left by an earlier pyramid with the same base are removed.
+ * @param base The path the level files are named after, e.g. the raw capture's path.
+ * @param factor Decimation between levels, e.g. 2 or 10.
+ * @param levels The number of levels, at most MMA8451_PYRAMID_MAX_LEVELS.
+ * @param scale Meters per second squared per count, stored for readers.
+ * @return The pyramid or NULL if there was an error.
+ */
+mma8451_pyramid* mma8451_pyramid_create(const char* base, unsigned int factor, unsigned int levels, double scale);
+/**
+ * This function adds samples to every level. Only the first level is touched per sample,
+ * higher levels are updated as the buckets below them complete. Completed buckets are
+ * buffered and written in blocks.
+ * @param pyramid Pyramid being written.
+ * @param samples Samples with increasing sequence numbers.
+ * @param timestamps_ns Each sample's timestamp in nanoseconds.
+ * @param count Number of samples.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_pyramid_add(mma8451_pyramid* pyramid, const mma8451_sample* samples, const uint64_t* timestamps_ns, unsigned int count);
+/**
+ * This function writes buffered buckets so readers see them. Buckets still being filled
+ * are not written.
+ * @param pyramid Pyramid being written.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_pyramid_flush(mma8451_pyramid* pyramid);
+/**
+ * This function opens the level files of a pyramid for reading. Levels still being written
+ * can be read, new buckets show up as they are flushed.
+ * @param base The path the level files are named after.
+ * @return The pyramid or NULL if there was an error.
+ */
+mma8451_pyramid* mma8451_pyramid_open(const char* base);
+/**
+ * This function gets the number of levels.
+ * @param pyramid Pyramid.
+ * @return The number of levels.
+ */
+unsigned int mma8451_pyramid_levels(mma8451_pyramid* pyramid);
+/**
+ * This function gets the samples per bucket of a level.
+ * @param pyramid Pyramid.
+ * @param level Level from 1 to mma8451_pyramid_levels().
+ * @return The decimation, or 0 for an invalid level.
+ */
+uint64_t mma8451_pyramid_decimation(mma8451_pyramid* pyramid, unsigned int level);
+/**
+ * This function gets the scale stored with the pyramid.
+ * @param pyramid Pyramid.
+ * @return Meters per second squared per count.
+ */
+double mma8451_pyramid_scale(mma8451_pyramid* pyramid);
+/**
+ * This function picks the finest level that covers a time range in at most points buckets,
+ * or the coarsest level if none does. It takes two binary searches per level.
+ * @param pyramid Pyramid opened for reading.
+ * @param start_ns Start of the range in nanoseconds.
+ * @param end_ns End of the range in nanoseconds, exclusive.
+ * @param points The most buckets wanted.
+ * @return The level, 0 if failure.
+ */
+unsigned int mma8451_pyramid_choose(mma8451_pyramid* pyramid, uint64_t start_ns, uint64_t end_ns, unsigned int points);
+/**
+ * This function reads the buckets of one level that overlap a time range. The first bucket
+ * is found with a binary search, the rest are read in one pread().
+ * @param pyramid Pyramid opened for reading.
+ * @param level Level from 1 to mma8451_pyramid_levels().
+ * @param start_ns Start of the range in nanoseconds.
+ * @param end_ns End of the range in nanoseconds, exclusive.
+ * @param buckets Buckets to fill.
+ * @param max Size of buckets.
+ * @param count Set to the number of buckets read.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_pyramid_query(mma8451_pyramid* pyramid, unsigned int level, uint64_t start_ns, uint64_t end_ns, mma8451_pyramid_bucket* buckets, unsigned int max, unsigned int* count);
+/**
+ * This function closes a pyramid. A writer first ends the buckets still being filled and
+ * writes everything buffered.
+ * @param pyramid Pyramid to close.
+ * @return 1 if successful, 0 if a writer failed to write its last buckets.
+ */
+int mma8451_pyramid_close(mma8451_pyramid* pyramid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "mma8451-queue.h"
+#include <linux/i2c.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+/**
+ * The pending requests and worker thread for one adapter.
+ */
+typedef struct mma8451_queue_lane {
+    struct mma8451_queue* queue;
+    int file;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    mma8451_request* head;
+    mma8451_request* tail;
+    int stopping;
+} mma8451_queue_lane;
+
+struct mma8451_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    mma8451_queue_lane lanes[MMA8451_QUEUE_MAX_ADAPTERS];
+    unsigned int nlanes;
+    mma8451_request* done_head;
+    mma8451_request* done_tail;
+};
+
+static void* mma8451_queue_worker(void* arg);
+
+mma8451_queue* mma8451_queue_create(void) {
+    mma8451_queue* queue = (mma8451_queue*)calloc(1, sizeof(mma8451_queue));
+    if(queue == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->done_cond, NULL);
+    return queue;
+}
+
+void mma8451_queue_destroy(mma8451_queue* queue) {
+    unsigned int i;
+
+    if(queue == NULL) {
+        return;
+    }
+
+    for(i = 0; i < queue->nlanes; i++) {
+        mma8451_queue_lane* lane = &queue->lanes[i];
+        pthread_mutex_lock(&lane->mutex);
+        lane->stopping = 1;
+        pthread_cond_signal(&lane->cond);
+        pthread_mutex_unlock(&lane->mutex);
+        pthread_join(lane->thread, NULL);
+        pthread_mutex_destroy(&lane->mutex);
+        pthread_cond_destroy(&lane->cond);
+    }
+
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->done_cond);
+    free(queue);
+}
+
+/**
+ * Finds the lane for an adapter, starting a worker for it if this is its first request.
+ */
+static mma8451_queue_lane* mma8451_queue_lane_for(mma8451_queue* queue, int file) {
+    mma8451_queue_lane* lane = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&queue->mutex);
+    for(i = 0; i < queue->nlanes; i++) {
+        if(queue->lanes[i].file == file) {
+            lane = &queue->lanes[i];
+            break;
+        }
+    }
+
+    if(lane == NULL && queue->nlanes < MMA8451_QUEUE_MAX_ADAPTERS) {
+        lane = &queue->lanes[queue->nlanes];
+        lane->queue = queue;
+        lane->file = file;
+        pthread_mutex_init(&lane->mutex, NULL);
+        pthread_cond_init(&lane->cond, NULL);
+        if(pthread_create(&lane->thread, NULL, mma8451_queue_worker, lane) != 0) {
+            pthread_mutex_destroy(&lane->mutex);
+            pthread_cond_destroy(&lane->cond);
+            lane = NULL;
+        } else {
+            queue->nlanes++;
+        }
+    } else if(lane == NULL) {
+        errno = ENOSPC;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return lane;
+}
+
+int mma8451_queue_submit(mma8451_queue* queue, mma8451_request* request) {
+    mma8451_queue_lane* lane;
+
+    if(request->device == NULL || (request->type == MMA8451_REQUEST_READ_BLOCK && (request->buf == NULL || request->len == 0))) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    lane = mma8451_queue_lane_for(queue, request->device->file);
+    if(lane == NULL) {
+        return 0;
+    }
+
+    request->next = NULL;
+    pthread_mutex_lock(&lane->mutex);
+    if(lane->tail != NULL) {
+        lane->tail->next = request;
+    } else {
+        lane->head = request;
+    }
+    lane->tail = request;
+    pthread_cond_signal(&lane->cond);
+    pthread_mutex_unlock(&lane->mutex);
+
+    return 1;
+}
+
+mma8451_request* mma8451_queue_wait(mma8451_queue* queue, int timeout_ms) {
+    mma8451_request* request;
+    struct timespec deadline;
+
+    if(timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->done_head == NULL) {
+        if(timeout_ms < 0) {
+            pthread_cond_wait(&queue->done_cond, &queue->mutex);
+        } else if(pthread_cond_timedwait(&queue->done_cond, &queue->mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    request = queue->done_head;
+    if(request != NULL) {
+        queue->done_head = request->next;
+        if(queue->done_head == NULL) {
+            queue->done_tail = NULL;
+        }
+        request->next = NULL;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return request;
+}
+
+/**
+ * Hands a finished request to its callback or the completion list.
+ */
+static void mma8451_queue_complete(mma8451_queue* queue, mma8451_request* request, int result, int error) {
+    request->result = result;
+    request->error = result ? 0 : error;
+    request->next = NULL;
+
+    if(request->callback != NULL) {
+        request->callback(request, request->user);
+        return;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->done_tail != NULL) {
+        queue->done_tail->next = request;
+    } else {
+        queue->done_head = request;
+    }
+    queue->done_tail = request;
+    pthread_cond_broadcast(&queue->done_cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Builds the messages for a run of requests on the same device, merging writes to consecutive
+ * registers into one auto-increment message.
+ * @param first First request of the run.
+ * @param messages Messages to fill.
+ * @param wbuf Storage for register addresses and write payloads, MMA8451_QUEUE_MAX_MSGS * 2 bytes.
+ * @param nmsgs Number of messages built.
+ * @return The first request not included in the run.
+ */
+static mma8451_request* mma8451_queue_build(mma8451_request* first, struct i2c_msg* messages, unsigned char* wbuf, unsigned int* nmsgs) {
+    mma8451_request* request = first;
+    unsigned int n = 0, used = 0;
+    int merge_reg = -1;
+
+    for(; request != NULL && request->device == first->device; request = request->next) {
+        unsigned char addr = first->device->addr;
+
+        if(used + 2 > MMA8451_QUEUE_MAX_MSGS * 2) {
+            break;
+        }
+        if(request->type == MMA8451_REQUEST_WRITE) {
+            if(merge_reg == (int)request->reg) {
+                //Extend the previous write, the device auto-increments.
+                wbuf[used++] = request->value;
+                messages[n - 1].len++;
+                merge_reg++;
+                continue;
+            }
+            if(n + 1 > MMA8451_QUEUE_MAX_MSGS) {
+                break;
+            }
+            messages[n].addr  = addr;
+            messages[n].flags = 0;
+            messages[n].len   = 2;
+            messages[n].buf   = &wbuf[used];
+            wbuf[used++] = request->reg;
+            wbuf[used++] = request->value;
+            merge_reg = request->reg + 1;
+            n++;
+        } else {
+            if(n + 2 > MMA8451_QUEUE_MAX_MSGS) {
+                break;
+            }
+            messages[n].addr  = addr;
+            messages[n].flags = 0;
+            messages[n].len   = 1;
+            messages[n].buf   = &wbuf[used];
+            wbuf[used++] = request->reg;
+
+            messages[n + 1].addr  = addr;
+            messages[n + 1].flags = I2C_M_RD;
+            if(request->type == MMA8451_REQUEST_READ) {
+                messages[n + 1].len = 1;
+                messages[n + 1].buf = &request->value;
+            } else {
+                messages[n + 1].len = request->len;
+                messages[n + 1].buf = request->buf;
+            }
+            merge_reg = -1;
+            n += 2;
+        }
+    }
+
+    *nmsgs = n;
+    return request;
+}
+
+/**
+ * Runs a list of requests, one I2C_RDWR per run of requests for the same device.
+ */
+static void mma8451_queue_run(mma8451_queue* queue, mma8451_request* requests) {
+    struct i2c_msg messages[MMA8451_QUEUE_MAX_MSGS];
+    unsigned char wbuf[MMA8451_QUEUE_MAX_MSGS * 2];
+
+    while(requests != NULL) {
+        mma8451_request* first = requests;
+        mma8451_request* end;
+        unsigned int nmsgs;
+        int result, error;
+
+        end = mma8451_queue_build(first, messages, wbuf, &nmsgs);
+        result = mma8451_transfer(first->device, messages, nmsgs);
+        error = errno;
+
+        while(requests != end) {
+            mma8451_request* request = requests;
+            requests = request->next;
+
+            if(!result && (request != first || requests != end)) {
+                //The merged transfer failed, retry on its own so the error lands on the right request.
+                request->next = NULL;
+                mma8451_queue_build(request, messages, wbuf, &nmsgs);
+                if(mma8451_transfer(request->device, messages, nmsgs)) {
+                    mma8451_queue_complete(queue, request, 1, 0);
+                } else {
+                    mma8451_queue_complete(queue, request, 0, errno);
+                }
+                continue;
+            }
+            mma8451_queue_complete(queue, request, result, error);
+        }
+    }
+}
+
+static void* mma8451_queue_worker(void* arg) {
+    mma8451_queue_lane* lane = (mma8451_queue_lane*)arg;
+
+    for(;;) {
+        mma8451_request* requests;
+
+        pthread_mutex_lock(&lane->mutex);
+        while(lane->head == NULL && !lane->stopping) {
+            pthread_cond_wait(&lane->cond, &lane->mutex);
+        }
+        requests = lane->head;
+        lane->head = NULL;
+        lane->tail = NULL;
+        pthread_mutex_unlock(&lane->mutex);
+
+        if(requests == NULL) {
+            break;
+        }
+        mma8451_queue_run(lane->queue, requests);
+    }
+
+    return NULL;
+}
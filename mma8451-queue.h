@@ -0,0 +1,152 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef MMA8451_QUEUE_H
+#define MMA8451_QUEUE_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The maximum number of adapters (I2C bus file descriptors) a queue serves.
+ */
+#define MMA8451_QUEUE_MAX_ADAPTERS 8
+/**
+ * The maximum number of i2c_msg entries merged into one I2C_RDWR, this is the kernel's
+ * I2C_RDWR_IOCTL_MAX_MSGS.
+ */
+#define MMA8451_QUEUE_MAX_MSGS 42
+
+/**
+ * An enumeration containing the supported request types.
+ */
+typedef enum mma8451_request_type {
+	/**
+	 * Read a single register into value.
+	 */
+	MMA8451_REQUEST_READ = 0,
+	/**
+	 * Write value to a single register.
+	 */
+	MMA8451_REQUEST_WRITE = 1,
+	/**
+	 * Read len consecutive registers into buf.
+	 */
+	MMA8451_REQUEST_READ_BLOCK = 2
+} mma8451_request_type;
+
+struct mma8451_request;
+
+/**
+ * Completion callback, called on the adapter's worker thread.
+ */
+typedef void (*mma8451_request_callback)(struct mma8451_request* request, void* user);
+
+/**
+ * This structure describes one queued register operation. It is owned by the caller and must
+ * stay valid until it completes.
+ */
+typedef struct mma8451_request {
+	/**
+	 * Device to operate on.
+	 */
+	mma8451* device;
+	/**
+	 * The operation to perform.
+	 */
+	mma8451_request_type type;
+	/**
+	 * First register to read or write.
+	 */
+	mma8451_register reg;
+	/**
+	 * Value to write, or the value read for MMA8451_REQUEST_READ.
+	 */
+	unsigned char value;
+	/**
+	 * Buffer for MMA8451_REQUEST_READ_BLOCK.
+	 */
+	unsigned char* buf;
+	/**
+	 * Number of bytes to read for MMA8451_REQUEST_READ_BLOCK.
+	 */
+	unsigned int len;
+	/**
+	 * Optional completion callback. If NULL the request is delivered through
+	 * mma8451_queue_wait() instead.
+	 */
+	mma8451_request_callback callback;
+	/**
+	 * User data passed to the callback.
+	 */
+	void* user;
+	/**
+	 * Set on completion, 1 if successful, 0 if failure.
+	 */
+	int result;
+	/**
+	 * Set on completion to the errno of a failed request.
+	 */
+	int error;
+	/**
+	 * Internal list link.
+	 */
+	struct mma8451_request* next;
+} mma8451_request;
+
+/**
+ * An opaque request queue with one worker thread per adapter.
+ */
+typedef struct mma8451_queue mma8451_queue;
+
+/**
+ * This function creates a request queue.
+ * @return The queue or NULL if there was an error.
+ */
+mma8451_queue* mma8451_queue_create(void);
+/**
+ * This function completes every submitted request, stops the workers and frees the queue.
+ * @param queue Queue to destroy.
+ */
+void mma8451_queue_destroy(mma8451_queue* queue);
+/**
+ * This function submits a request to the worker for its device's adapter. Consecutive
+ * requests for the same device are merged into one I2C_RDWR and writes to consecutive
+ * registers are merged into one auto-increment message.
+ * @param queue Queue to submit to.
+ * @param request Request to run, must stay valid until completed.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_queue_submit(mma8451_queue* queue, mma8451_request* request);
+/**
+ * This function waits for a request without a callback to complete.
+ * @param queue Queue to wait on.
+ * @param timeout_ms Milliseconds to wait, negative to wait forever.
+ * @return The completed request or NULL on timeout.
+ */
+mma8451_request* mma8451_queue_wait(mma8451_queue* queue, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,577 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-record.h"
+#include "mma8451-pyramid.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * The largest chunk accepted, so a corrupt header can't ask for a huge buffer.
+ */
+#define MMA8451_RECORD_MAX_CHUNK_SAMPLES (1U << 20)
+
+struct mma8451_record {
+    int fd;
+    int writing;
+    mma8451_record_header header;
+    mma8451_record_entry* index;
+    uint64_t entries;
+    uint64_t capacity;
+    uint64_t samples;
+    uint64_t end;
+    unsigned char* buf;
+    unsigned int fill;
+    uint64_t loaded;
+    uint64_t chunk;
+    unsigned int position;
+    uint64_t last_sequence;
+    int have_last;
+    mma8451_pyramid* pyramid;
+};
+
+static int mma8451_record_write_all(int fd, const void* buf, size_t len) {
+    const unsigned char* p = (const unsigned char*)buf;
+
+    while(len > 0) {
+        ssize_t written = write(fd, p, len);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return 1;
+}
+
+static int mma8451_record_read_all(int fd, void* buf, size_t len, uint64_t offset) {
+    ssize_t got = pread(fd, buf, len, (off_t)offset);
+
+    if(got != (ssize_t)len) {
+        if(got >= 0) {
+            errno = EIO;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * The chunk buffer holds a chunk header followed by its samples, so a chunk is written with
+ * one write().
+ */
+static mma8451_record_sample* mma8451_record_samples_of(mma8451_record* record) {
+    return (mma8451_record_sample*)(record->buf + sizeof(mma8451_record_chunk));
+}
+
+static int mma8451_record_append_entry(mma8451_record* record, const mma8451_record_entry* entry) {
+    if(record->entries == record->capacity) {
+        uint64_t capacity = record->capacity ? record->capacity * 2 : 256;
+        mma8451_record_entry* index = (mma8451_record_entry*)realloc(record->index, capacity * sizeof(mma8451_record_entry));
+        if(index == NULL) {
+            errno = ENOMEM;
+            return 0;
+        }
+        record->index = index;
+        record->capacity = capacity;
+    }
+    record->index[record->entries++] = *entry;
+    record->samples += entry->count;
+    return 1;
+}
+
+static void mma8451_record_free(mma8451_record* record) {
+    if(record->fd >= 0) {
+        close(record->fd);
+    }
+    free(record->index);
+    free(record->buf);
+    free(record);
+}
+
+static int mma8451_record_alloc_buf(mma8451_record* record) {
+    record->buf = (unsigned char*)malloc(sizeof(mma8451_record_chunk) + (size_t)record->header.chunk_samples * sizeof(mma8451_record_sample));
+    if(record->buf == NULL) {
+        errno = ENOMEM;
+        return 0;
+    }
+    return 1;
+}
+
+mma8451_record* mma8451_record_create(const char* path, const mma8451_record_config* config) {
+    mma8451_record* record;
+    unsigned int chunk_samples = config->chunk_samples ? config->chunk_samples : MMA8451_RECORD_CHUNK_SAMPLES;
+    int err;
+
+    if(chunk_samples > MMA8451_RECORD_MAX_CHUNK_SAMPLES) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    record = (mma8451_record*)calloc(1, sizeof(mma8451_record));
+    if(record == NULL) {
+        return NULL;
+    }
+    record->writing = 1;
+    record->header.magic = MMA8451_RECORD_MAGIC;
+    record->header.version = MMA8451_RECORD_VERSION;
+    record->header.sample_size = sizeof(mma8451_record_sample);
+    record->header.chunk_samples = chunk_samples;
+    record->header.scale = config->scale;
+    record->header.period_ns = config->period_ns;
+    record->end = sizeof(mma8451_record_header);
+
+    record->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(record->fd < 0 || !mma8451_record_alloc_buf(record) ||
+       !mma8451_record_write_all(record->fd, &record->header, sizeof(record->header))) {
+        err = errno;
+        mma8451_record_free(record);
+        errno = err;
+        return NULL;
+    }
+
+    if(config->pyramid_levels > 0) {
+        record->pyramid = mma8451_pyramid_create(path, config->pyramid_factor, config->pyramid_levels, config->scale);
+        if(record->pyramid == NULL) {
+            err = errno;
+            mma8451_record_free(record);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    return record;
+}
+
+/**
+ * Writes the buffered samples as a chunk and adds it to the index.
+ */
+static int mma8451_record_write_chunk(mma8451_record* record) {
+    mma8451_record_chunk* chunk = (mma8451_record_chunk*)record->buf;
+    mma8451_record_sample* samples = mma8451_record_samples_of(record);
+    mma8451_record_entry entry;
+    size_t len = sizeof(mma8451_record_chunk) + (size_t)record->fill * sizeof(mma8451_record_sample);
+
+    chunk->magic = MMA8451_RECORD_CHUNK_MAGIC;
+    chunk->count = record->fill;
+    chunk->timestamp_ns = samples[0].timestamp_ns;
+    chunk->last_timestamp_ns = samples[record->fill - 1].timestamp_ns;
+    record->fill = 0;
+
+    if(!mma8451_record_write_all(record->fd, record->buf, len)) {
+        int err = errno;
+
+        //Drop what made it to disk so later chunks and the index still start at end.
+        if(lseek(record->fd, (off_t)record->end, SEEK_SET) < 0 || ftruncate(record->fd, (off_t)record->end) != 0) {
+            err = errno;
+        }
+        errno = err;
+        return 0;
+    }
+
+    entry.offset = record->end;
+    entry.sequence = chunk->sequence;
+    entry.timestamp_ns = chunk->timestamp_ns;
+    entry.count = chunk->count;
+    entry.reserved = 0;
+    record->end += len;
+    return mma8451_record_append_entry(record, &entry);
+}
+
+int mma8451_record_write(mma8451_record* record, const mma8451_sample* samples, const uint64_t* timestamps_ns, unsigned int count) {
+    mma8451_record_chunk* chunk = (mma8451_record_chunk*)record->buf;
+    mma8451_record_sample* out = mma8451_record_samples_of(record);
+    int result = 1;
+    unsigned int i;
+
+    if(!record->writing) {
+        errno = EBADF;
+        return 0;
+    }
+
+    for(i = 0; i < count; i++) {
+        const mma8451_sample* sample = &samples[i];
+        mma8451_record_sample* stored;
+
+        //Chunks hold consecutive sequence numbers only, so a gap starts a new one.
+        if(record->fill > 0 && (sample->sequence != chunk->sequence + record->fill || (sample->flags & MMA8451_SAMPLE_GAP))) {
+            result &= mma8451_record_write_chunk(record);
+        }
+        if(record->fill == 0) {
+            chunk->sequence = sample->sequence;
+        }
+
+        stored = &out[record->fill++];
+        stored->timestamp_ns = timestamps_ns[i];
+        stored->raw = sample->raw;
+        stored->status = sample->status;
+        stored->flags = sample->flags;
+
+        if(record->fill == record->header.chunk_samples) {
+            result &= mma8451_record_write_chunk(record);
+        }
+    }
+
+    if(record->pyramid != NULL) {
+        result &= mma8451_pyramid_add(record->pyramid, samples, timestamps_ns, count);
+    }
+    return result;
+}
+
+int mma8451_record_flush(mma8451_record* record) {
+    int result = 1;
+
+    if(!record->writing) {
+        return 1;
+    }
+    if(record->fill > 0) {
+        result = mma8451_record_write_chunk(record);
+    }
+    if(record->pyramid != NULL) {
+        result &= mma8451_pyramid_flush(record->pyramid);
+    }
+    return result;
+}
+
+/**
+ * Rebuilds the index by walking the chunk headers from the start of the file, stopping at the
+ * first one that is missing, invalid or torn. Leaves end at the end of the last whole chunk.
+ */
+static int mma8451_record_scan(mma8451_record* record, uint64_t size) {
+    uint64_t offset = sizeof(mma8451_record_header);
+
+    record->entries = 0;
+    record->samples = 0;
+    while(offset + sizeof(mma8451_record_chunk) <= size) {
+        mma8451_record_chunk chunk;
+        mma8451_record_entry entry;
+        uint64_t len;
+
+        if(!mma8451_record_read_all(record->fd, &chunk, sizeof(chunk), offset)) {
+            return 0;
+        }
+        len = sizeof(chunk) + (uint64_t)chunk.count * sizeof(mma8451_record_sample);
+        if(chunk.magic != MMA8451_RECORD_CHUNK_MAGIC || chunk.count == 0 ||
+           chunk.count > record->header.chunk_samples || offset + len > size) {
+            break;
+        }
+
+        entry.offset = offset;
+        entry.sequence = chunk.sequence;
+        entry.timestamp_ns = chunk.timestamp_ns;
+        entry.count = chunk.count;
+        entry.reserved = 0;
+        if(!mma8451_record_append_entry(record, &entry)) {
+            return 0;
+        }
+        offset += len;
+    }
+    record->end = offset;
+    return 1;
+}
+
+/**
+ * Reads the header and the index of an open file, from the trailer if there is a valid one
+ * and otherwise by scanning. Sets indexed if the trailer was used.
+ */
+static int mma8451_record_load(mma8451_record* record, int* indexed) {
+    mma8451_record_trailer trailer;
+    struct stat st;
+    uint64_t size;
+
+    *indexed = 0;
+    if(fstat(record->fd, &st) != 0 ||
+       !mma8451_record_read_all(record->fd, &record->header, sizeof(record->header), 0)) {
+        return 0;
+    }
+    if(record->header.magic != MMA8451_RECORD_MAGIC || record->header.version != MMA8451_RECORD_VERSION ||
+       record->header.sample_size != sizeof(mma8451_record_sample) || record->header.chunk_samples == 0 ||
+       record->header.chunk_samples > MMA8451_RECORD_MAX_CHUNK_SAMPLES) {
+        errno = EINVAL;
+        return 0;
+    }
+    size = (uint64_t)st.st_size;
+
+    if(size >= sizeof(mma8451_record_header) + sizeof(trailer) &&
+       mma8451_record_read_all(record->fd, &trailer, sizeof(trailer), size - sizeof(trailer)) &&
+       trailer.magic == MMA8451_RECORD_INDEX_MAGIC &&
+       trailer.index_offset >= sizeof(mma8451_record_header) &&
+       trailer.entries <= (size - trailer.index_offset) / sizeof(mma8451_record_entry) &&
+       trailer.index_offset + trailer.entries * sizeof(mma8451_record_entry) + sizeof(trailer) == size) {
+        record->index = (mma8451_record_entry*)malloc(trailer.entries ? trailer.entries * sizeof(mma8451_record_entry) : 1);
+        if(record->index == NULL) {
+            errno = ENOMEM;
+            return 0;
+        }
+        if(!mma8451_record_read_all(record->fd, record->index, trailer.entries * sizeof(mma8451_record_entry), trailer.index_offset)) {
+            return 0;
+        }
+        record->entries = trailer.entries;
+        record->capacity = trailer.entries;
+        record->samples = trailer.samples;
+        record->end = trailer.index_offset;
+        *indexed = 1;
+        return 1;
+    }
+
+    return mma8451_record_scan(record, size);
+}
+
+/**
+ * Writes the index and trailer at end.
+ */
+static int mma8451_record_write_index(mma8451_record* record) {
+    mma8451_record_trailer trailer;
+
+    trailer.magic = MMA8451_RECORD_INDEX_MAGIC;
+    trailer.reserved = 0;
+    trailer.index_offset = record->end;
+    trailer.entries = record->entries;
+    trailer.samples = record->samples;
+    return mma8451_record_write_all(record->fd, record->index, record->entries * sizeof(mma8451_record_entry)) &&
+           mma8451_record_write_all(record->fd, &trailer, sizeof(trailer));
+}
+
+mma8451_record* mma8451_record_open(const char* path) {
+    mma8451_record* record;
+    int indexed, err;
+
+    record = (mma8451_record*)calloc(1, sizeof(mma8451_record));
+    if(record == NULL) {
+        return NULL;
+    }
+    record->loaded = UINT64_MAX;
+    record->fd = open(path, O_RDONLY);
+    if(record->fd < 0 || !mma8451_record_load(record, &indexed) || !mma8451_record_alloc_buf(record)) {
+        err = errno;
+        mma8451_record_free(record);
+        errno = err;
+        return NULL;
+    }
+    return record;
+}
+
+int mma8451_record_repair(const char* path) {
+    mma8451_record* record;
+    int indexed, result, err;
+
+    record = (mma8451_record*)calloc(1, sizeof(mma8451_record));
+    if(record == NULL) {
+        return 0;
+    }
+    record->fd = open(path, O_RDWR);
+    if(record->fd < 0 || !mma8451_record_load(record, &indexed)) {
+        err = errno;
+        mma8451_record_free(record);
+        errno = err;
+        return 0;
+    }
+
+    result = indexed ||
+        (ftruncate(record->fd, (off_t)record->end) == 0 &&
+         lseek(record->fd, (off_t)record->end, SEEK_SET) >= 0 &&
+         mma8451_record_write_index(record) &&
+         fsync(record->fd) == 0);
+    err = errno;
+    mma8451_record_free(record);
+    errno = err;
+    return result;
+}
+
+uint64_t mma8451_record_samples(mma8451_record* record) {
+    return record->samples + record->fill;
+}
+
+double mma8451_record_scale(mma8451_record* record) {
+    return record->header.scale;
+}
+
+/**
+ * Reads a chunk's samples into the buffer unless it is already there.
+ */
+static int mma8451_record_load_chunk(mma8451_record* record, uint64_t chunk) {
+    const mma8451_record_entry* entry = &record->index[chunk];
+
+    if(record->loaded == chunk) {
+        return 1;
+    }
+    record->loaded = UINT64_MAX;
+    if(!mma8451_record_read_all(record->fd, mma8451_record_samples_of(record), (size_t)entry->count * sizeof(mma8451_record_sample),
+                                entry->offset + sizeof(mma8451_record_chunk))) {
+        return 0;
+    }
+    record->loaded = chunk;
+    return 1;
+}
+
+/**
+ * Moves to a sample, normalizing a position past the end of a chunk to the start of the next.
+ */
+static void mma8451_record_position(mma8451_record* record, uint64_t chunk, unsigned int position) {
+    if(chunk < record->entries && position >= record->index[chunk].count) {
+        chunk++;
+        position = 0;
+    }
+    record->chunk = chunk;
+    record->position = position;
+    record->have_last = 0;
+}
+
+int mma8451_record_seek_time(mma8451_record* record, uint64_t timestamp_ns) {
+    const mma8451_record_sample* samples = mma8451_record_samples_of(record);
+    uint64_t lo = 0, hi = record->entries;
+    unsigned int first, last;
+
+    if(record->writing) {
+        errno = EBADF;
+        return 0;
+    }
+
+    //The last chunk starting at or before the time.
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if(record->index[mid].timestamp_ns <= timestamp_ns) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if(lo == 0) {
+        mma8451_record_position(record, 0, 0);
+        return 1;
+    }
+    if(!mma8451_record_load_chunk(record, lo - 1)) {
+        return 0;
+    }
+
+    first = 0;
+    last = record->index[lo - 1].count;
+    while(first < last) {
+        unsigned int mid = first + (last - first) / 2;
+        if(samples[mid].timestamp_ns < timestamp_ns) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+    mma8451_record_position(record, lo - 1, first);
+    return 1;
+}
+
+int mma8451_record_seek_sequence(mma8451_record* record, uint64_t sequence) {
+    uint64_t lo = 0, hi = record->entries;
+    const mma8451_record_entry* entry;
+
+    if(record->writing) {
+        errno = EBADF;
+        return 0;
+    }
+
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if(record->index[mid].sequence <= sequence) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if(lo == 0) {
+        mma8451_record_position(record, 0, 0);
+        return 1;
+    }
+
+    //Sequence numbers are consecutive within a chunk, so no need to read it.
+    entry = &record->index[lo - 1];
+    if(sequence - entry->sequence >= entry->count) {
+        mma8451_record_position(record, lo, 0);
+    } else {
+        mma8451_record_position(record, lo - 1, (unsigned int)(sequence - entry->sequence));
+    }
+    return 1;
+}
+
+unsigned int mma8451_record_read(mma8451_record* record, mma8451_sample* samples, uint64_t* timestamps_ns, unsigned int max) {
+    const mma8451_record_sample* stored = mma8451_record_samples_of(record);
+    unsigned int count = 0;
+
+    if(record->writing) {
+        errno = EBADF;
+        return 0;
+    }
+
+    while(count < max && record->chunk < record->entries) {
+        const mma8451_record_entry* entry = &record->index[record->chunk];
+
+        if(!mma8451_record_load_chunk(record, record->chunk)) {
+            return count;
+        }
+        for(; count < max && record->position < entry->count; count++, record->position++) {
+            const mma8451_record_sample* in = &stored[record->position];
+            mma8451_sample* sample = &samples[count];
+
+            sample->sequence = entry->sequence + record->position;
+            sample->raw = in->raw;
+            sample->status = in->status;
+            sample->flags = in->flags;
+            if(record->have_last && sample->sequence != record->last_sequence + 1) {
+                sample->flags |= MMA8451_SAMPLE_GAP;
+            }
+            record->last_sequence = sample->sequence;
+            record->have_last = 1;
+            if(timestamps_ns != NULL) {
+                timestamps_ns[count] = in->timestamp_ns;
+            }
+        }
+        if(record->position >= entry->count) {
+            record->chunk++;
+            record->position = 0;
+        }
+    }
+
+    if(count == 0) {
+        errno = 0;
+    }
+    return count;
+}
+
+int mma8451_record_close(mma8451_record* record) {
+    int result = 1;
+
+    if(record == NULL) {
+        return 1;
+    }
+    if(record->writing) {
+        //The index is written even if the last chunk was lost, it covers the chunks before it.
+        result = mma8451_record_flush(record);
+        result &= mma8451_record_write_index(record);
+        if(record->pyramid != NULL) {
+            result &= mma8451_pyramid_close(record->pyramid);
+        }
+    }
+    mma8451_record_free(record);
+    return result;
+}
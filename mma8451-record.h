@@ -0,0 +1,313 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_RECORD_H
+#define MMA8451_RECORD_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Identifies a libmma8451 recording ("MMAR").
+ */
+#define MMA8451_RECORD_MAGIC 0x52414D4D
+/**
+ * Identifies a chunk of samples in a recording ("MMAC").
+ */
+#define MMA8451_RECORD_CHUNK_MAGIC 0x43414D4D
+/**
+ * Identifies the index trailer at the end of a recording ("MMAI").
+ */
+#define MMA8451_RECORD_INDEX_MAGIC 0x49414D4D
+/**
+ * The layout version of recordings.
+ */
+#define MMA8451_RECORD_VERSION 1
+/**
+ * The default number of samples per chunk, one index entry is kept per chunk.
+ */
+#define MMA8451_RECORD_CHUNK_SAMPLES 4096
+
+/*
+ * A recording is a mma8451_record_header, a run of chunks and, once the recording is closed,
+ * an index with one mma8451_record_entry per chunk followed by a mma8451_record_trailer. Each
+ * chunk is a mma8451_record_chunk followed by its samples. All fields are in host byte order.
+ * The index only repeats what the chunk headers hold, so it can always be rebuilt from them.
+ */
+
+/**
+ * This structure is at the start of a recording.
+ */
+typedef struct mma8451_record_header {
+	/**
+	 * MMA8451_RECORD_MAGIC.
+	 */
+	uint32_t magic;
+	/**
+	 * MMA8451_RECORD_VERSION.
+	 */
+	uint16_t version;
+	/**
+	 * sizeof(mma8451_record_sample).
+	 */
+	uint16_t sample_size;
+	/**
+	 * The most samples in one chunk.
+	 */
+	uint32_t chunk_samples;
+	/**
+	 * Reserved, set to 0.
+	 */
+	uint32_t reserved;
+	/**
+	 * Meters per second squared per count.
+	 */
+	double scale;
+	/**
+	 * The nominal sample period in nanoseconds, 0 if unknown.
+	 */
+	uint64_t period_ns;
+} mma8451_record_header;
+
+/**
+ * This structure contains one recorded sample.
+ */
+typedef struct mma8451_record_sample {
+	/**
+	 * Timestamp in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * The sample in counts.
+	 */
+	mma8451_raw_sample raw;
+	/**
+	 * The STATUS register read with the sample.
+	 */
+	uint8_t status;
+	/**
+	 * MMA8451_SAMPLE_* flags.
+	 */
+	uint8_t flags;
+} mma8451_record_sample;
+
+/**
+ * This structure is at the start of every chunk. The samples of a chunk have consecutive
+ * sequence numbers, a new chunk is started after every gap.
+ */
+typedef struct mma8451_record_chunk {
+	/**
+	 * MMA8451_RECORD_CHUNK_MAGIC.
+	 */
+	uint32_t magic;
+	/**
+	 * The number of samples that follow.
+	 */
+	uint32_t count;
+	/**
+	 * Sequence number of the first sample.
+	 */
+	uint64_t sequence;
+	/**
+	 * Timestamp of the first sample in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * Timestamp of the last sample in nanoseconds.
+	 */
+	uint64_t last_timestamp_ns;
+} mma8451_record_chunk;
+
+/**
+ * This structure is one entry of the index.
+ */
+typedef struct mma8451_record_entry {
+	/**
+	 * File offset of the chunk header.
+	 */
+	uint64_t offset;
+	/**
+	 * Sequence number of the chunk's first sample.
+	 */
+	uint64_t sequence;
+	/**
+	 * Timestamp of the chunk's first sample in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * The number of samples in the chunk.
+	 */
+	uint32_t count;
+	/**
+	 * Reserved, set to 0.
+	 */
+	uint32_t reserved;
+} mma8451_record_entry;
+
+/**
+ * This structure ends a recording that has an index.
+ */
+typedef struct mma8451_record_trailer {
+	/**
+	 * MMA8451_RECORD_INDEX_MAGIC.
+	 */
+	uint32_t magic;
+	/**
+	 * Reserved, set to 0.
+	 */
+	uint32_t reserved;
+	/**
+	 * File offset of the first index entry, also the end of the last chunk.
+	 */
+	uint64_t index_offset;
+	/**
+	 * The number of index entries.
+	 */
+	uint64_t entries;
+	/**
+	 * The number of samples in the recording.
+	 */
+	uint64_t samples;
+} mma8451_record_trailer;
+
+/**
+ * This structure configures a new recording.
+ */
+typedef struct mma8451_record_config {
+	/**
+	 * Samples per chunk, 0 for MMA8451_RECORD_CHUNK_SAMPLES. Seeking reads at most one chunk.
+	 */
+	unsigned int chunk_samples;
+	/**
+	 * Meters per second squared per count.
+	 */
+	double scale;
+	/**
+	 * The nominal sample period in nanoseconds, 0 if unknown.
+	 */
+	uint64_t period_ns;
+	/**
+	 * Decimation factor of a mma8451_pyramid built alongside the recording.
+	 */
+	unsigned int pyramid_factor;
+	/**
+	 * The number of pyramid levels, 0 for no pyramid. The level files are named after the
+	 * recording and can be read with mma8451_pyramid_open().
+	 */
+	unsigned int pyramid_levels;
+} mma8451_record_config;
+
+/**
+ * An opaque handle to a recording being written or read.
+ */
+typedef struct mma8451_record mma8451_record;
+
+/**
+ * This function creates (or replaces) a recording.
+ * @param path Path of the recording.
+ * @param config The configuration.
+ * @return The recording or NULL if there was an error.
+ */
+mma8451_record* mma8451_record_create(const char* path, const mma8451_record_config* config);
+/**
+ * This function appends samples. Samples are buffered until their chunk is full.
+ * @param record Recording being written.
+ * @param samples Samples with increasing sequence numbers and timestamps.
+ * @param timestamps_ns Each sample's timestamp in nanoseconds.
+ * @param count Number of samples.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_record_write(mma8451_record* record, const mma8451_sample* samples, const uint64_t* timestamps_ns, unsigned int count);
+/**
+ * This function writes the buffered samples as a (possibly short) chunk, so they survive a
+ * crash and can be seen by readers.
+ * @param record Recording being written.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_record_flush(mma8451_record* record);
+/**
+ * This function opens a recording for reading. The index is loaded from the trailer or, for
+ * recordings that were not closed or are still being written, rebuilt by walking the chunk
+ * headers. The position starts at the first sample.
+ * @param path Path of the recording.
+ * @return The recording or NULL if there was an error.
+ */
+mma8451_record* mma8451_record_open(const char* path);
+/**
+ * This function rebuilds the index of a recording that was not closed, e.g. after a crash.
+ * A torn chunk at the end is cut off and the index and trailer are written after the last
+ * whole chunk.
+ * @param path Path of the recording.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_record_repair(const char* path);
+/**
+ * This function gets the number of samples in a recording.
+ * @param record Recording.
+ * @return The number of samples.
+ */
+uint64_t mma8451_record_samples(mma8451_record* record);
+/**
+ * This function gets the scale stored with a recording.
+ * @param record Recording.
+ * @return Meters per second squared per count.
+ */
+double mma8451_record_scale(mma8451_record* record);
+/**
+ * This function moves to the first sample taken at or after a time, with a binary search of
+ * the index and one of a single chunk.
+ * @param record Recording opened for reading.
+ * @param timestamp_ns Time to seek to in nanoseconds.
+ * @return 1 if successful, 0 if failure. Seeking past the end succeeds and reads nothing.
+ */
+int mma8451_record_seek_time(mma8451_record* record, uint64_t timestamp_ns);
+/**
+ * This function moves to the first sample with a sequence number at or after sequence.
+ * @param record Recording opened for reading.
+ * @param sequence Sequence number to seek to.
+ * @return 1 if successful, 0 if failure. Seeking past the end succeeds and reads nothing.
+ */
+int mma8451_record_seek_sequence(mma8451_record* record, uint64_t sequence);
+/**
+ * This function reads samples from the current position onwards.
+ * @param record Recording opened for reading.
+ * @param samples Samples to fill. MMA8451_SAMPLE_GAP is set where sequence numbers jump.
+ * @param timestamps_ns Set to each sample's timestamp in nanoseconds, may be NULL.
+ * @param max Size of the buffers.
+ * @return The number of samples read, 0 at the end of the recording or if failure (errno is
+ *         0 at the end).
+ */
+unsigned int mma8451_record_read(mma8451_record* record, mma8451_sample* samples, uint64_t* timestamps_ns, unsigned int max);
+/**
+ * This function closes a recording. A writer first writes the buffered samples, the index
+ * and the trailer.
+ * @param record Recording to close.
+ * @return 1 if successful, 0 if a writer failed to finish the file.
+ */
+int mma8451_record_close(mma8451_record* record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#define _GNU_SOURCE
+#include "mma8451-rt.h"
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+struct mma8451_rt {
+    mma8451* device;
+    mma8451_rt_config config;
+    pthread_t thread;
+    int stopping;
+    int paced;
+    mma8451_pacer pacer;
+    mma8451_rt_report report;
+};
+
+static uint64_t mma8451_rt_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void mma8451_rt_record(mma8451_rt_histogram* histogram, uint64_t latency_ns) {
+    uint64_t bucket = latency_ns / 1000;
+    uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+
+    if(bucket >= MMA8451_RT_HISTOGRAM_BUCKETS) {
+        bucket = MMA8451_RT_HISTOGRAM_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_ns, latency_ns, __ATOMIC_RELAXED);
+    if(latency_ns > max) {
+        __atomic_store_n(&histogram->max_ns, latency_ns, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Touches the stack the loop will run on so the first cycles don't take page faults.
+ */
+static void __attribute__((noinline)) mma8451_rt_prefault_stack(void) {
+    volatile unsigned char stack[MMA8451_RT_STACK_PREFAULT];
+    unsigned int i;
+
+    for(i = 0; i < sizeof(stack); i += 256) {
+        stack[i] = 0;
+    }
+}
+
+static void* mma8451_rt_loop(void* arg) {
+    mma8451_rt* rt = (mma8451_rt*)arg;
+    mma8451_rt_report* report = &rt->report;
+    mma8451_pacer* pacer = &rt->pacer;
+    uint64_t period = report->period_ns;
+    uint64_t next;
+    struct timespec deadline;
+    mma8451_sample sample;
+    int result;
+
+    mma8451_rt_prefault_stack();
+
+    next = mma8451_rt_now_ns() + period;
+    pacer->next_ns = next;
+    while(!__atomic_load_n(&rt->stopping, __ATOMIC_RELAXED)) {
+        uint64_t woke, done;
+
+        //Paced loops follow the device's clock, the pacer moves the deadline.
+        if(rt->paced) {
+            next = pacer->next_ns;
+        }
+        deadline.tv_sec = next / 1000000000ULL;
+        deadline.tv_nsec = next % 1000000000ULL;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+        woke = mma8451_rt_now_ns();
+
+        if(rt->paced) {
+            result = mma8451_pacer_read(rt->device, pacer, &sample);
+        } else {
+            result = mma8451_read_sample(rt->device, &sample);
+        }
+        if(result) {
+            done = mma8451_rt_now_ns();
+            if(rt->config.callback != NULL) {
+                rt->config.callback(&sample, done, rt->config.user);
+            }
+            __atomic_fetch_add(&report->samples, 1, __ATOMIC_RELAXED);
+        } else {
+            done = mma8451_rt_now_ns();
+            if(errno == EAGAIN) {
+                __atomic_fetch_add(&report->not_ready, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_fetch_add(&report->errors, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        mma8451_rt_record(&report->wakeup, woke > next ? woke - next : 0);
+        mma8451_rt_record(&report->completion, done > next ? done - next : 0);
+        __atomic_fetch_add(&report->cycles, 1, __ATOMIC_RELAXED);
+
+        if(rt->paced) {
+            //The pacer restarts its phase after falling behind, count the periods it lost.
+            if(done >= next + pacer->interval_ns) {
+                __atomic_fetch_add(&report->missed, (done - next) / pacer->interval_ns, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+
+        //Stay on the original grid but skip the deadlines that have already passed.
+        next += period;
+        if(done >= next) {
+            uint64_t skipped = (done - next) / period + 1;
+            next += skipped * period;
+            __atomic_fetch_add(&report->missed, skipped, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+mma8451_rt* mma8451_rt_start(mma8451* device, const mma8451_rt_config* config) {
+    mma8451_rt* rt;
+    pthread_attr_t attr;
+    int result;
+
+    if(config->priority < 0 || config->priority > 99) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    //Written out rather than calloc()ed so the pages are faulted in before the loop starts.
+    rt = (mma8451_rt*)malloc(sizeof(mma8451_rt));
+    if(rt == NULL) {
+        return NULL;
+    }
+    memset(rt, 0, sizeof(mma8451_rt));
+    rt->device = device;
+    rt->config = *config;
+
+    rt->report.period_ns = config->period_ns;
+    if(rt->report.period_ns == 0) {
+        if(!mma8451_pacer_init(device, &rt->pacer)) {
+            free(rt);
+            return NULL;
+        }
+        rt->report.period_ns = rt->pacer.period_ns;
+        rt->paced = 1;
+    }
+
+    if(config->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        free(rt);
+        return NULL;
+    }
+
+    pthread_attr_init(&attr);
+    if(config->priority > 0) {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    if(config->cpu >= 0) {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(config->cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    pthread_attr_setstacksize(&attr, MMA8451_RT_STACK_PREFAULT * 4);
+
+    result = pthread_create(&rt->thread, &attr, mma8451_rt_loop, rt);
+    pthread_attr_destroy(&attr);
+    if(result != 0) {
+        free(rt);
+        errno = result;
+        return NULL;
+    }
+
+    return rt;
+}
+
+static void mma8451_rt_copy_histogram(mma8451_rt_histogram* dst, const mma8451_rt_histogram* src) {
+    unsigned int i;
+
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+    dst->sum_ns = __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+    for(i = 0; i < MMA8451_RT_HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+void mma8451_rt_get_report(mma8451_rt* rt, mma8451_rt_report* report) {
+    report->period_ns = rt->report.period_ns;
+    report->cycles = __atomic_load_n(&rt->report.cycles, __ATOMIC_RELAXED);
+    report->samples = __atomic_load_n(&rt->report.samples, __ATOMIC_RELAXED);
+    report->not_ready = __atomic_load_n(&rt->report.not_ready, __ATOMIC_RELAXED);
+    report->errors = __atomic_load_n(&rt->report.errors, __ATOMIC_RELAXED);
+    report->missed = __atomic_load_n(&rt->report.missed, __ATOMIC_RELAXED);
+    mma8451_rt_copy_histogram(&report->wakeup, &rt->report.wakeup);
+    mma8451_rt_copy_histogram(&report->completion, &rt->report.completion);
+}
+
+uint64_t mma8451_rt_percentile(const mma8451_rt_histogram* histogram, double fraction) {
+    uint64_t target, seen = 0;
+    unsigned int i;
+
+    if(histogram->count == 0) {
+        return 0;
+    }
+    target = (uint64_t)(fraction * (double)histogram->count + 0.5);
+    if(target == 0) {
+        target = 1;
+    }
+
+    for(i = 0; i < MMA8451_RT_HISTOGRAM_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if(seen >= target) {
+            uint64_t bound = (uint64_t)(i + 1) * 1000;
+            return bound < histogram->max_ns ? bound : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+void mma8451_rt_stop(mma8451_rt* rt) {
+    if(rt == NULL) {
+        return;
+    }
+    __atomic_store_n(&rt->stopping, 1, __ATOMIC_RELAXED);
+    pthread_join(rt->thread, NULL);
+    free(rt);
+}
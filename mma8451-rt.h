@@ -0,0 +1,183 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_RT_H
+#define MMA8451_RT_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The number of 1 microsecond buckets in a latency histogram. The last bucket also counts
+ * everything slower.
+ */
+#define MMA8451_RT_HISTOGRAM_BUCKETS 2048
+/**
+ * The number of bytes of stack touched by the acquisition thread before its first cycle.
+ */
+#define MMA8451_RT_STACK_PREFAULT (64 * 1024)
+
+/**
+ * Called on the acquisition thread with each sample read. It must not block, allocate or
+ * make system calls if the loop is to keep its latency bound.
+ */
+typedef void (*mma8451_rt_callback)(const mma8451_sample* sample, uint64_t timestamp_ns, void* user);
+
+/**
+ * This structure configures real-time acquisition.
+ */
+typedef struct mma8451_rt_config {
+	/**
+	 * SCHED_FIFO priority of the acquisition thread, 1 to 99. 0 leaves it on the default
+	 * scheduling policy.
+	 */
+	int priority;
+	/**
+	 * CPU the acquisition thread is pinned to, negative to leave it unpinned.
+	 */
+	int cpu;
+	/**
+	 * Lock the process's current and future memory with mlockall(), it stays locked
+	 * after the loop stops.
+	 */
+	int lock_memory;
+	/**
+	 * The read period in nanoseconds on a fixed grid, 0 to follow the data rate in CTRL_REG1
+	 * with mma8451_pacer_read() so reads track the device's clock rather than drift through
+	 * its data-ready edge.
+	 */
+	uint64_t period_ns;
+	/**
+	 * Called with each sample, may be NULL.
+	 */
+	mma8451_rt_callback callback;
+	/**
+	 * User data passed to the callback.
+	 */
+	void* user;
+} mma8451_rt_config;
+
+/**
+ * This structure contains a latency histogram relative to the cycle's scheduled start.
+ */
+typedef struct mma8451_rt_histogram {
+	/**
+	 * The number of cycles measured.
+	 */
+	uint64_t count;
+	/**
+	 * The largest latency seen, in nanoseconds.
+	 */
+	uint64_t max_ns;
+	/**
+	 * The sum of all latencies, in nanoseconds.
+	 */
+	uint64_t sum_ns;
+	/**
+	 * Cycle counts by latency in microseconds.
+	 */
+	uint32_t buckets[MMA8451_RT_HISTOGRAM_BUCKETS];
+} mma8451_rt_histogram;
+
+/**
+ * This structure contains the acquisition loop's counters and jitter histograms.
+ */
+typedef struct mma8451_rt_report {
+	/**
+	 * The read period in use, in nanoseconds.
+	 */
+	uint64_t period_ns;
+	/**
+	 * The number of cycles run.
+	 */
+	uint64_t cycles;
+	/**
+	 * The number of samples delivered.
+	 */
+	uint64_t samples;
+	/**
+	 * Cycles that found no new sample. A paced loop expects about one in five, each moves the
+	 * next read a sixteenth of a period later.
+	 */
+	uint64_t not_ready;
+	/**
+	 * Cycles whose read failed.
+	 */
+	uint64_t errors;
+	/**
+	 * Cycles skipped because the previous one ran past its successor's start.
+	 */
+	uint64_t missed;
+	/**
+	 * Timer expiry to the thread running.
+	 */
+	mma8451_rt_histogram wakeup;
+	/**
+	 * Timer expiry to the sample being read.
+	 */
+	mma8451_rt_histogram completion;
+} mma8451_rt_report;
+
+/**
+ * An opaque real-time acquisition loop.
+ */
+typedef struct mma8451_rt mma8451_rt;
+
+/**
+ * This function starts reading a device with mma8451_read_sample() on a dedicated thread,
+ * once per period on absolute CLOCK_MONOTONIC deadlines. Without a configured period the
+ * deadlines come from a pacer locked to the device's data-ready, so each sample is read once. Everything the loop uses is
+ * allocated and touched here, the loop itself doesn't allocate or format (build with
+ * MMA8451_ERROR_SIZE=0 to also remove the error text formatted on failed transfers).
+ * SCHED_FIFO and mlockall() need CAP_SYS_NICE and CAP_IPC_LOCK or matching rlimits.
+ * @param device Device to read, must not be used elsewhere until stopped.
+ * @param config The loop configuration.
+ * @return The loop or NULL if there was an error.
+ */
+mma8451_rt* mma8451_rt_start(mma8451* device, const mma8451_rt_config* config);
+/**
+ * This function copies the loop's counters and histograms. It can be called while the loop
+ * runs, counters are read individually so a copy may straddle a cycle.
+ * @param rt The loop.
+ * @param report Set to the current counters.
+ */
+void mma8451_rt_get_report(mma8451_rt* rt, mma8451_rt_report* report);
+/**
+ * This function gets the latency a fraction of the cycles stayed within, e.g. 0.9999.
+ * @param histogram Histogram to search.
+ * @param fraction Fraction of cycles, 0 to 1.
+ * @return The latency in nanoseconds, rounded up to the bucket, or the maximum seen if it
+ *         falls in the last bucket.
+ */
+uint64_t mma8451_rt_percentile(const mma8451_rt_histogram* histogram, double fraction);
+/**
+ * This function stops the loop, waiting at most one period, and frees it.
+ * @param rt The loop to stop.
+ */
+void mma8451_rt_stop(mma8451_rt* rt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
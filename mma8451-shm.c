@@ -0,0 +1,313 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "mma8451-shm.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+/**
+ * The ring header, the slots follow it. head is the number of samples ever published and
+ * lives on its own cache line so readers polling it don't contend with slot writes.
+ */
+typedef struct mma8451_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t slot_size;
+    uint64_t scale_bits;
+    unsigned char pad0[40];
+    uint64_t head;
+    unsigned char pad1[56];
+} mma8451_shm_header;
+
+/**
+ * One ring slot. seq is a per-slot seqlock: sample n is being written while it holds
+ * 2n + 1 and is complete once it holds 2n + 2.
+ */
+typedef struct mma8451_shm_slot {
+    uint64_t seq;
+    mma8451_shm_sample sample;
+} mma8451_shm_slot;
+
+struct mma8451_shm {
+    mma8451_shm_header* header;
+    mma8451_shm_slot* slots;
+    size_t size;
+    uint64_t mask;
+    uint64_t next;
+    uint64_t lost;
+    int publisher;
+};
+
+static uint64_t mma8451_shm_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+mma8451_shm* mma8451_shm_create(const char* name, unsigned int capacity, double scale) {
+    mma8451_shm* shm;
+    unsigned int slots = 1;
+    size_t size;
+    void* map;
+    int fd, err;
+
+    if(capacity == 0 || capacity > (1U << 30)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    while(slots < capacity) {
+        slots <<= 1;
+    }
+    size = sizeof(mma8451_shm_header) + (size_t)slots * sizeof(mma8451_shm_slot);
+
+    shm = (mma8451_shm*)calloc(1, sizeof(mma8451_shm));
+    if(shm == NULL) {
+        return NULL;
+    }
+
+    //Replace a ring by unlinking it rather than resizing it in place, readers still mapping
+    //the old object keep valid (if stale) memory instead of faulting on truncated pages.
+    if(shm_unlink(name) < 0 && errno != ENOENT) {
+        free(shm);
+        return NULL;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        free(shm);
+        return NULL;
+    }
+    if(ftruncate(fd, size) < 0) {
+        err = errno;
+        close(fd);
+        free(shm);
+        errno = err;
+        return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if(map == MAP_FAILED) {
+        free(shm);
+        errno = err;
+        return NULL;
+    }
+
+    shm->header = (mma8451_shm_header*)map;
+    shm->slots = (mma8451_shm_slot*)(shm->header + 1);
+    shm->size = size;
+    shm->mask = slots - 1;
+    shm->publisher = 1;
+
+    shm->header->version = MMA8451_SHM_VERSION;
+    shm->header->capacity = slots;
+    shm->header->slot_size = sizeof(mma8451_shm_slot);
+    mma8451_shm_set_scale(shm, scale);
+    //Publishing the magic last marks the ring as ready for readers.
+    __atomic_store_n(&shm->header->magic, MMA8451_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+int mma8451_shm_publish(mma8451_shm* shm, const mma8451_shm_sample* samples, unsigned int count) {
+    uint64_t head, now = 0;
+    unsigned int i;
+
+    if(!shm->publisher) {
+        errno = EBADF;
+        return 0;
+    }
+
+    head = shm->header->head;
+    for(i = 0; i < count; i++, head++) {
+        mma8451_shm_slot* slot = &shm->slots[head & shm->mask];
+
+        __atomic_store_n(&slot->seq, head * 2 + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->sample = samples[i];
+        if(slot->sample.timestamp_ns == 0) {
+            if(now == 0) {
+                now = mma8451_shm_now_ns();
+            }
+            slot->sample.timestamp_ns = now;
+        }
+        __atomic_store_n(&slot->seq, head * 2 + 2, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&shm->header->head, head, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+void mma8451_shm_set_scale(mma8451_shm* shm, double scale) {
+    uint64_t bits;
+
+    memcpy(&bits, &scale, sizeof(bits));
+    __atomic_store_n(&shm->header->scale_bits, bits, __ATOMIC_RELEASE);
+}
+
+double mma8451_shm_scale(mma8451_shm* shm) {
+    uint64_t bits = __atomic_load_n(&shm->header->scale_bits, __ATOMIC_ACQUIRE);
+    double scale;
+
+    memcpy(&scale, &bits, sizeof(scale));
+    return scale;
+}
+
+mma8451_shm* mma8451_shm_open(const char* name) {
+    mma8451_shm* shm;
+    mma8451_shm_header* header;
+    struct stat st;
+    void* map;
+    int fd, err;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) {
+        return NULL;
+    }
+    if(fstat(fd, &st) < 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    if((size_t)st.st_size < sizeof(mma8451_shm_header)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    err = errno;
+    close(fd);
+    if(map == MAP_FAILED) {
+        errno = err;
+        return NULL;
+    }
+
+    header = (mma8451_shm_header*)map;
+    if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != MMA8451_SHM_MAGIC ||
+       header->version != MMA8451_SHM_VERSION ||
+       header->slot_size != sizeof(mma8451_shm_slot) ||
+       header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0 ||
+       sizeof(mma8451_shm_header) + (size_t)header->capacity * sizeof(mma8451_shm_slot) > (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    shm = (mma8451_shm*)calloc(1, sizeof(mma8451_shm));
+    if(shm == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    shm->header = header;
+    shm->slots = (mma8451_shm_slot*)(header + 1);
+    shm->size = st.st_size;
+    shm->mask = header->capacity - 1;
+    shm->next = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+
+    return shm;
+}
+
+/**
+ * Skips a reader that has been lapped by the publisher forward to half a ring behind the
+ * head, leaving the publisher room before it catches up with the reader again.
+ */
+static void mma8451_shm_resync(mma8451_shm* shm) {
+    uint64_t head = __atomic_load_n(&shm->header->head, __ATOMIC_ACQUIRE);
+    uint64_t target = head - ((shm->mask + 1) / 2);
+
+    if(head < (shm->mask + 1) / 2) {
+        target = 0;
+    }
+    if(target > shm->next) {
+        shm->lost += target - shm->next;
+        shm->next = target;
+    } else {
+        //Only the sample being read was overwritten.
+        shm->lost++;
+        shm->next++;
+    }
+}
+
+int mma8451_shm_peek(mma8451_shm* shm, const mma8451_shm_sample** sample) {
+    for(;;) {
+        uint64_t head = __atomic_load_n(&shm->header->head, __ATOMIC_ACQUIRE);
+        uint64_t seq;
+
+        if(shm->next >= head) {
+            return 0;
+        }
+        if(head - shm->next > shm->mask + 1) {
+            mma8451_shm_resync(shm);
+            continue;
+        }
+        seq = __atomic_load_n(&shm->slots[shm->next & shm->mask].seq, __ATOMIC_ACQUIRE);
+        if(seq != shm->next * 2 + 2) {
+            mma8451_shm_resync(shm);
+            continue;
+        }
+        *sample = &shm->slots[shm->next & shm->mask].sample;
+        return 1;
+    }
+}
+
+int mma8451_shm_release(mma8451_shm* shm) {
+    uint64_t seq;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq = __atomic_load_n(&shm->slots[shm->next & shm->mask].seq, __ATOMIC_RELAXED);
+    if(seq != shm->next * 2 + 2) {
+        mma8451_shm_resync(shm);
+        return 0;
+    }
+    shm->next++;
+    return 1;
+}
+
+unsigned int mma8451_shm_read(mma8451_shm* shm, mma8451_shm_sample* samples, unsigned int max) {
+    const mma8451_shm_sample* sample;
+    unsigned int count = 0;
+
+    while(count < max && mma8451_shm_peek(shm, &sample)) {
+        samples[count] = *sample;
+        if(mma8451_shm_release(shm)) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+uint64_t mma8451_shm_lost(mma8451_shm* shm) {
+    return shm->lost;
+}
+
+void mma8451_shm_close(mma8451_shm* shm) {
+    if(shm == NULL) {
+        return;
+    }
+    munmap(shm->header, shm->size);
+    free(shm);
+}
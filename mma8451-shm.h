@@ -0,0 +1,146 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef MMA8451_SHM_H
+#define MMA8451_SHM_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Identifies a libmma8451 shared memory ring ("MMAS").
+ */
+#define MMA8451_SHM_MAGIC 0x53414D4D
+/**
+ * The layout version of the shared memory ring.
+ */
+#define MMA8451_SHM_VERSION 1
+
+/**
+ * This structure contains a single published sample.
+ */
+typedef struct mma8451_shm_sample {
+	/**
+	 * CLOCK_MONOTONIC time the sample was read, in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * X axis in signed counts, multiply by the ring's scale for m/s^2.
+	 */
+	int16_t x;
+	/**
+	 * Y axis in signed counts.
+	 */
+	int16_t y;
+	/**
+	 * Z axis in signed counts.
+	 */
+	int16_t z;
+	/**
+	 * Application defined flags.
+	 */
+	uint16_t flags;
+} mma8451_shm_sample;
+
+/**
+ * An opaque handle to a publisher's or reader's mapping of a ring.
+ */
+typedef struct mma8451_shm mma8451_shm;
+
+/**
+ * This function creates (or replaces) a shared memory ring and maps it for publishing. Only
+ * one process may publish to a ring. A replaced ring is unlinked, readers that still map it
+ * stop seeing new samples and must reopen the name.
+ * @param name POSIX shared memory name, e.g. "/mma8451-i2c-1-1c".
+ * @param capacity Number of samples in the ring, rounded up to a power of two.
+ * @param scale Meters per second squared per count, published for readers.
+ * @return The mapping or NULL if there was an error.
+ */
+mma8451_shm* mma8451_shm_create(const char* name, unsigned int capacity, double scale);
+/**
+ * This function publishes samples. Readers see each sample as soon as it is written.
+ * @param shm Publisher mapping.
+ * @param samples Samples to publish. A zero timestamp is replaced with the current time.
+ * @param count Number of samples.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_shm_publish(mma8451_shm* shm, const mma8451_shm_sample* samples, unsigned int count);
+/**
+ * This function updates the scale published to readers, e.g. after a range change.
+ * @param shm Publisher mapping.
+ * @param scale Meters per second squared per count.
+ */
+void mma8451_shm_set_scale(mma8451_shm* shm, double scale);
+/**
+ * This function maps an existing ring read-only. Reading starts with the next sample published.
+ * @param name POSIX shared memory name.
+ * @return The mapping or NULL if there was an error.
+ */
+mma8451_shm* mma8451_shm_open(const char* name);
+/**
+ * This function gets a pointer to the next sample in the ring without copying it. The sample
+ * must be checked with mma8451_shm_release() after use since the publisher may have
+ * overwritten it in the meantime.
+ * @param shm Reader mapping.
+ * @param sample Set to the next sample.
+ * @return 1 if a sample is available, 0 if the reader has caught up with the publisher.
+ */
+int mma8451_shm_peek(mma8451_shm* shm, const mma8451_shm_sample** sample);
+/**
+ * This function finishes with the sample returned by mma8451_shm_peek() and advances.
+ * @param shm Reader mapping.
+ * @return 1 if the sample was intact while it was used, 0 if it was overwritten, in which
+ *         case the reader has been resynchronized and the sample should be discarded.
+ */
+int mma8451_shm_release(mma8451_shm* shm);
+/**
+ * This function copies up to max new samples out of the ring, resynchronizing after overruns.
+ * @param shm Reader mapping.
+ * @param samples Buffer to fill.
+ * @param max Size of the buffer.
+ * @return The number of samples copied.
+ */
+unsigned int mma8451_shm_read(mma8451_shm* shm, mma8451_shm_sample* samples, unsigned int max);
+/**
+ * This function gets the number of samples this reader has lost to overruns.
+ * @param shm Reader mapping.
+ * @return The number of lost samples.
+ */
+uint64_t mma8451_shm_lost(mma8451_shm* shm);
+/**
+ * This function gets the scale published with the ring.
+ * @param shm Mapping.
+ * @return Meters per second squared per count.
+ */
+double mma8451_shm_scale(mma8451_shm* shm);
+/**
+ * This function unmaps a ring. The publisher's close does not unlink the name, use
+ * shm_unlink() to remove it.
+ * @param shm Mapping to close.
+ */
+void mma8451_shm_close(mma8451_shm* shm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -74,6 +74,8 @@ int main(int argc, char** argv) {
     struct timespec start;
     struct timespec sample;
     unsigned int samples = 0;
+    unsigned int gaps = 0;
+    mma8451_pacer pacer;
     char* path;
     unsigned char address;
 
@@ -94,25 +96,38 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    printf("Successfully opened device, initializing...\n");
+    printf("Successfully opened device using %s transfers, initializing...\n", mma8451_transfer_name(dev->transfer));
     if(!initializeDevice(dev)) {
         perror("Unable to initialize device.");
         return -2;
     }
 
+    //Sleep between samples rather than polling the bus, each sample is read once.
+    if(!mma8451_pacer_init(dev, &pacer)) {
+        perror("Unable to read data rate.");
+        return -2;
+    }
+
     printf("Successfully initialized, starting capture. (Press Ctrl-C to stop)\n");
     clock_gettime(CLOCK_REALTIME, &start);
 
     printf("\n");
     while(1) {
+        mma8451_sample raw;
         mma8451_acceleration data;
         long long duration;
         double samplesPerSecond;
 
-        //Actually read the acceleration data from the accelerometer.
-        if(!mma8451_get_acceleration(dev, &data)) {
+        //Wait for the next sample and read it from the accelerometer.
+        if(!mma8451_pacer_wait(dev, &pacer, &raw)) {
             return 0;
         }
+        gaps += (raw.flags & MMA8451_SAMPLE_GAP) ? 1 : 0;
+
+        //The device was set up for 8-bit samples in the 2G range.
+        data.x = raw.raw.x / (double)RANGE_DIV_2G_8BIT;
+        data.y = raw.raw.y / (double)RANGE_DIV_2G_8BIT;
+        data.z = raw.raw.z / (double)RANGE_DIV_2G_8BIT;
 
         clock_gettime(CLOCK_REALTIME, &sample);
         samples++;
@@ -127,7 +142,7 @@ int main(int argc, char** argv) {
             //Move up a line and clear to the beginning of the line.
             printf("%c[1A%c[K", 0x1b, 0x1b);
             //Print the sample.
-            printf("x=%f, y=%f, z=%f, samplesPerSecond=%f\n", data.x, data.y, data.z, samplesPerSecond);
+            printf("x=%f, y=%f, z=%f, samplesPerSecond=%f, gaps=%u\n", data.x, data.y, data.z, samplesPerSecond, gaps);
         }
     }
 
@@ -0,0 +1,174 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "mma8451-tilt.h"
+#include <errno.h>
+#include <math.h>
+
+/**
+ * Samples are smoothed and decimated into blocks of this many before the angles are computed.
+ */
+#define MMA8451_TILT_BLOCK 64
+
+/**
+ * Odd polynomial approximations of atan(a) on [0, 1], fitted for minimax error.
+ */
+static const struct {
+    float error;
+    unsigned int terms;
+    float c[6];
+} mma8451_tilt_approx[] = {
+    { 5.0e-3f, 2, { 9.724193226e-01f, -1.919995822e-01f } },
+    { 6.2e-4f, 3, { 9.953602836e-01f, -2.887029695e-01f, 7.935171470e-02f } },
+    { 8.2e-5f, 4, { 9.992139906e-01f, -3.211767668e-01f, 1.462686900e-01f, -3.898923866e-02f } },
+    { 1.2e-5f, 5, { 9.998663351e-01f, -3.303048665e-01f, 1.801595707e-01f, -8.515665794e-02f, 2.084520876e-02f } },
+    { 2.5e-6f, 6, { 9.999772174e-01f, -3.326227850e-01f, 1.935400736e-01f, -1.164256285e-01f, 5.264631944e-02f, -1.171869040e-02f } }
+};
+
+#define MMA8451_TILT_APPROX_COUNT (sizeof(mma8451_tilt_approx) / sizeof(mma8451_tilt_approx[0]))
+
+int mma8451_tilt_init(mma8451_tilt_state* state, const mma8451_tilt_config* config) {
+    unsigned int i;
+
+    if(config->smoothing < 0 || config->smoothing >= 1 || config->max_error < 0) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    state->x = state->y = state->z = 0;
+    state->alpha = 1 - config->smoothing;
+    state->decimation = config->decimation ? config->decimation : 1;
+    state->phase = 0;
+    state->primed = 0;
+    state->terms = 0;
+    state->error = 0;
+
+    for(i = 0; i < MMA8451_TILT_APPROX_COUNT; i++) {
+        if(mma8451_tilt_approx[i].error <= config->max_error) {
+            state->terms = mma8451_tilt_approx[i].terms;
+            state->error = mma8451_tilt_approx[i].error;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * atan2 for a block, branch free so the loop vectorizes. The ratio of the smaller to the larger
+ * magnitude is mapped through the polynomial and the result is folded into the right octant.
+ */
+static void mma8451_tilt_atan2(const float* y, const float* x, float* out, unsigned int n, unsigned int index) {
+    const float* c = mma8451_tilt_approx[index].c;
+    unsigned int terms = mma8451_tilt_approx[index].terms;
+    unsigned int i;
+
+    for(i = 0; i < n; i++) {
+        float ax = fabsf(x[i]), ay = fabsf(y[i]);
+        float mx = ax > ay ? ax : ay;
+        float mn = ax > ay ? ay : ax;
+        float a = mn / (mx > 0 ? mx : 1);
+        float s = a * a;
+        float r = c[terms - 1];
+        unsigned int k;
+
+        for(k = terms - 1; k > 0; k--) {
+            r = r * s + c[k - 1];
+        }
+        r *= a;
+        r = ay > ax ? (float)M_PI_2 - r : r;
+        r = x[i] < 0 ? (float)M_PI - r : r;
+        out[i] = y[i] < 0 ? -r : r;
+    }
+}
+
+/**
+ * Computes the angles for a block of smoothed samples.
+ */
+static void mma8451_tilt_angles(const mma8451_tilt_state* state, const float* x, const float* y, const float* z, unsigned int n, mma8451_tilt* out) {
+    float horizontal[MMA8451_TILT_BLOCK], yz[MMA8451_TILT_BLOCK], minus_x[MMA8451_TILT_BLOCK];
+    float pitch[MMA8451_TILT_BLOCK], roll[MMA8451_TILT_BLOCK], tilt[MMA8451_TILT_BLOCK];
+    unsigned int i;
+
+    for(i = 0; i < n; i++) {
+        horizontal[i] = sqrtf(x[i] * x[i] + y[i] * y[i]);
+        yz[i] = sqrtf(y[i] * y[i] + z[i] * z[i]);
+        minus_x[i] = -x[i];
+    }
+
+    if(state->terms == 0) {
+        for(i = 0; i < n; i++) {
+            pitch[i] = atan2f(minus_x[i], yz[i]);
+            roll[i] = atan2f(y[i], z[i]);
+            tilt[i] = atan2f(horizontal[i], z[i]);
+        }
+    } else {
+        unsigned int index = state->terms - mma8451_tilt_approx[0].terms;
+        mma8451_tilt_atan2(minus_x, yz, pitch, n, index);
+        mma8451_tilt_atan2(y, z, roll, n, index);
+        mma8451_tilt_atan2(horizontal, z, tilt, n, index);
+    }
+
+    for(i = 0; i < n; i++) {
+        out[i].pitch = pitch[i];
+        out[i].roll = roll[i];
+        out[i].tilt = tilt[i];
+    }
+}
+
+unsigned int mma8451_tilt_process(mma8451_tilt_state* state, const mma8451_raw_sample* samples, unsigned int count, mma8451_tilt* out) {
+    float x[MMA8451_TILT_BLOCK], y[MMA8451_TILT_BLOCK], z[MMA8451_TILT_BLOCK];
+    float alpha = state->alpha;
+    unsigned int i, n = 0, written = 0;
+
+    for(i = 0; i < count; i++) {
+        if(!state->primed) {
+            state->x = samples[i].x;
+            state->y = samples[i].y;
+            state->z = samples[i].z;
+            state->primed = 1;
+        } else {
+            state->x += alpha * (samples[i].x - state->x);
+            state->y += alpha * (samples[i].y - state->y);
+            state->z += alpha * (samples[i].z - state->z);
+        }
+
+        if(++state->phase < state->decimation) {
+            continue;
+        }
+        state->phase = 0;
+
+        x[n] = state->x;
+        y[n] = state->y;
+        z[n] = state->z;
+        if(++n == MMA8451_TILT_BLOCK) {
+            mma8451_tilt_angles(state, x, y, z, n, out + written);
+            written += n;
+            n = 0;
+        }
+    }
+
+    if(n > 0) {
+        mma8451_tilt_angles(state, x, y, z, n, out + written);
+        written += n;
+    }
+
+    return written;
+}
@@ -0,0 +1,125 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef MMA8451_TILT_H
+#define MMA8451_TILT_H
+
+#include "mma8451.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * This structure configures tilt tracking.
+ */
+typedef struct mma8451_tilt_config {
+	/**
+	 * The largest acceptable angle error in radians from the atan2 approximation. The cheapest
+	 * approximation within the bound is used, 0 uses atan2f().
+	 */
+	float max_error;
+	/**
+	 * Low-pass smoothing applied to the samples before the angles are computed, 0 (off) up to
+	 * but not including 1. Each output moves (1 - smoothing) of the way towards the new sample.
+	 */
+	float smoothing;
+	/**
+	 * Emit one output per this many input samples, 0 or 1 for every sample.
+	 */
+	unsigned int decimation;
+} mma8451_tilt_config;
+
+/**
+ * This structure contains one orientation output, all angles in radians.
+ */
+typedef struct mma8451_tilt {
+	/**
+	 * Rotation about the Y axis, -pi/2 to pi/2, positive when X points down.
+	 */
+	float pitch;
+	/**
+	 * Rotation about the X axis, -pi to pi, 0 when Z points up.
+	 */
+	float roll;
+	/**
+	 * Angle between Z and vertical, 0 to pi.
+	 */
+	float tilt;
+} mma8451_tilt;
+
+/**
+ * This structure contains the tracking state, set up by mma8451_tilt_init().
+ */
+typedef struct mma8451_tilt_state {
+	/**
+	 * Smoothed X, Y and Z in counts.
+	 */
+	float x, y, z;
+	/**
+	 * The smoothing factor applied to each new sample.
+	 */
+	float alpha;
+	/**
+	 * The error bound of the selected approximation.
+	 */
+	float error;
+	/**
+	 * The selected approximation, 0 for atan2f().
+	 */
+	unsigned int terms;
+	/**
+	 * The decimation factor.
+	 */
+	unsigned int decimation;
+	/**
+	 * Samples consumed since the last output.
+	 */
+	unsigned int phase;
+	/**
+	 * Whether or not the smoothed values hold a sample yet.
+	 */
+	unsigned char primed;
+} mma8451_tilt_state;
+
+/**
+ * This function initializes tilt tracking.
+ * @param state The state to initialize.
+ * @param config The configuration.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_tilt_init(mma8451_tilt_state* state, const mma8451_tilt_config* config);
+/**
+ * This function computes pitch, roll and tilt for a block of samples. The samples are in
+ * counts straight from the device, e.g. a mma8451_drain_fifo() burst, since the angles don't
+ * depend on the scale.
+ * @param state The tracking state.
+ * @param samples The samples.
+ * @param count Number of samples.
+ * @param out Outputs to fill, room for count / decimation + 1 entries.
+ * @return The number of outputs written.
+ */
+unsigned int mma8451_tilt_process(mma8451_tilt_state* state, const mma8451_raw_sample* samples, unsigned int count, mma8451_tilt* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
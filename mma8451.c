@@ -27,23 +27,103 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#ifndef MMA8451_DISABLE_STATS
+#define MMA8451_STATS_ADD(counter, n) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#else
+#define MMA8451_STATS_ADD(counter, n) ((void)0)
+#endif
+
+#if MMA8451_ERROR_SIZE > 0
+#define MMA8451_SET_ERROR(device, ...) snprintf((device)->last_error, MMA8451_ERROR_SIZE, __VA_ARGS__)
+#else
+#define MMA8451_SET_ERROR(device, ...) ((void)0)
+#endif
+
+/**
+ * Counters for transfers made through the low level i2c functions without a device.
+ */
+static mma8451_stats mma8451_unattributed_stats;
+
+static int mma8451_i2c_rdwr(mma8451_stats* stats, mma8451_stats_op op, int file, struct i2c_msg* messages, int nmsgs);
+static int mma8451_device_rdwr(mma8451* device, mma8451_stats_op op, struct i2c_msg* messages, unsigned int nmsgs);
+static int mma8451_device_get_block(mma8451* device, mma8451_stats_op op, unsigned char reg, unsigned char* buf, unsigned int cnt);
+static int mma8451_device_set(mma8451* device, unsigned char reg, unsigned char value);
+static int mma8451_i2c_set(mma8451_stats* stats, int file, unsigned char addr, unsigned char reg, unsigned char value);
+static int mma8451_i2c_get(mma8451_stats* stats, int file, unsigned char addr, unsigned char reg, unsigned char *val);
+static int mma8451_i2c_get_block(mma8451_stats* stats, int file, unsigned char addr, unsigned char reg, unsigned char *buf, unsigned int cnt);
 
 mma8451* mma8451_open(char* path, unsigned char addr) {
-    mma8451* dev = (mma8451*)calloc(1, sizeof(mma8451));
-    unsigned char whoami;
+    mma8451* dev;
+    void* storage;
+    int file;
+
+    file = open(path, O_RDWR);
+    if(file < 0) {
+        return NULL;
+    }
+
+    //Keep the hot fields at the start of the handle on their own cache line.
+    if(posix_memalign(&storage, 64, sizeof(mma8451)) != 0) {
+        close(file);
+        errno = ENOMEM;
+        return NULL;
+    }
+    dev = (mma8451*)storage;
 
-    dev->path = (char*)calloc(1, strlen(path) + 1);
-    strcpy(dev->path, path);
-    dev->addr = addr;
+    if(!mma8451_init(dev, file, addr)) {
+        int err = errno;
+        close(file);
+        free(dev);
+        errno = err;
+        return NULL;
+    }
 
-    dev->file = open(path, O_RDWR);
-    if(dev->file < 0) {
-        free(dev->path);
+    dev->path = strdup(path);
+    if(dev->path == NULL) {
+        close(file);
         free(dev);
+        errno = ENOMEM;
         return NULL;
     }
 
-    if(!mma8451_get_whoami(dev, &whoami)) {
+    return dev;
+}
+
+static int mma8451_smbus_address(mma8451* device, unsigned char addr);
+static void mma8451_smbus_forget(int fd);
+
+int mma8451_init(mma8451* device, int fd, unsigned char addr) {
+    unsigned long funcs;
+    unsigned char whoami;
+
+    memset(device, 0, sizeof(mma8451));
+    device->file = fd;
+    device->addr = addr;
+    device->range = MMA8451_RANGE_2G;
+    device->data_size = MMA8451_14BIT_OUTPUT;
+
+    //Use the fastest transfers the adapter supports. If it can't report them, assume I2C_RDWR.
+    if(ioctl(fd, I2C_FUNCS, &funcs) == 0 && !(funcs & I2C_FUNC_I2C)) {
+        if(!(funcs & I2C_FUNC_SMBUS_READ_I2C_BLOCK) || !(funcs & I2C_FUNC_SMBUS_WRITE_BYTE_DATA)) {
+            errno = EOPNOTSUPP;
+            return 0;
+        }
+        device->transfer = MMA8451_TRANSFER_SMBUS;
+        device->max_read = MMA8451_SMBUS_BLOCK_MAX;
+        //The file may be new or reused, don't trust an address set through an earlier one.
+        mma8451_smbus_forget(fd);
+        if(!mma8451_smbus_address(device, addr)) {
+            return 0;
+        }
+    }
+
+    if(!mma8451_get_whoami(device, &whoami)) {
         return 0;
     }
 
@@ -53,16 +133,49 @@ mma8451* mma8451_open(char* path, unsigned char addr) {
         return 0;
     }
 
-    dev->range = MMA8451_RANGE_2G;
-    dev->data_size = MMA8451_14BIT_OUTPUT;
+    return 1;
+}
 
-    return dev;
+int mma8451_set_transfer(mma8451* device, mma8451_transfer_mode mode, unsigned int max_read) {
+    if(mode == MMA8451_TRANSFER_SMBUS) {
+        if(max_read == 0 || max_read > MMA8451_SMBUS_BLOCK_MAX) {
+            max_read = MMA8451_SMBUS_BLOCK_MAX;
+        }
+    } else if(mode == MMA8451_TRANSFER_I2C_CHUNKED) {
+        if(max_read < 8) {
+            errno = EINVAL;
+            return 0;
+        }
+    } else if(mode != MMA8451_TRANSFER_I2C) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if(mode == MMA8451_TRANSFER_SMBUS && !mma8451_smbus_address(device, device->addr)) {
+        return 0;
+    }
+    device->transfer = mode;
+    device->max_read = (mode == MMA8451_TRANSFER_I2C) ? 0 : max_read;
+    return 1;
+}
+
+const char* mma8451_transfer_name(mma8451_transfer_mode mode) {
+    switch(mode) {
+    case MMA8451_TRANSFER_I2C:
+        return "i2c";
+    case MMA8451_TRANSFER_I2C_CHUNKED:
+        return "i2c-chunked";
+    case MMA8451_TRANSFER_SMBUS:
+        return "smbus";
+    }
+    return "unknown";
 }
 
 int mma8451_close(mma8451* dev) {
     if(dev == NULL) {
         return 0;
     }
+    mma8451_smbus_forget(dev->file);
     close(dev->file);
     free(dev->path);
     free(dev);
@@ -90,7 +203,7 @@ int mma8451_reset(mma8451* device) {
 int mma8451_get_acceleration(mma8451* device, mma8451_acceleration* data) {
     if(device->data_size == MMA8451_14BIT_OUTPUT) {
         unsigned char tmp[6];
-        if(!mma8451_get_i2c_register_block(device->file, device->addr, MMA8451_REGISTER_OUT_X_MSB, (unsigned char*)&tmp, 6)) {
+        if(!mma8451_device_get_block(device, MMA8451_STATS_OP_BLOCK_READ, MMA8451_REGISTER_OUT_X_MSB, (unsigned char*)&tmp, 6)) {
             return 0;
         }
 
@@ -117,7 +230,7 @@ int mma8451_get_acceleration(mma8451* device, mma8451_acceleration* data) {
         }
     } else {
         unsigned char tmp[3];
-        if(!mma8451_get_i2c_register_block(device->file, device->addr, MMA8451_REGISTER_OUT_X_MSB, (unsigned char*)&tmp, 3)) {
+        if(!mma8451_device_get_block(device, MMA8451_STATS_OP_BLOCK_READ, MMA8451_REGISTER_OUT_X_MSB, (unsigned char*)&tmp, 3)) {
             return 0;
         }
         
@@ -144,6 +257,317 @@ int mma8451_get_acceleration(mma8451* device, mma8451_acceleration* data) {
         }
     }
 
+    MMA8451_STATS_ADD(device->stats.samples, 1);
+
+    return 1;
+}
+
+int mma8451_drain_fifo(mma8451* device, mma8451_raw_sample* samples, unsigned int count) {
+    unsigned char buf[32 * 6];
+    unsigned int bytes = (device->data_size == MMA8451_8BIT_OUTPUT) ? 3 : 6;
+
+    if(count > 32) {
+        errno = EINVAL;
+        return 0;
+    }
+    if(count == 0) {
+        return 1;
+    }
+    if(!mma8451_get_register_block(device, MMA8451_REGISTER_OUT_X_MSB, buf, count * bytes)) {
+        return 0;
+    }
+
+    mma8451_decode_samples(device, buf, count, samples);
+    MMA8451_STATS_ADD(device->stats.samples, count);
+
+    return 1;
+}
+
+int mma8451_read_sample(mma8451* device, mma8451_sample* sample) {
+    unsigned char buf[7];
+    unsigned int bytes = (device->data_size == MMA8451_8BIT_OUTPUT) ? 3 : 6;
+
+    if(!mma8451_get_register_block(device, MMA8451_REGISTER_STATUS, buf, bytes + 1)) {
+        return 0;
+    }
+
+    if(!MMA8451_FIELD_GET(buf[0], MMA8451_STATUS_ZYXDR)) {
+        MMA8451_STATS_ADD(device->stats.duplicates, 1);
+        errno = EAGAIN;
+        return 0;
+    }
+
+    sample->flags = 0;
+    if(MMA8451_FIELD_GET(buf[0], MMA8451_STATUS_ZYXOW)) {
+        //At least one sample was overwritten, give it a sequence number so the gap is visible.
+        device->sequence++;
+        sample->flags |= MMA8451_SAMPLE_GAP;
+        MMA8451_STATS_ADD(device->stats.overruns, 1);
+    }
+
+    mma8451_decode_samples(device, &buf[1], 1, &sample->raw);
+    sample->status = buf[0];
+    sample->sequence = device->sequence++;
+    MMA8451_STATS_ADD(device->stats.samples, 1);
+
+    return 1;
+}
+
+int mma8451_read_bus(mma8451_bus_read* reads, unsigned int count) {
+    struct i2c_msg messages[MMA8451_BUS_READ_MAX * 2];
+    unsigned char buf[MMA8451_BUS_READ_MAX][1 + 32 * 6];
+    unsigned char reg = MMA8451_REGISTER_STATUS;
+    unsigned int i;
+
+    if(count == 0 || count > MMA8451_BUS_READ_MAX) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    for(i = 0; i < count; i++) {
+        mma8451* device = reads[i].device;
+        unsigned int bytes = (device->data_size == MMA8451_8BIT_OUTPUT) ? 3 : 6;
+        unsigned int samples = reads[i].fifo ? reads[i].count : 1;
+
+        if(device->file != reads[0].device->file || samples > 32) {
+            errno = EINVAL;
+            return 0;
+        }
+
+        messages[i * 2].addr      = device->addr;
+        messages[i * 2].flags     = 0;
+        messages[i * 2].len       = 1;
+        messages[i * 2].buf       = &reg;
+
+        messages[i * 2 + 1].addr  = device->addr;
+        messages[i * 2 + 1].flags = I2C_M_RD;
+        messages[i * 2 + 1].len   = 1 + samples * bytes;
+        messages[i * 2 + 1].buf   = buf[i];
+    }
+
+    if(!mma8451_transfer(reads[0].device, messages, count * 2)) {
+        return 0;
+    }
+
+    for(i = 0; i < count; i++) {
+        mma8451_bus_read* read = &reads[i];
+        mma8451* device = read->device;
+        unsigned char status = buf[i][0];
+
+        read->status = status;
+        read->flags = 0;
+        if(read->fifo) {
+            unsigned int queued = MMA8451_FIELD_GET(status, MMA8451_F_STATUS_F_CNT);
+
+            read->valid = queued < read->count ? queued : read->count;
+            if(MMA8451_FIELD_GET(status, MMA8451_F_STATUS_F_OVF)) {
+                device->sequence++;
+                read->flags |= MMA8451_SAMPLE_GAP;
+                MMA8451_STATS_ADD(device->stats.fifo_overflows, 1);
+            }
+        } else if(!MMA8451_FIELD_GET(status, MMA8451_STATUS_ZYXDR)) {
+            read->valid = 0;
+            MMA8451_STATS_ADD(device->stats.duplicates, 1);
+        } else {
+            read->valid = 1;
+            if(MMA8451_FIELD_GET(status, MMA8451_STATUS_ZYXOW)) {
+                device->sequence++;
+                read->flags |= MMA8451_SAMPLE_GAP;
+                MMA8451_STATS_ADD(device->stats.overruns, 1);
+            }
+        }
+
+        mma8451_decode_samples(device, &buf[i][1], read->valid, read->samples);
+        read->sequence = device->sequence;
+        device->sequence += read->valid;
+        MMA8451_STATS_ADD(device->stats.samples, read->valid);
+    }
+
+    return 1;
+}
+
+void mma8451_decode_samples(mma8451* device, const unsigned char* buf, unsigned int count, mma8451_raw_sample* samples) {
+    unsigned int i;
+
+    if(device->data_size == MMA8451_8BIT_OUTPUT) {
+        for(i = 0; i < count; i++, buf += 3) {
+            samples[i].x = (int8_t)buf[0];
+            samples[i].y = (int8_t)buf[1];
+            samples[i].z = (int8_t)buf[2];
+        }
+    } else {
+        for(i = 0; i < count; i++, buf += 6) {
+            samples[i].x = (int16_t)((buf[0] << 8) | buf[1]) >> 2;
+            samples[i].y = (int16_t)((buf[2] << 8) | buf[3]) >> 2;
+            samples[i].z = (int16_t)((buf[4] << 8) | buf[5]) >> 2;
+        }
+    }
+}
+
+static uint64_t mma8451_stats_take64(uint64_t* counter, unsigned char reset) {
+    return reset ? __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED) : __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+#if MMA8451_STATS_ERRNO_BUCKETS > 0 || MMA8451_STATS_LATENCY_BUCKETS > 0
+static uint32_t mma8451_stats_take32(uint32_t* counter, unsigned char reset) {
+    return reset ? __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED) : __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+#endif
+
+int mma8451_get_stats(mma8451* device, mma8451_stats* stats, unsigned char reset) {
+    mma8451_stats* src = (device != NULL) ? &device->stats : &mma8451_unattributed_stats;
+#if MMA8451_STATS_ERRNO_BUCKETS > 0 || MMA8451_STATS_LATENCY_BUCKETS > 0
+    int i;
+#endif
+#if MMA8451_STATS_LATENCY_BUCKETS > 0
+    int j;
+#endif
+
+    if(stats == NULL) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    stats->ioctls = mma8451_stats_take64(&src->ioctls, reset);
+    stats->bytes_read = mma8451_stats_take64(&src->bytes_read, reset);
+    stats->bytes_written = mma8451_stats_take64(&src->bytes_written, reset);
+    stats->errors = mma8451_stats_take64(&src->errors, reset);
+    stats->retries = mma8451_stats_take64(&src->retries, reset);
+    stats->fifo_overflows = mma8451_stats_take64(&src->fifo_overflows, reset);
+    stats->samples = mma8451_stats_take64(&src->samples, reset);
+    stats->duplicates = mma8451_stats_take64(&src->duplicates, reset);
+    stats->overruns = mma8451_stats_take64(&src->overruns, reset);
+
+#if MMA8451_STATS_ERRNO_BUCKETS > 0
+    for(i = 0; i < MMA8451_STATS_ERRNO_BUCKETS; i++) {
+        stats->errors_by_errno[i] = mma8451_stats_take32(&src->errors_by_errno[i], reset);
+    }
+#endif
+
+#if MMA8451_STATS_LATENCY_BUCKETS > 0
+    for(i = 0; i < MMA8451_STATS_OP_COUNT; i++) {
+        for(j = 0; j < MMA8451_STATS_LATENCY_BUCKETS; j++) {
+            stats->latency[i][j] = mma8451_stats_take32(&src->latency[i][j], reset);
+        }
+    }
+#endif
+
+    return 1;
+}
+
+/**
+ * The runs of contiguous writable registers, in the order they're restored. Read-only and
+ * reserved registers between them are skipped. CTRL_REG1 is included in the last run so it
+ * goes out with the rest of the configuration (with ACTIVE cleared).
+ */
+static const unsigned char mma8451_restore_runs[][2] = {
+    { MMA8451_REGISTER_F_SETUP, 2 },
+    { MMA8451_REGISTER_XYZ_DATA_CFG, 2 },
+    { MMA8451_REGISTER_PL_CFG, 5 },
+    { MMA8451_REGISTER_FF_MT_THS, 2 },
+    { MMA8451_REGISTER_TRANSIENT_CFG, 1 },
+    { MMA8451_REGISTER_TRANSIENT_THS, 3 },
+    { MMA8451_REGISTER_PULSE_THSX, 7 },
+    { MMA8451_REGISTER_CTRL_REG1, 8 }
+};
+
+#define MMA8451_RESTORE_RUN_COUNT (sizeof(mma8451_restore_runs) / sizeof(mma8451_restore_runs[0]))
+
+int mma8451_snapshot(mma8451* device, mma8451_register_map* map) {
+    unsigned char status_reg = MMA8451_REGISTER_STATUS;
+    unsigned char config_reg = MMA8451_REGISTER_RESERVED_1;
+    struct i2c_msg messages[4];
+
+    memset(map, 0, sizeof(mma8451_register_map));
+
+    //The sample registers (0x01 - 0x06) are skipped, reading them would pop a sample off the
+    //FIFO and the auto-increment pointer doesn't advance linearly through them in FIFO or
+    //fast read mode. Both reads go out as one I2C_RDWR with repeated starts.
+    messages[0].addr  = device->addr;
+    messages[0].flags = 0;
+    messages[0].len   = 1;
+    messages[0].buf   = &status_reg;
+
+    messages[1].addr  = device->addr;
+    messages[1].flags = I2C_M_RD;
+    messages[1].len   = 1;
+    messages[1].buf   = &map->regs[MMA8451_REGISTER_STATUS];
+
+    messages[2].addr  = device->addr;
+    messages[2].flags = 0;
+    messages[2].len   = 1;
+    messages[2].buf   = &config_reg;
+
+    messages[3].addr  = device->addr;
+    messages[3].flags = I2C_M_RD;
+    messages[3].len   = MMA8451_REGISTER_COUNT - MMA8451_REGISTER_RESERVED_1;
+    messages[3].buf   = &map->regs[MMA8451_REGISTER_RESERVED_1];
+
+    if(!mma8451_device_rdwr(device, MMA8451_STATS_OP_BLOCK_READ, messages, 4)) {
+        MMA8451_SET_ERROR(device, "Unable to read register map: %s : %u", strerror(errno), errno);
+        return 0;
+    }
+
+    return 1;
+}
+
+int mma8451_restore(mma8451* device, const mma8451_register_map* map) {
+    unsigned char buf[2 + MMA8451_RESTORE_RUN_COUNT + MMA8451_REGISTER_COUNT];
+    struct i2c_msg messages[1 + MMA8451_RESTORE_RUN_COUNT];
+    unsigned char ctrl_reg1 = map->regs[MMA8451_REGISTER_CTRL_REG1];
+    unsigned char standby = MMA8451_FIELD_SET(ctrl_reg1, MMA8451_CTRL_REG1_ACTIVE, 0);
+    unsigned int i, n = 0, off = 0;
+
+    //Most control registers can only be changed in standby.
+    if(!mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, standby)) {
+        return 0;
+    }
+
+    //The FIFO can only move between circular, fill and trigger mode through disabled.
+    if(map->regs[MMA8451_REGISTER_F_SETUP] != 0) {
+        messages[0].addr  = device->addr;
+        messages[0].flags = 0;
+        messages[0].len   = 2;
+        messages[0].buf   = buf;
+
+        buf[0] = MMA8451_REGISTER_F_SETUP;
+        buf[1] = 0;
+        n = 1;
+        off = 2;
+    }
+
+    for(i = 0; i < MMA8451_RESTORE_RUN_COUNT; i++, n++) {
+        unsigned char start = mma8451_restore_runs[i][0];
+        unsigned char len = mma8451_restore_runs[i][1];
+
+        messages[n].addr  = device->addr;
+        messages[n].flags = 0;
+        messages[n].len   = len + 1;
+        messages[n].buf   = &buf[off];
+
+        buf[off] = start;
+        memcpy(&buf[off + 1], &map->regs[start], len);
+        off += len + 1;
+    }
+
+    //Stay in standby until everything else is written and never trigger a reset.
+    buf[off - 8] = standby;
+    buf[off - 7] = MMA8451_FIELD_SET(map->regs[MMA8451_REGISTER_CTRL_REG2], MMA8451_CTRL_REG2_RST, 0);
+
+    if(!mma8451_device_rdwr(device, MMA8451_STATS_OP_WRITE, messages, n)) {
+        MMA8451_SET_ERROR(device, "Unable to write register map: %s : %u", strerror(errno), errno);
+        return 0;
+    }
+
+    device->range = mma8451_map_range(map);
+    device->data_size = mma8451_map_output_size(map);
+
+    if(ctrl_reg1 != standby) {
+        if(!mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, ctrl_reg1)) {
+            return 0;
+        }
+    }
+
     return 1;
 }
 
@@ -203,6 +627,72 @@ int mma8451_set_data_rate(mma8451* device, mma8451_data_rate rate) {
 
     return 1;
 }
+/**
+ * High-pass cutoffs in hz at SEL 0 for each power mode and data rate, each SEL step halves it.
+ */
+static const double mma8451_hp_cutoffs[4][8] = {
+    //MMA8451_POWER_MODE_NORMAL
+    { 16, 16, 8, 4, 2, 2, 2, 2 },
+    //MMA8451_POWER_MODE_LNOISE_LPOWER
+    { 16, 16, 8, 4, 2, 0.5, 0.25, 0.25 },
+    //MMA8451_POWER_MODE_HIGH_RES
+    { 16, 16, 16, 16, 16, 16, 16, 16 },
+    //MMA8451_POWER_MODE_LOW_POWER
+    { 16, 8, 4, 2, 1, 0.25, 0.25, 0.25 }
+};
+
+double mma8451_hp_cutoff_hz(mma8451_data_rate rate, mma8451_power_mode mode, unsigned char sel) {
+    return mma8451_hp_cutoffs[mode & 0x3][rate & 0x7] / (1 << (sel & 0x3));
+}
+
+int mma8451_set_high_pass(mma8451* device, double hz, unsigned char output, double* actual) {
+    unsigned char ctrl1, ctrl2, cutoff, xyz, sel, best = 0;
+    double best_distance = 0;
+
+    if(hz <= 0) {
+        errno = EINVAL;
+        return 0;
+    }
+    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, &ctrl1) ||
+       !mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG2, NULL, &ctrl2) ||
+       !mma8451_get_register(device, MMA8451_REGISTER_HP_FILTER_CUTOFF, NULL, &cutoff) ||
+       !mma8451_get_register(device, MMA8451_REGISTER_XYZ_DATA_CFG, NULL, &xyz)) {
+        return 0;
+    }
+
+    //Nearest on a log scale since the choices are octaves apart.
+    for(sel = 0; sel < 4; sel++) {
+        double available = mma8451_hp_cutoff_hz((mma8451_data_rate)MMA8451_FIELD_GET(ctrl1, MMA8451_CTRL_REG1_DR),
+            (mma8451_power_mode)MMA8451_FIELD_GET(ctrl2, MMA8451_CTRL_REG2_MODS), sel);
+        double distance = (available > hz) ? available / hz : hz / available;
+        if(sel == 0 || distance < best_distance) {
+            best = sel;
+            best_distance = distance;
+        }
+    }
+
+    cutoff = MMA8451_FIELD_SET(cutoff, MMA8451_HP_FILTER_CUTOFF_SEL, best);
+    xyz = MMA8451_FIELD_SET(xyz, MMA8451_XYZ_DATA_CFG_HPF_OUT, output ? 1 : 0);
+
+    if((ctrl1 & MMA8451_CTRL_REG1_ACTIVE_MASK) &&
+       !mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, ctrl1 & ~MMA8451_CTRL_REG1_ACTIVE_MASK)) {
+        return 0;
+    }
+    if(!mma8451_set_register(device, MMA8451_REGISTER_HP_FILTER_CUTOFF, NULL, cutoff) ||
+       !mma8451_set_register(device, MMA8451_REGISTER_XYZ_DATA_CFG, NULL, xyz)) {
+        return 0;
+    }
+    if((ctrl1 & MMA8451_CTRL_REG1_ACTIVE_MASK) && !mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, ctrl1)) {
+        return 0;
+    }
+
+    if(actual != NULL) {
+        *actual = mma8451_hp_cutoff_hz((mma8451_data_rate)MMA8451_FIELD_GET(ctrl1, MMA8451_CTRL_REG1_DR),
+            (mma8451_power_mode)MMA8451_FIELD_GET(ctrl2, MMA8451_CTRL_REG2_MODS), best);
+    }
+    return 1;
+}
+
 int mma8451_set_low_noise(mma8451* device, unsigned char low_noise) {
     mma8451_register_ctrl_reg1 cfg;
     if(!mma8451_get_ctrl_reg1(device, &cfg)) {
@@ -274,6 +764,64 @@ int mma8451_set_active(mma8451* device, unsigned char active) {
     return 1;
 }
 
+/**
+ * Packs a compatibility register structure into a single register byte.
+ */
+static unsigned char mma8451_pack_register(mma8451_register_generic* data) {
+    unsigned char value = 0;
+
+    value |= (data->bit7 & 0x1) << 7;
+    value |= (data->bit6 & 0x1) << 6;
+    value |= (data->bit5 & 0x1) << 5;
+    value |= (data->bit4 & 0x1) << 4;
+    value |= (data->bit3 & 0x1) << 3;
+    value |= (data->bit2 & 0x1) << 2;
+    value |= (data->bit1 & 0x1) << 1;
+    value |= (data->bit0 & 0x1);
+    return value;
+}
+
+/**
+ * Unpacks a single register byte into a compatibility register structure.
+ */
+static void mma8451_unpack_register(unsigned char value, mma8451_register_generic* data) {
+    data->bit7 = (value >> 7) & 0x1;
+    data->bit6 = (value >> 6) & 0x1;
+    data->bit5 = (value >> 5) & 0x1;
+    data->bit4 = (value >> 4) & 0x1;
+    data->bit3 = (value >> 3) & 0x1;
+    data->bit2 = (value >> 2) & 0x1;
+    data->bit1 = (value >> 1) & 0x1;
+    data->bit0 = value & 0x1;
+}
+
+/**
+ * Shared implementation of the PULSE_THSX/Y/Z getters.
+ */
+static int mma8451_get_pulse_ths(mma8451* device, mma8451_register reg, mma8451_register_pulse_ths* data) {
+    unsigned char value;
+    if(!mma8451_get_register(device, reg, (mma8451_register_generic*)data, &value)) {
+        return 0;
+    }
+    data->ths = MMA8451_FIELD_GET(value, MMA8451_PULSE_THSX_THS);
+    return 1;
+}
+
+/**
+ * Shared implementation of the PULSE_THSX/Y/Z setters.
+ */
+static int mma8451_set_pulse_ths(mma8451* device, mma8451_register reg, mma8451_register_pulse_ths* data) {
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
+
+    value = MMA8451_FIELD_SET(value, MMA8451_PULSE_THSX_THS, data->ths);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
+
+    if(!mma8451_set_register(device, reg, NULL, value)) {
+        return 0;
+    }
+    return 1;
+}
+
 int mma8451_get_status(mma8451* device, mma8451_register_status* data) {
     if(!mma8451_get_register(device, MMA8451_REGISTER_STATUS, (mma8451_register_generic*)data, NULL)) {
         return 0;
@@ -281,48 +829,35 @@ int mma8451_get_status(mma8451* device, mma8451_register_status* data) {
     return 1;
 }
 int mma8451_get_f_status(mma8451* device, mma8451_register_f_status* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_F_STATUS, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_F_STATUS, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
-    data->f_cnt = 0;
-    data->f_cnt += (data->f_cnt5 << 5);
-    data->f_cnt += (data->f_cnt4 << 4);
-    data->f_cnt += (data->f_cnt3 << 3);
-    data->f_cnt += (data->f_cnt2 << 2);
-    data->f_cnt += (data->f_cnt1 << 1);
-    data->f_cnt += data->f_cnt0;
+    data->f_cnt = MMA8451_FIELD_GET(value, MMA8451_F_STATUS_F_CNT);
+
+    if(data->f_ovf) {
+        MMA8451_STATS_ADD(device->stats.fifo_overflows, 1);
+    }
     return 1;
 }
 int mma8451_get_f_setup(mma8451* device, mma8451_register_f_setup* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_F_SETUP, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_F_SETUP, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
 
-    data->f_mode = 0;
-    data->f_mode += (data->f_mode1 << 1);
-    data->f_mode += data->f_mode0;
-
-    data->f_wmrk = 0;
-    data->f_wmrk += (data->f_wmrk5 << 5);
-    data->f_wmrk += (data->f_wmrk4 << 4);
-    data->f_wmrk += (data->f_wmrk3 << 3);
-    data->f_wmrk += (data->f_wmrk2 << 2);
-    data->f_wmrk += (data->f_wmrk1 << 1);
-    data->f_wmrk +=  data->f_wmrk0;
+    data->f_mode = MMA8451_FIELD_GET(value, MMA8451_F_SETUP_F_MODE);
+    data->f_wmrk = MMA8451_FIELD_GET(value, MMA8451_F_SETUP_F_WMRK);
     return 1;
 }
 int mma8451_set_f_setup(mma8451* device, mma8451_register_f_setup* data) {
-    data->f_mode1 = (data->f_mode >> 1) & 0x1;
-    data->f_mode0 = data->f_mode & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    data->f_wmrk5 = (data->f_wmrk >> 5) & 0x1;
-    data->f_wmrk4 = (data->f_wmrk >> 4) & 0x1;
-    data->f_wmrk3 = (data->f_wmrk >> 3) & 0x1;
-    data->f_wmrk2 = (data->f_wmrk >> 2) & 0x1;
-    data->f_wmrk1 = (data->f_wmrk >> 1) & 0x1;
-    data->f_wmrk0 = data->f_wmrk & 0x1;
+    value = MMA8451_FIELD_SET(value, MMA8451_F_SETUP_F_MODE, data->f_mode);
+    value = MMA8451_FIELD_SET(value, MMA8451_F_SETUP_F_WMRK, data->f_wmrk);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
 
-    if(!mma8451_set_register(device, MMA8451_REGISTER_F_SETUP, (mma8451_register_generic*)data, 0)) {
+    if(!mma8451_set_register(device, MMA8451_REGISTER_F_SETUP, NULL, value)) {
         return 0;
     }
     return 1;
@@ -340,20 +875,13 @@ int mma8451_set_trig_cfg(mma8451* device, mma8451_register_trig_cfg* data) {
     return 1;
 }
 int mma8451_get_sysmod(mma8451* device, mma8451_register_sysmod* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_SYSMOD, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_SYSMOD, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
 
-    data->fgt = 0;
-    data->fgt += (data->fgt_4 << 4);
-    data->fgt += (data->fgt_3 << 3);
-    data->fgt += (data->fgt_2 << 2);
-    data->fgt += (data->fgt_1 << 1);
-    data->fgt +=  data->fgt_0;
-
-    data->mode = 0;
-    data->mode += (data->sysmod1 << 1);
-    data->mode += data->sysmod0;
+    data->fgt = MMA8451_FIELD_GET(value, MMA8451_SYSMOD_FGT);
+    data->mode = MMA8451_FIELD_GET(value, MMA8451_SYSMOD_SYSMOD);
     return 1;
 }
 int mma8451_get_int_source(mma8451* device, mma8451_register_int_source* data) {
@@ -369,20 +897,21 @@ int mma8451_get_whoami(mma8451* device, unsigned char* whoami) {
     return 1;
 }
 int mma8451_get_xyz_data_cfg(mma8451* device, mma8451_register_xyz_data_cfg* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_XYZ_DATA_CFG, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_XYZ_DATA_CFG, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
 
-    data->fs = 0;
-    data->fs += (data->fs1 << 1);
-    data->fs += (data->fs0);
+    data->fs = MMA8451_FIELD_GET(value, MMA8451_XYZ_DATA_CFG_FS);
     return 1;
 }
 int mma8451_set_xyz_data_cfg(mma8451* device, mma8451_register_xyz_data_cfg* data) {
-    data->fs1 = (data->fs >> 1) & 0x1;
-    data->fs0 = (data->fs) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    if(!mma8451_set_register(device, MMA8451_REGISTER_XYZ_DATA_CFG, (mma8451_register_generic*)data, 0)) {
+    value = MMA8451_FIELD_SET(value, MMA8451_XYZ_DATA_CFG_FS, data->fs);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
+
+    if(!mma8451_set_register(device, MMA8451_REGISTER_XYZ_DATA_CFG, NULL, value)) {
         return 0;
     }
 
@@ -433,91 +962,64 @@ int mma8451_set_pl_count(mma8451* device, unsigned char count) {
     return 1;
 }
 int mma8451_get_pl_bf_zcomp(mma8451* device, mma8451_register_pl_bf_zcomp* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_PL_BF_ZCOMP, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_PL_BF_ZCOMP, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
 
-    data->bkfr = 0;
-    data->bkfr += (data->bkfr1 << 1);
-    data->bkfr += (data->bkfr0);
-
-    data->zlock = 0;
-    data->zlock += (data->zlock2 << 2);
-    data->zlock += (data->zlock1 << 1);
-    data->zlock += (data->zlock0);
+    data->bkfr = MMA8451_FIELD_GET(value, MMA8451_PL_BF_ZCOMP_BKFR);
+    data->zlock = MMA8451_FIELD_GET(value, MMA8451_PL_BF_ZCOMP_ZLOCK);
     return 1;
 }
 int mma8451_set_pl_bf_zcomp(mma8451* device, mma8451_register_pl_bf_zcomp* data) {
-    data->bkfr1 = (data->bkfr >> 1) & 0x1;
-    data->bkfr0 = (data->bkfr) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    data->zlock2 = (data->zlock >> 2) & 0x1;
-    data->zlock1 = (data->zlock >> 1) & 0x1;
-    data->zlock0 = (data->zlock) & 0x1;
+    value = MMA8451_FIELD_SET(value, MMA8451_PL_BF_ZCOMP_BKFR, data->bkfr);
+    value = MMA8451_FIELD_SET(value, MMA8451_PL_BF_ZCOMP_ZLOCK, data->zlock);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
 
-    if(!mma8451_set_register(device, MMA8451_REGISTER_PL_BF_ZCOMP, (mma8451_register_generic*)data, 0)) {
+    if(!mma8451_set_register(device, MMA8451_REGISTER_PL_BF_ZCOMP, NULL, value)) {
         return 0;
     }
     return 1;
 }
 int mma8451_get_p_l_ths_reg(mma8451* device, mma8451_register_p_l_ths_reg* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_P_L_THS_REG, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_P_L_THS_REG, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
-    data->p_l_ths = 0;
-    data->p_l_ths += (data->p_l_ths4 << 4);
-    data->p_l_ths += (data->p_l_ths3 << 3);
-    data->p_l_ths += (data->p_l_ths2 << 2);
-    data->p_l_ths += (data->p_l_ths1 << 1);
-    data->p_l_ths += (data->p_l_ths0);
-
-    data->hys = 0;
-    data->hys += (data->hys2 << 2);
-    data->hys += (data->hys1 << 1);
-    data->hys += (data->hys0);
+    data->p_l_ths = MMA8451_FIELD_GET(value, MMA8451_P_L_THS_REG_P_L_THS);
+    data->hys = MMA8451_FIELD_GET(value, MMA8451_P_L_THS_REG_HYS);
     return 1;
 }
 int mma8451_set_p_l_ths_reg(mma8451* device, mma8451_register_p_l_ths_reg* data) {
-    data->p_l_ths4 = (data->p_l_ths >> 4) & 0x1;
-    data->p_l_ths3 = (data->p_l_ths >> 3) & 0x1;
-    data->p_l_ths2 = (data->p_l_ths >> 2) & 0x1;
-    data->p_l_ths1 = (data->p_l_ths >> 1) & 0x1;
-    data->p_l_ths0 = (data->p_l_ths) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    data->hys2 = (data->hys >> 2) & 0x1;
-    data->hys1 = (data->hys >> 1) & 0x1;
-    data->hys0 = (data->hys) & 0x1;
+    value = MMA8451_FIELD_SET(value, MMA8451_P_L_THS_REG_P_L_THS, data->p_l_ths);
+    value = MMA8451_FIELD_SET(value, MMA8451_P_L_THS_REG_HYS, data->hys);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
 
-    if(!mma8451_set_register(device, MMA8451_REGISTER_P_L_THS_REG, (mma8451_register_generic*)data, 0)) {
+    if(!mma8451_set_register(device, MMA8451_REGISTER_P_L_THS_REG, NULL, value)) {
         return 0;
     }
     return 1;
 }
 int mma8451_get_ff_mt_ths(mma8451* device, mma8451_register_ff_mt_ths* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_FF_MT_THS, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_FF_MT_THS, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
 
-    data->ths = 0;
-    data->ths += (data->ths6 << 6);
-    data->ths += (data->ths5 << 5);
-    data->ths += (data->ths4 << 4);
-    data->ths += (data->ths3 << 3);
-    data->ths += (data->ths2 << 2);
-    data->ths += (data->ths1 << 1);
-    data->ths += (data->ths0);
+    data->ths = MMA8451_FIELD_GET(value, MMA8451_FF_MT_THS_THS);
     return 1;
 }
 int mma8451_set_ff_mt_ths(mma8451* device, mma8451_register_ff_mt_ths* data) {
-    data->ths6 = (data->ths >> 6) & 0x1;
-    data->ths5 = (data->ths >> 5) & 0x1;
-    data->ths4 = (data->ths >> 4) & 0x1;
-    data->ths3 = (data->ths >> 3) & 0x1;
-    data->ths2 = (data->ths >> 2) & 0x1;
-    data->ths1 = (data->ths >> 1) & 0x1;
-    data->ths0 = (data->ths) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    if(!mma8451_set_register(device, MMA8451_REGISTER_FF_MT_THS, (mma8451_register_generic*)data, 0)) {
+    value = MMA8451_FIELD_SET(value, MMA8451_FF_MT_THS_THS, data->ths);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
+
+    if(!mma8451_set_register(device, MMA8451_REGISTER_FF_MT_THS, NULL, value)) {
         return 0;
     }
     return 1;
@@ -571,29 +1073,20 @@ int mma8451_get_transient_scr(mma8451* device, mma8451_register_transient_scr* d
     return 1;
 }
 int mma8451_get_transient_ths(mma8451* device, mma8451_register_transient_ths* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_TRANSIENT_THS, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_TRANSIENT_THS, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
-    data->ths = 0;
-    data->ths += (data->ths6 << 6);
-    data->ths += (data->ths5 << 5);
-    data->ths += (data->ths4 << 4);
-    data->ths += (data->ths3 << 3);
-    data->ths += (data->ths2 << 2);
-    data->ths += (data->ths1 << 1);
-    data->ths += (data->ths0);
+    data->ths = MMA8451_FIELD_GET(value, MMA8451_TRANSIENT_THS_THS);
     return 1;
 }
 int mma8451_set_transient_ths(mma8451* device, mma8451_register_transient_ths* data) {
-    data->ths6 = (data->ths >> 6) & 0x1;
-    data->ths5 = (data->ths >> 5) & 0x1;
-    data->ths4 = (data->ths >> 4) & 0x1;
-    data->ths3 = (data->ths >> 3) & 0x1;
-    data->ths2 = (data->ths >> 2) & 0x1;
-    data->ths1 = (data->ths >> 1) & 0x1;
-    data->ths0 = (data->ths) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    if(!mma8451_set_register(device, MMA8451_REGISTER_TRANSIENT_THS, (mma8451_register_generic*)data, 0)) {
+    value = MMA8451_FIELD_SET(value, MMA8451_TRANSIENT_THS_THS, data->ths);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
+
+    if(!mma8451_set_register(device, MMA8451_REGISTER_TRANSIENT_THS, NULL, value)) {
         return 0;
     }
     return 1;
@@ -629,85 +1122,22 @@ int mma8451_get_pulse_src(mma8451* device, mma8451_register_pulse_src* data) {
     return 1;
 }
 int mma8451_get_pulse_thsx(mma8451* device, mma8451_register_pulse_ths* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_PULSE_THSX, (mma8451_register_generic*)data, NULL)) {
-        return 0;
-    }
-    data->ths = 0;
-    data->ths += (data->ths6 << 6);
-    data->ths += (data->ths5 << 5);
-    data->ths += (data->ths4 << 4);
-    data->ths += (data->ths3 << 3);
-    data->ths += (data->ths2 << 2);
-    data->ths += (data->ths1 << 1);
-    data->ths += (data->ths0);
-    return 1;
+    return mma8451_get_pulse_ths(device, MMA8451_REGISTER_PULSE_THSX, data);
 }
 int mma8451_set_pulse_thsx(mma8451* device, mma8451_register_pulse_ths* data) {
-    data->ths6 = (data->ths >> 6) & 0x1;
-    data->ths5 = (data->ths >> 5) & 0x1;
-    data->ths4 = (data->ths >> 4) & 0x1;
-    data->ths3 = (data->ths >> 3) & 0x1;
-    data->ths2 = (data->ths >> 2) & 0x1;
-    data->ths1 = (data->ths >> 1) & 0x1;
-    data->ths0 = (data->ths) & 0x1;
-    if(!mma8451_set_register(device, MMA8451_REGISTER_PULSE_THSX, (mma8451_register_generic*)data, 0)) {
-        return 0;
-    }
-    return 1;
+    return mma8451_set_pulse_ths(device, MMA8451_REGISTER_PULSE_THSX, data);
 }
 int mma8451_get_pulse_thsy(mma8451* device, mma8451_register_pulse_ths* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_PULSE_THSY, (mma8451_register_generic*)data, NULL)) {
-        return 0;
-    }
-    data->ths = 0;
-    data->ths += (data->ths6 << 6);
-    data->ths += (data->ths5 << 5);
-    data->ths += (data->ths4 << 4);
-    data->ths += (data->ths3 << 3);
-    data->ths += (data->ths2 << 2);
-    data->ths += (data->ths1 << 1);
-    data->ths += (data->ths0);
-    return 1;
+    return mma8451_get_pulse_ths(device, MMA8451_REGISTER_PULSE_THSY, data);
 }
 int mma8451_set_pulse_thsy(mma8451* device, mma8451_register_pulse_ths* data) {
-    data->ths6 = (data->ths >> 6) & 0x1;
-    data->ths5 = (data->ths >> 5) & 0x1;
-    data->ths4 = (data->ths >> 4) & 0x1;
-    data->ths3 = (data->ths >> 3) & 0x1;
-    data->ths2 = (data->ths >> 2) & 0x1;
-    data->ths1 = (data->ths >> 1) & 0x1;
-    data->ths0 = (data->ths) & 0x1;
-    if(!mma8451_set_register(device, MMA8451_REGISTER_PULSE_THSY, (mma8451_register_generic*)data, 0)) {
-        return 0;
-    }
-    return 1;
+    return mma8451_set_pulse_ths(device, MMA8451_REGISTER_PULSE_THSY, data);
 }
 int mma8451_get_pulse_thsz(mma8451* device, mma8451_register_pulse_ths* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_PULSE_THSZ, (mma8451_register_generic*)data, NULL)) {
-        return 0;
-    }
-    data->ths = 0;
-    data->ths += (data->ths6 << 6);
-    data->ths += (data->ths5 << 5);
-    data->ths += (data->ths4 << 4);
-    data->ths += (data->ths3 << 3);
-    data->ths += (data->ths2 << 2);
-    data->ths += (data->ths1 << 1);
-    data->ths += (data->ths0);
-    return 1;
+    return mma8451_get_pulse_ths(device, MMA8451_REGISTER_PULSE_THSZ, data);
 }
 int mma8451_set_pulse_thsz(mma8451* device, mma8451_register_pulse_ths* data) {
-    data->ths6 = (data->ths >> 6) & 0x1;
-    data->ths5 = (data->ths >> 5) & 0x1;
-    data->ths4 = (data->ths >> 4) & 0x1;
-    data->ths3 = (data->ths >> 3) & 0x1;
-    data->ths2 = (data->ths >> 2) & 0x1;
-    data->ths1 = (data->ths >> 1) & 0x1;
-    data->ths0 = (data->ths) & 0x1;
-    if(!mma8451_set_register(device, MMA8451_REGISTER_PULSE_THSZ, (mma8451_register_generic*)data, 0)) {
-        return 0;
-    }
-    return 1;
+    return mma8451_set_pulse_ths(device, MMA8451_REGISTER_PULSE_THSZ, data);
 }
 int mma8451_get_pulse_tmlt(mma8451* device, unsigned char* tmlt) {
     if(!mma8451_get_register(device, MMA8451_REGISTER_PULSE_TMLT, NULL, tmlt)) {
@@ -758,27 +1188,22 @@ int mma8451_set_aslp_count(mma8451* device, unsigned char count) {
     return 1;
 }
 int mma8451_get_ctrl_reg1(mma8451* device, mma8451_register_ctrl_reg1* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG1, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG1, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
-    data->aslp_rate = 0;
-    data->aslp_rate += (data->aslp_rate1 << 1);
-    data->aslp_rate += (data->aslp_rate0);
-
-    data->dr = 0;
-    data->dr += (data->dr2 << 2);
-    data->dr += (data->dr1 << 1);
-    data->dr += (data->dr0);
+    data->aslp_rate = MMA8451_FIELD_GET(value, MMA8451_CTRL_REG1_ASLP_RATE);
+    data->dr = MMA8451_FIELD_GET(value, MMA8451_CTRL_REG1_DR);
     return 1;
 }
 int mma8451_set_ctrl_reg1(mma8451* device, mma8451_register_ctrl_reg1* data) {
-    data->aslp_rate1 = (data->aslp_rate >> 1) & 0x1;
-    data->aslp_rate0 = (data->aslp_rate) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
 
-    data->dr2 = (data->dr >> 2) & 0x1;
-    data->dr1 = (data->dr >> 1) & 0x1;
-    data->dr0 = (data->dr) & 0x1;
-    if(!mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, (mma8451_register_generic*)data, 0)) {
+    value = MMA8451_FIELD_SET(value, MMA8451_CTRL_REG1_ASLP_RATE, data->aslp_rate);
+    value = MMA8451_FIELD_SET(value, MMA8451_CTRL_REG1_DR, data->dr);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
+
+    if(!mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, value)) {
         return 0;
     }
 
@@ -787,26 +1212,23 @@ int mma8451_set_ctrl_reg1(mma8451* device, mma8451_register_ctrl_reg1* data) {
     return 1;
 }
 int mma8451_get_ctrl_reg2(mma8451* device, mma8451_register_ctrl_reg2* data) {
-    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG2, (mma8451_register_generic*)data, NULL)) {
+    unsigned char value;
+    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG2, (mma8451_register_generic*)data, &value)) {
         return 0;
     }
 
-    data->smods = 0;
-    data->smods += (data->smods1 << 1);
-    data->smods += (data->smods0);
-
-    data->mods = 0;
-    data->mods += (data->mods1 << 1);
-    data->mods += (data->mods0);
+    data->smods = MMA8451_FIELD_GET(value, MMA8451_CTRL_REG2_SMODS);
+    data->mods = MMA8451_FIELD_GET(value, MMA8451_CTRL_REG2_MODS);
     return 1;
 }
 int mma8451_set_ctrl_reg2(mma8451* device, mma8451_register_ctrl_reg2* data) {
-    data->smods1 = (data->smods >> 1) & 0x1;
-    data->smods0 = (data->smods) & 0x1;
+    unsigned char value = mma8451_pack_register((mma8451_register_generic*)data);
+
+    value = MMA8451_FIELD_SET(value, MMA8451_CTRL_REG2_SMODS, data->smods);
+    value = MMA8451_FIELD_SET(value, MMA8451_CTRL_REG2_MODS, data->mods);
+    mma8451_unpack_register(value, (mma8451_register_generic*)data);
 
-    data->mods1 = (data->mods >> 1) & 0x1;
-    data->mods0 = (data->mods) & 0x1;
-    if(!mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG2, (mma8451_register_generic*)data, 0)) {
+    if(!mma8451_set_register(device, MMA8451_REGISTER_CTRL_REG2, NULL, value)) {
         return 0;
     }
     return 1;
@@ -886,20 +1308,13 @@ int mma8451_set_off_z(mma8451* device, unsigned char offset) {
 
 int mma8451_get_register(mma8451* device, mma8451_register reg, mma8451_register_generic* data, unsigned char* byteData) {
     unsigned char value;
-    if(!mma8451_get_i2c_register(device->file, device->addr, reg, &value)) {
-        snprintf((char*)&device->last_error, MMA8451_ERROR_SIZE, "Unable to get register %hhu: %s : %u", reg, strerror(errno), errno);
+    if(!mma8451_device_get_block(device, MMA8451_STATS_OP_READ, reg, &value, 1)) {
+        MMA8451_SET_ERROR(device, "Unable to get register %hhu: %s : %u", reg, strerror(errno), errno);
         return 0;
     }
 
     if(data != NULL) {
-        data->bit7 = (value & 0x80) > 0;
-        data->bit6 = (value & 0x40) > 0;
-        data->bit5 = (value & 0x20) > 0;
-        data->bit4 = (value & 0x10) > 0;
-        data->bit3 = (value & 0x08) > 0;
-        data->bit2 = (value & 0x04) > 0;
-        data->bit1 = (value & 0x02) > 0;
-        data->bit0 = (value & 0x01) > 0;
+        mma8451_unpack_register(value, data);
     }
 
     if(byteData != NULL) {
@@ -913,28 +1328,756 @@ int mma8451_set_register(mma8451* device, mma8451_register reg, mma8451_register
     unsigned char value = 0;
 
     if(data != NULL) {
-        value += (data->bit7 & 0x1) << 7;
-        value += (data->bit6 & 0x1) << 6;
-        value += (data->bit5 & 0x1) << 5;
-        value += (data->bit4 & 0x1) << 4;
-        value += (data->bit3 & 0x1) << 3;
-        value += (data->bit2 & 0x1) << 2;
-        value += (data->bit1 & 0x1) << 1;
-        value += (data->bit0 & 0x1);
+        value = mma8451_pack_register(data);
     } else {
         value = byteData;
     }
 
-    if(!mma8451_set_i2c_register(device->file, device->addr, reg, value)) {
-        snprintf((char*)&device->last_error, MMA8451_ERROR_SIZE, "Unable to set register %hhu: %s : %u", reg, strerror(errno), errno);
+    if(!mma8451_device_set(device, reg, value)) {
+        MMA8451_SET_ERROR(device, "Unable to set register %hhu: %s : %u", reg, strerror(errno), errno);
         return 0;
     }
     return 1;
 }
 
-int mma8451_set_i2c_register(int file, unsigned char addr, unsigned char reg, unsigned char value) {
-    unsigned char outbuf[2];
+int mma8451_get_register_block(mma8451* device, mma8451_register reg, unsigned char* buf, unsigned int cnt) {
+    if(!mma8451_device_get_block(device, MMA8451_STATS_OP_BLOCK_READ, reg, buf, cnt)) {
+        MMA8451_SET_ERROR(device, "Unable to get register block %hhu: %s : %u", reg, strerror(errno), errno);
+        return 0;
+    }
+    return 1;
+}
+
+int mma8451_transfer(mma8451* device, struct i2c_msg* messages, unsigned int nmsgs) {
+    mma8451_stats_op op = MMA8451_STATS_OP_WRITE;
+    unsigned int i;
+
+    for(i = 0; i < nmsgs; i++) {
+        if(messages[i].flags & I2C_M_RD) {
+            op = MMA8451_STATS_OP_BLOCK_READ;
+        }
+    }
+
+    if(!mma8451_device_rdwr(device, op, messages, nmsgs)) {
+        MMA8451_SET_ERROR(device, "Unable to transfer %u messages: %s : %u", nmsgs, strerror(errno), errno);
+        return 0;
+    }
+    return 1;
+}
+
+static uint64_t mma8451_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Sample periods in nanoseconds for each mma8451_data_rate.
+ */
+static const uint64_t mma8451_periods[] = {
+    1250000, 2500000, 5000000, 10000000, 20000000, 80000000, 160000000, 640000000
+};
+
+uint64_t mma8451_data_rate_period_ns(mma8451_data_rate rate) {
+    return mma8451_periods[rate & 0x7];
+}
+
+int mma8451_pacer_init(mma8451* device, mma8451_pacer* pacer) {
+    unsigned char ctrl;
+
+    if(!mma8451_get_register(device, MMA8451_REGISTER_CTRL_REG1, NULL, &ctrl)) {
+        return 0;
+    }
+
+    pacer->period_ns = mma8451_data_rate_period_ns(MMA8451_FIELD_GET(ctrl, MMA8451_CTRL_REG1_DR));
+    pacer->interval_ns = pacer->period_ns;
+    pacer->next_ns = mma8451_now_ns();
+    pacer->timestamp_ns = 0;
+    pacer->early = 0;
+    pacer->retried = 0;
+    return 1;
+}
+
+int mma8451_pacer_read(mma8451* device, mma8451_pacer* pacer, mma8451_sample* sample) {
+    uint64_t step = pacer->period_ns / 16;
+    uint64_t now;
+
+    if(!mma8451_read_sample(device, sample)) {
+        if(errno == EAGAIN) {
+            //Too early, the sample isn't ready yet.
+            pacer->early++;
+            pacer->next_ns += step;
+            pacer->retried = 1;
+        }
+        return 0;
+    }
+
+    now = mma8451_now_ns();
+    pacer->timestamp_ns = now;
+
+    //A read that succeeds first time can't tell how long the sample was waiting, so creep
+    //earlier until one comes up empty. That keeps the phase just after data-ready. The
+    //interval follows the same feedback, balancing at about one empty read in five.
+    if(pacer->retried) {
+        pacer->next_ns += pacer->interval_ns;
+        pacer->interval_ns += pacer->interval_ns / 512;
+        pacer->retried = 0;
+    } else {
+        pacer->next_ns += pacer->interval_ns - step / 4;
+        pacer->interval_ns -= pacer->interval_ns / 2048;
+    }
+    if(pacer->interval_ns < pacer->period_ns / 2) {
+        pacer->interval_ns = pacer->period_ns / 2;
+    } else if(pacer->interval_ns > pacer->period_ns * 2) {
+        pacer->interval_ns = pacer->period_ns * 2;
+    }
+    if(pacer->next_ns <= now) {
+        //Fell more than a period behind, the next sample is due within a period of now.
+        pacer->next_ns = now + step;
+    }
+    return 1;
+}
+
+int mma8451_pacer_wait(mma8451* device, mma8451_pacer* pacer, mma8451_sample* sample) {
+    struct timespec deadline;
+
+    for(;;) {
+        deadline.tv_sec = pacer->next_ns / 1000000000ULL;
+        deadline.tv_nsec = pacer->next_ns % 1000000000ULL;
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+
+        if(mma8451_pacer_read(device, pacer, sample)) {
+            return 1;
+        }
+        if(errno != EAGAIN) {
+            return 0;
+        }
+    }
+}
+
+#ifndef MMA8451_DISABLE_TRACE
+/**
+ * A single traced I2C_RDWR transfer.
+ */
+typedef struct mma8451_trace_event {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int32_t result;
+    int32_t file;
+    int32_t tid;
+    uint16_t len;
+    unsigned char addr;
+    unsigned char reg;
+    unsigned char op;
+} mma8451_trace_event;
+
+/**
+ * A per-thread ring of trace events. Only the owning thread writes to it, a ring is handed
+ * to a new thread once its owner exits and keeps the old thread's events until overwritten.
+ */
+typedef struct mma8451_trace_ring {
+    uint64_t head;
+    int owned;
+    mma8451_trace_event* events;
+} __attribute__((aligned(64))) mma8451_trace_ring;
+
+static mma8451_trace_ring mma8451_trace_rings[MMA8451_TRACE_MAX_THREADS];
+static mma8451_trace_event* mma8451_trace_storage;
+static unsigned int mma8451_trace_capacity;
+static unsigned int mma8451_trace_claimed;
+static int mma8451_trace_enabled;
+static __thread int mma8451_trace_slot = -1;
+static __thread int32_t mma8451_trace_tid;
+static pthread_once_t mma8451_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mma8451_trace_key;
+static char mma8451_trace_signal_path[256];
+
+int mma8451_trace_start(unsigned int events_per_thread) {
+    unsigned int capacity = 1;
+    int i;
+
+    if(mma8451_trace_storage == NULL) {
+        if(events_per_thread == 0) {
+            errno = EINVAL;
+            return 0;
+        }
+        while(capacity < events_per_thread) {
+            capacity <<= 1;
+        }
+        mma8451_trace_storage = (mma8451_trace_event*)calloc((size_t)capacity * MMA8451_TRACE_MAX_THREADS, sizeof(mma8451_trace_event));
+        if(mma8451_trace_storage == NULL) {
+            return 0;
+        }
+        mma8451_trace_capacity = capacity;
+        for(i = 0; i < MMA8451_TRACE_MAX_THREADS; i++) {
+            mma8451_trace_rings[i].events = mma8451_trace_storage + (size_t)i * capacity;
+        }
+    }
+
+    for(i = 0; i < MMA8451_TRACE_MAX_THREADS; i++) {
+        __atomic_store_n(&mma8451_trace_rings[i].head, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&mma8451_trace_enabled, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int mma8451_trace_stop(void) {
+    __atomic_store_n(&mma8451_trace_enabled, 0, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void mma8451_trace_free(void) {
+    int i;
+
+    mma8451_trace_stop();
+    for(i = 0; i < MMA8451_TRACE_MAX_THREADS; i++) {
+        mma8451_trace_rings[i].events = NULL;
+    }
+    free(mma8451_trace_storage);
+    mma8451_trace_storage = NULL;
+    mma8451_trace_capacity = 0;
+}
+
+/**
+ * Gives a thread's ring back when the thread exits.
+ */
+static void mma8451_trace_release(void* value) {
+    unsigned int slot = (unsigned int)((uintptr_t)value - 1);
+
+    __atomic_store_n(&mma8451_trace_rings[slot].owned, 0, __ATOMIC_RELEASE);
+}
+
+static void mma8451_trace_key_create(void) {
+    pthread_key_create(&mma8451_trace_key, mma8451_trace_release);
+}
+
+/**
+ * Claims a free ring for the calling thread.
+ * @return The ring's slot, -1 if every ring is owned.
+ */
+static int mma8451_trace_claim(void) {
+    unsigned int i, claimed;
+
+    pthread_once(&mma8451_trace_once, mma8451_trace_key_create);
+    for(i = 0; i < MMA8451_TRACE_MAX_THREADS; i++) {
+        int expected = 0;
+
+        if(!__atomic_compare_exchange_n(&mma8451_trace_rings[i].owned, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if(pthread_setspecific(mma8451_trace_key, (void*)(uintptr_t)(i + 1)) != 0) {
+            __atomic_store_n(&mma8451_trace_rings[i].owned, 0, __ATOMIC_RELEASE);
+            return -1;
+        }
+        //mma8451_trace_claimed is the number of rings that have ever been used.
+        claimed = __atomic_load_n(&mma8451_trace_claimed, __ATOMIC_RELAXED);
+        while(claimed < i + 1 && !__atomic_compare_exchange_n(&mma8451_trace_claimed, &claimed, i + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        return (int)i;
+    }
+    return -1;
+}
+
+/**
+ * Records a transfer in the calling thread's ring. Does not allocate or format.
+ */
+static void mma8451_trace_record(int file, struct i2c_msg* messages, int nmsgs, mma8451_stats_op op, uint64_t start_ns, uint64_t end_ns, int result) {
+    mma8451_trace_ring* ring;
+    mma8451_trace_event* event;
+    uint64_t head;
+
+    if(mma8451_trace_slot < 0) {
+        if(mma8451_trace_slot == -2) {
+            //All rings were owned when this thread first traced, it isn't traced.
+            return;
+        }
+        mma8451_trace_slot = mma8451_trace_claim();
+        if(mma8451_trace_slot < 0) {
+            mma8451_trace_slot = -2;
+            return;
+        }
+        mma8451_trace_tid = (int32_t)syscall(SYS_gettid);
+    }
+
+    ring = &mma8451_trace_rings[mma8451_trace_slot];
+    if(ring->events == NULL) {
+        return;
+    }
+    head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    event = &ring->events[head & (mma8451_trace_capacity - 1)];
+    event->start_ns = start_ns;
+    event->end_ns = end_ns;
+    event->result = result;
+    event->file = file;
+    event->tid = mma8451_trace_tid;
+    event->addr = messages[0].addr;
+    event->reg = (messages[0].len > 0 && !(messages[0].flags & I2C_M_RD)) ? messages[0].buf[0] : 0;
+    event->op = op;
+    event->len = messages[nmsgs - 1].len;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * A small output buffer for the trace writer, only uses async-signal-safe calls.
+ */
+typedef struct mma8451_trace_writer {
+    int fd;
+    unsigned int len;
+    int failed;
+    char buf[4096];
+} mma8451_trace_writer;
+
+static void mma8451_trace_flush(mma8451_trace_writer* out) {
+    unsigned int off = 0;
+    while(off < out->len && !out->failed) {
+        ssize_t written = write(out->fd, out->buf + off, out->len - off);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            out->failed = 1;
+            break;
+        }
+        off += written;
+    }
+    out->len = 0;
+}
+
+static void mma8451_trace_puts(mma8451_trace_writer* out, const char* str) {
+    while(*str) {
+        if(out->len == sizeof(out->buf)) {
+            mma8451_trace_flush(out);
+        }
+        out->buf[out->len++] = *str++;
+    }
+}
+
+static void mma8451_trace_putu(mma8451_trace_writer* out, uint64_t value, int min_digits) {
+    char tmp[24];
+    int i = sizeof(tmp) - 1;
+
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = '0' + (value % 10);
+        value /= 10;
+        min_digits--;
+    } while(value > 0 || min_digits > 0);
+    mma8451_trace_puts(out, &tmp[i]);
+}
+
+/**
+ * Writes a nanosecond value as microseconds with three decimals, as expected by the trace viewer.
+ */
+static void mma8451_trace_putus(mma8451_trace_writer* out, uint64_t ns) {
+    mma8451_trace_putu(out, ns / 1000, 1);
+    mma8451_trace_puts(out, ".");
+    mma8451_trace_putu(out, ns % 1000, 3);
+}
+
+int mma8451_trace_dump(int fd) {
+    static const char* names[MMA8451_STATS_OP_COUNT] = { "read", "write", "block_read" };
+    mma8451_trace_writer out;
+    unsigned int i, claimed;
+    int first = 1;
+
+    out.fd = fd;
+    out.len = 0;
+    out.failed = 0;
+
+    claimed = __atomic_load_n(&mma8451_trace_claimed, __ATOMIC_RELAXED);
+    if(claimed > MMA8451_TRACE_MAX_THREADS) {
+        claimed = MMA8451_TRACE_MAX_THREADS;
+    }
+
+    mma8451_trace_puts(&out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for(i = 0; i < claimed && mma8451_trace_capacity > 0; i++) {
+        mma8451_trace_ring* ring = &mma8451_trace_rings[i];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t pos = (head > mma8451_trace_capacity) ? head - mma8451_trace_capacity : 0;
+
+        for(; pos < head; pos++) {
+            mma8451_trace_event* event = &ring->events[pos & (mma8451_trace_capacity - 1)];
+
+            mma8451_trace_puts(&out, first ? "\n" : ",\n");
+            first = 0;
+            mma8451_trace_puts(&out, "{\"name\":\"");
+            mma8451_trace_puts(&out, names[event->op % MMA8451_STATS_OP_COUNT]);
+            mma8451_trace_puts(&out, "\",\"cat\":\"i2c\",\"ph\":\"X\",\"ts\":");
+            mma8451_trace_putus(&out, event->start_ns);
+            mma8451_trace_puts(&out, ",\"dur\":");
+            mma8451_trace_putus(&out, event->end_ns - event->start_ns);
+            mma8451_trace_puts(&out, ",\"pid\":");
+            mma8451_trace_putu(&out, (uint32_t)event->file, 1);
+            mma8451_trace_puts(&out, ",\"tid\":");
+            mma8451_trace_putu(&out, event->addr, 1);
+            mma8451_trace_puts(&out, ",\"args\":{\"reg\":");
+            mma8451_trace_putu(&out, event->reg, 1);
+            mma8451_trace_puts(&out, ",\"len\":");
+            mma8451_trace_putu(&out, event->len, 1);
+            mma8451_trace_puts(&out, ",\"errno\":");
+            mma8451_trace_putu(&out, (uint32_t)event->result, 1);
+            mma8451_trace_puts(&out, ",\"thread\":");
+            mma8451_trace_putu(&out, (uint32_t)event->tid, 1);
+            mma8451_trace_puts(&out, "}}");
+        }
+    }
+    mma8451_trace_puts(&out, "\n]}\n");
+    mma8451_trace_flush(&out);
+
+    return !out.failed;
+}
+
+static void mma8451_trace_signal_handler(int signum) {
+    int saved_errno = errno;
+    int fd = open(mma8451_trace_signal_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    (void)signum;
+    if(fd >= 0) {
+        mma8451_trace_dump(fd);
+        close(fd);
+    }
+    errno = saved_errno;
+}
+
+int mma8451_trace_dump_on_signal(int signum, const char* path) {
+    struct sigaction action;
+
+    if(path == NULL || strlen(path) >= sizeof(mma8451_trace_signal_path)) {
+        errno = EINVAL;
+        return 0;
+    }
+    strcpy(mma8451_trace_signal_path, path);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = mma8451_trace_signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if(sigaction(signum, &action, NULL) < 0) {
+        return 0;
+    }
+    return 1;
+}
+#else
+int mma8451_trace_start(unsigned int events_per_thread) {
+    (void)events_per_thread;
+    errno = ENOTSUP;
+    return 0;
+}
+
+int mma8451_trace_stop(void) {
+    return 1;
+}
+
+void mma8451_trace_free(void) {
+}
+
+int mma8451_trace_dump(int fd) {
+    (void)fd;
+    errno = ENOTSUP;
+    return 0;
+}
+
+int mma8451_trace_dump_on_signal(int signum, const char* path) {
+    (void)signum;
+    (void)path;
+    errno = ENOTSUP;
+    return 0;
+}
+#endif
+
+/**
+ * Issues an I2C_RDWR or I2C_SMBUS ioctl, retrying interrupted transfers and updating the counters.
+ * @param stats Counters to update.
+ * @param op The type of transfer for the latency histogram.
+ * @param file File pointer to I2C bus.
+ * @param request I2C_RDWR or I2C_SMBUS.
+ * @param arg The ioctl argument.
+ * @param messages Messages describing the transfer for the counters and trace.
+ * @param nmsgs Number of messages.
+ * @return 1 for success, 0 for failure.
+ */
+static int mma8451_i2c_ioctl(mma8451_stats* stats, mma8451_stats_op op, int file, unsigned long request, void* arg, struct i2c_msg* messages, int nmsgs) {
+    int attempt, result, err, i;
+    uint64_t start_ns = 0, end_ns = 0;
+    int timed = 0;
+#if !defined(MMA8451_DISABLE_STATS) && MMA8451_STATS_LATENCY_BUCKETS > 0
+    uint64_t usec;
+    int bucket;
+
+    timed = 1;
+#endif
+#ifndef MMA8451_DISABLE_TRACE
+    int traced = __atomic_load_n(&mma8451_trace_enabled, __ATOMIC_RELAXED);
+
+    timed |= traced;
+#endif
+
+    if(timed) {
+        start_ns = mma8451_now_ns();
+    }
+
+    for(attempt = 0; ; attempt++) {
+        MMA8451_STATS_ADD(stats->ioctls, 1);
+        result = ioctl(file, request, arg);
+        if(result >= 0 || attempt >= MMA8451_I2C_RETRIES || (errno != EINTR && errno != EAGAIN)) {
+            break;
+        }
+        MMA8451_STATS_ADD(stats->retries, 1);
+    }
+    err = errno;
+
+    if(timed) {
+        end_ns = mma8451_now_ns();
+    }
+
+#if !defined(MMA8451_DISABLE_STATS) && MMA8451_STATS_LATENCY_BUCKETS > 0
+    usec = (end_ns - start_ns) / 1000;
+    bucket = (usec == 0) ? 0 : 64 - __builtin_clzll(usec);
+    if(bucket >= MMA8451_STATS_LATENCY_BUCKETS) {
+        bucket = MMA8451_STATS_LATENCY_BUCKETS - 1;
+    }
+    MMA8451_STATS_ADD(stats->latency[op][bucket], 1);
+#endif
+#ifndef MMA8451_DISABLE_TRACE
+    if(traced) {
+        mma8451_trace_record(file, messages, nmsgs, op, start_ns, end_ns, (result < 0) ? err : 0);
+    }
+#endif
+
+    if(result < 0) {
+        MMA8451_STATS_ADD(stats->errors, 1);
+#if MMA8451_STATS_ERRNO_BUCKETS > 0
+        MMA8451_STATS_ADD(stats->errors_by_errno[(err < MMA8451_STATS_ERRNO_BUCKETS) ? err : MMA8451_STATS_ERRNO_BUCKETS - 1], 1);
+#endif
+        errno = err;
+        return 0;
+    }
+
+    for(i = 0; i < nmsgs; i++) {
+        if(messages[i].flags & I2C_M_RD) {
+            MMA8451_STATS_ADD(stats->bytes_read, messages[i].len);
+        } else {
+            MMA8451_STATS_ADD(stats->bytes_written, messages[i].len);
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * Issues an I2C_RDWR ioctl, retrying interrupted transfers and updating the counters.
+ * @param stats Counters to update.
+ * @param op The type of transfer for the latency histogram.
+ * @param file File pointer to I2C bus.
+ * @param messages Messages to transfer.
+ * @param nmsgs Number of messages.
+ * @return 1 for success, 0 for failure.
+ */
+static int mma8451_i2c_rdwr(mma8451_stats* stats, mma8451_stats_op op, int file, struct i2c_msg* messages, int nmsgs) {
     struct i2c_rdwr_ioctl_data packets;
+
+    packets.msgs  = messages;
+    packets.nmsgs = nmsgs;
+    return mma8451_i2c_ioctl(stats, op, file, I2C_RDWR, &packets, messages, nmsgs);
+}
+
+/**
+ * Number of adapter files whose SMBus address is remembered, files past this set it every time.
+ */
+#define MMA8451_SMBUS_FILES 256
+
+/**
+ * The address plus one each adapter file's SMBus transfers go to, or 0 if unknown. I2C_SLAVE
+ * is per file, so this is shared by every handle on the file rather than kept per handle.
+ */
+static unsigned char mma8451_smbus_bound[MMA8451_SMBUS_FILES];
+
+static void mma8451_smbus_forget(int fd) {
+    if(fd >= 0 && fd < MMA8451_SMBUS_FILES) {
+        __atomic_store_n(&mma8451_smbus_bound[fd], 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Points the adapter's SMBus transfers at an address. I2C_SLAVE is only issued when another
+ * handle on the same file, or mma8451_read_bus(), last pointed it somewhere else.
+ */
+static int mma8451_smbus_address(mma8451* device, unsigned char addr) {
+    int cached = (device->file >= 0 && device->file < MMA8451_SMBUS_FILES);
+
+    if(cached && __atomic_load_n(&mma8451_smbus_bound[device->file], __ATOMIC_RELAXED) == addr + 1) {
+        return 1;
+    }
+    if(ioctl(device->file, I2C_SLAVE, addr) < 0) {
+        int err = errno;
+        if(cached) {
+            mma8451_smbus_forget(device->file);
+        }
+        if(err == EBUSY) {
+            MMA8451_SET_ERROR(device, "Address 0x%02x is bound to a kernel driver, unbind it or use mma8451-iio.h", addr);
+        } else {
+            MMA8451_SET_ERROR(device, "Unable to set SMBus address 0x%02x: %s : %u", addr, strerror(err), err);
+        }
+        errno = err;
+        return 0;
+    }
+    if(cached) {
+        __atomic_store_n(&mma8451_smbus_bound[device->file], addr + 1, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+/**
+ * Reads up to MMA8451_SMBUS_BLOCK_MAX registers with a SMBus I2C-block read. The adapter
+ * must already be pointed at addr.
+ */
+static int mma8451_smbus_read(mma8451_stats* stats, mma8451_stats_op op, int file, unsigned char addr, unsigned char reg, unsigned char* buf, unsigned int len) {
+    union i2c_smbus_data data;
+    struct i2c_smbus_ioctl_data args;
+    struct i2c_msg messages[2];
+
+    messages[0].addr  = addr;
+    messages[0].flags = 0;
+    messages[0].len   = 1;
+    messages[0].buf   = &reg;
+    messages[1].addr  = addr;
+    messages[1].flags = I2C_M_RD;
+    messages[1].len   = len;
+    messages[1].buf   = buf;
+
+    data.block[0] = len;
+    args.read_write = I2C_SMBUS_READ;
+    args.command = reg;
+    args.size = I2C_SMBUS_I2C_BLOCK_DATA;
+    args.data = &data;
+    if(!mma8451_i2c_ioctl(stats, op, file, I2C_SMBUS, &args, messages, 2)) {
+        return 0;
+    }
+    memcpy(buf, &data.block[1], len);
+    return 1;
+}
+
+/**
+ * Writes consecutive registers with one SMBus byte data write each. The adapter must already
+ * be pointed at addr.
+ */
+static int mma8451_smbus_write(mma8451_stats* stats, int file, unsigned char addr, const unsigned char* buf, unsigned int len) {
+    union i2c_smbus_data data;
+    struct i2c_smbus_ioctl_data args;
+    struct i2c_msg message;
+    unsigned char out[2];
+    unsigned int i;
+
+    message.addr  = addr;
+    message.flags = 0;
+    message.len   = 2;
+    message.buf   = out;
+
+    for(i = 1; i < len; i++) {
+        out[0] = buf[0] + i - 1;
+        out[1] = buf[i];
+        data.byte = buf[i];
+        args.read_write = I2C_SMBUS_WRITE;
+        args.command = out[0];
+        args.size = I2C_SMBUS_BYTE_DATA;
+        args.data = &data;
+        if(!mma8451_i2c_ioctl(stats, MMA8451_STATS_OP_WRITE, file, I2C_SMBUS, &args, &message, 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Reads a block in pieces of at most the device's max_read bytes, with I2C_RDWR or SMBus.
+ * Reads that start at STATUS or OUT_X_MSB and run past OUT_Z_LSB are FIFO bursts, each
+ * piece after the first restarts at OUT_X_MSB on a sample boundary to keep draining.
+ */
+static int mma8451_read_chunked(mma8451* device, mma8451_stats_op op, unsigned char addr, unsigned char reg, unsigned char* buf, unsigned int len) {
+    int burst = (reg <= MMA8451_REGISTER_OUT_X_MSB && reg + len > MMA8451_REGISTER_OUT_Z_LSB + 1);
+    unsigned int max = device->max_read;
+    unsigned int done = 0;
+
+    while(done < len) {
+        unsigned int header = (done == 0 && reg == MMA8451_REGISTER_STATUS) ? 1 : 0;
+        unsigned char start = burst && done > 0 ? MMA8451_REGISTER_OUT_X_MSB : reg + done;
+        unsigned int n = len - done;
+
+        if(max != 0 && n > max) {
+            n = burst ? header + (max - header) / 6 * 6 : max;
+        }
+
+        if(device->transfer == MMA8451_TRANSFER_SMBUS) {
+            if(!mma8451_smbus_read(&device->stats, op, device->file, addr, start, buf + done, n)) {
+                return 0;
+            }
+        } else if(!mma8451_i2c_get_block(&device->stats, device->file, addr, start, buf + done, n)) {
+            return 0;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+/**
+ * Runs a set of messages on a device's adapter in its transfer mode. Writes must carry their
+ * register address, reads must follow a one byte register address write.
+ */
+static int mma8451_device_rdwr(mma8451* device, mma8451_stats_op op, struct i2c_msg* messages, unsigned int nmsgs) {
+    unsigned int i;
+
+    if(device->transfer == MMA8451_TRANSFER_I2C) {
+        unsigned int longest = 0;
+
+        if(mma8451_i2c_rdwr(&device->stats, op, device->file, messages, nmsgs)) {
+            return 1;
+        }
+        for(i = 0; i < nmsgs; i++) {
+            if((messages[i].flags & I2C_M_RD) && messages[i].len > longest) {
+                longest = messages[i].len;
+            }
+        }
+        if(errno != EOPNOTSUPP || longest <= 8) {
+            return 0;
+        }
+        //The adapter limits message length, fall back to chunked reads.
+        device->transfer = MMA8451_TRANSFER_I2C_CHUNKED;
+        device->max_read = (longest / 2 > 8) ? longest / 2 : 8;
+    }
+
+    for(;;) {
+        int result = 1;
+
+        for(i = 0; i < nmsgs && result; i++) {
+            //The file may be shared with other handles, and mma8451_read_bus() passes messages
+            //for other devices on the adapter.
+            if(device->transfer == MMA8451_TRANSFER_SMBUS && !mma8451_smbus_address(device, messages[i].addr)) {
+                return 0;
+            }
+            if(messages[i].flags & I2C_M_RD) {
+                errno = EOPNOTSUPP;
+                result = 0;
+            } else if(i + 1 < nmsgs && messages[i].len == 1 && (messages[i + 1].flags & I2C_M_RD)) {
+                result = mma8451_read_chunked(device, op, messages[i].addr, messages[i].buf[0], messages[i + 1].buf, messages[i + 1].len);
+                i++;
+            } else if(device->transfer == MMA8451_TRANSFER_SMBUS) {
+                result = mma8451_smbus_write(&device->stats, device->file, messages[i].addr, messages[i].buf, messages[i].len);
+            } else {
+                result = mma8451_i2c_rdwr(&device->stats, MMA8451_STATS_OP_WRITE, device->file, &messages[i], 1);
+            }
+        }
+
+        //Keep halving the piece size while the adapter still rejects it.
+        if(result || errno != EOPNOTSUPP || device->transfer != MMA8451_TRANSFER_I2C_CHUNKED || device->max_read <= 8) {
+            return result;
+        }
+        device->max_read = (device->max_read / 2 > 8) ? device->max_read / 2 : 8;
+    }
+}
+
+static int mma8451_i2c_set(mma8451_stats* stats, int file, unsigned char addr, unsigned char reg, unsigned char value) {
+    unsigned char outbuf[2];
     struct i2c_msg messages[1];
 
     messages[0].addr  = addr;
@@ -945,19 +2088,11 @@ int mma8451_set_i2c_register(int file, unsigned char addr, unsigned char reg, un
     outbuf[0] = reg;
     outbuf[1] = value;
 
-    packets.msgs  = messages;
-    packets.nmsgs = 1;
-    if(ioctl(file, I2C_RDWR, &packets) < 0) {
-        return 0;
-    }
-
-    return 1;
+    return mma8451_i2c_rdwr(stats, MMA8451_STATS_OP_WRITE, file, messages, 1);
 }
 
-
-int mma8451_get_i2c_register(int file, unsigned char addr, unsigned char reg, unsigned char *val) {
+static int mma8451_i2c_get(mma8451_stats* stats, int file, unsigned char addr, unsigned char reg, unsigned char *val) {
     unsigned char inbuf, outbuf;
-    struct i2c_rdwr_ioctl_data packets;
     struct i2c_msg messages[2];
 
     outbuf = reg;
@@ -971,9 +2106,7 @@ int mma8451_get_i2c_register(int file, unsigned char addr, unsigned char reg, un
     messages[1].len   = sizeof(inbuf);
     messages[1].buf   = &inbuf;
 
-    packets.msgs      = messages;
-    packets.nmsgs     = 2;
-    if(ioctl(file, I2C_RDWR, &packets) < 0) {
+    if(!mma8451_i2c_rdwr(stats, MMA8451_STATS_OP_READ, file, messages, 2)) {
         return 0;
     }
     *val = inbuf;
@@ -981,9 +2114,8 @@ int mma8451_get_i2c_register(int file, unsigned char addr, unsigned char reg, un
     return 1;
 }
 
-int mma8451_get_i2c_register_block(int file, unsigned char addr, unsigned char reg, unsigned char *buf, unsigned int cnt) {
+static int mma8451_i2c_get_block(mma8451_stats* stats, int file, unsigned char addr, unsigned char reg, unsigned char *buf, unsigned int cnt) {
     unsigned char outbuf;
-    struct i2c_rdwr_ioctl_data packets;
     struct i2c_msg messages[2];
 
     outbuf = reg;
@@ -997,10 +2129,48 @@ int mma8451_get_i2c_register_block(int file, unsigned char addr, unsigned char r
     messages[1].len   = cnt;
     messages[1].buf   = buf;
 
-    packets.msgs      = messages;
-    packets.nmsgs     = 2;
-    if(ioctl(file, I2C_RDWR, &packets) < 0) {
-        return 0;
-    }
-    return 1;
+    return mma8451_i2c_rdwr(stats, MMA8451_STATS_OP_BLOCK_READ, file, messages, 2);
+}
+
+static int mma8451_device_get_block(mma8451* device, mma8451_stats_op op, unsigned char reg, unsigned char* buf, unsigned int cnt) {
+    struct i2c_msg messages[2];
+
+    messages[0].addr  = device->addr;
+    messages[0].flags = 0;
+    messages[0].len   = 1;
+    messages[0].buf   = &reg;
+
+    messages[1].addr  = device->addr;
+    messages[1].flags = I2C_M_RD;
+    messages[1].len   = cnt;
+    messages[1].buf   = buf;
+
+    return mma8451_device_rdwr(device, op, messages, 2);
+}
+
+static int mma8451_device_set(mma8451* device, unsigned char reg, unsigned char value) {
+    unsigned char outbuf[2];
+    struct i2c_msg messages[1];
+
+    messages[0].addr  = device->addr;
+    messages[0].flags = 0;
+    messages[0].len   = sizeof(outbuf);
+    messages[0].buf   = outbuf;
+
+    outbuf[0] = reg;
+    outbuf[1] = value;
+
+    return mma8451_device_rdwr(device, MMA8451_STATS_OP_WRITE, messages, 1);
+}
+
+int mma8451_set_i2c_register(int file, unsigned char addr, unsigned char reg, unsigned char value) {
+    return mma8451_i2c_set(&mma8451_unattributed_stats, file, addr, reg, value);
+}
+
+int mma8451_get_i2c_register(int file, unsigned char addr, unsigned char reg, unsigned char *val) {
+    return mma8451_i2c_get(&mma8451_unattributed_stats, file, addr, reg, val);
+}
+
+int mma8451_get_i2c_register_block(int file, unsigned char addr, unsigned char reg, unsigned char *buf, unsigned int cnt) {
+    return mma8451_i2c_get_block(&mma8451_unattributed_stats, file, addr, reg, buf, cnt);
 }
\ No newline at end of file
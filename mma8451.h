@@ -17,6 +17,17 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#ifndef MMA8451_H
+#define MMA8451_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct i2c_msg;
+
 /**
  * This is the identifier the MMA8451 returns when asked for its MMA8451_REGISTER_WHO_AM_I
  * register.
@@ -51,9 +62,12 @@
  */
 #define RANGE_DIV_8G_8BIT (0x10 / GRAVITY_ACCEL)
 /**
- * The maximum size of an error message returned by this library.
+ * The maximum size of an error message kept in each handle. Define as 0 when building the
+ * library and application to drop last_error from the handle entirely, both must agree.
  */
+#ifndef MMA8451_ERROR_SIZE
 #define MMA8451_ERROR_SIZE 500
+#endif
 /**
  * The maximum value for a 14-bit signed sensor value.
  */
@@ -70,6 +84,41 @@
  * The maximum value for a 8-bit sensor value.
  */
 #define MAX_8BIT_SIGNED 0xFF
+/**
+ * The number of errno values tracked individually by the statistics counters, anything
+ * larger is counted in the last bucket. 0 removes the array from mma8451_stats, this is the
+ * default with MMA8451_DISABLE_STATS. The library and the application must agree.
+ */
+#ifndef MMA8451_STATS_ERRNO_BUCKETS
+#ifdef MMA8451_DISABLE_STATS
+#define MMA8451_STATS_ERRNO_BUCKETS 0
+#else
+#define MMA8451_STATS_ERRNO_BUCKETS 128
+#endif
+#endif
+/**
+ * The number of log2 buckets in each latency histogram. Bucket 0 holds transfers that took
+ * under 1us, bucket n holds transfers that took [2^(n-1), 2^n) microseconds and the last
+ * bucket holds everything slower. 0 removes the histograms from mma8451_stats, this is the
+ * default with MMA8451_DISABLE_STATS. The library and the application must agree.
+ */
+#ifndef MMA8451_STATS_LATENCY_BUCKETS
+#ifdef MMA8451_DISABLE_STATS
+#define MMA8451_STATS_LATENCY_BUCKETS 0
+#else
+#define MMA8451_STATS_LATENCY_BUCKETS 24
+#endif
+#endif
+/**
+ * The number of times an I2C transfer is retried when the adapter reports it was interrupted
+ * or lost arbitration.
+ */
+#define MMA8451_I2C_RETRIES 3
+/**
+ * The maximum number of threads that can record transfers at the same time while tracing is
+ * enabled. A thread's ring is released when it exits and reused by the next thread to trace.
+ */
+#define MMA8451_TRACE_MAX_THREADS 16
 
 /**
  * This enumeration contains all of the different MMA8451 register ID's.
@@ -128,6 +177,296 @@ typedef enum mma8451_register {
 	MMA8451_REGISTER_OFF_Z = 0x31
 } mma8451_register;
 
+/**
+ * The number of registers in the register map, from MMA8451_REGISTER_STATUS through
+ * MMA8451_REGISTER_OFF_Z.
+ */
+#define MMA8451_REGISTER_COUNT 0x32
+
+/**
+ * Masks and shifts for every field in the register map, named MMA8451_<register>_<field>.
+ * Use them with MMA8451_FIELD_GET() and MMA8451_FIELD_SET().
+ */
+//STATUS
+#define MMA8451_STATUS_ZYXOW_MASK 0x80
+#define MMA8451_STATUS_ZYXOW_SHIFT 7
+#define MMA8451_STATUS_ZOW_MASK 0x40
+#define MMA8451_STATUS_ZOW_SHIFT 6
+#define MMA8451_STATUS_YOW_MASK 0x20
+#define MMA8451_STATUS_YOW_SHIFT 5
+#define MMA8451_STATUS_XOW_MASK 0x10
+#define MMA8451_STATUS_XOW_SHIFT 4
+#define MMA8451_STATUS_ZYXDR_MASK 0x08
+#define MMA8451_STATUS_ZYXDR_SHIFT 3
+#define MMA8451_STATUS_ZDR_MASK 0x04
+#define MMA8451_STATUS_ZDR_SHIFT 2
+#define MMA8451_STATUS_YDR_MASK 0x02
+#define MMA8451_STATUS_YDR_SHIFT 1
+#define MMA8451_STATUS_XDR_MASK 0x01
+#define MMA8451_STATUS_XDR_SHIFT 0
+//F_STATUS
+#define MMA8451_F_STATUS_F_OVF_MASK 0x80
+#define MMA8451_F_STATUS_F_OVF_SHIFT 7
+#define MMA8451_F_STATUS_F_WMRK_FLAG_MASK 0x40
+#define MMA8451_F_STATUS_F_WMRK_FLAG_SHIFT 6
+#define MMA8451_F_STATUS_F_CNT_MASK 0x3F
+#define MMA8451_F_STATUS_F_CNT_SHIFT 0
+//F_SETUP
+#define MMA8451_F_SETUP_F_MODE_MASK 0xC0
+#define MMA8451_F_SETUP_F_MODE_SHIFT 6
+#define MMA8451_F_SETUP_F_WMRK_MASK 0x3F
+#define MMA8451_F_SETUP_F_WMRK_SHIFT 0
+//TRIG_CFG
+#define MMA8451_TRIG_CFG_TRIG_TRANS_MASK 0x20
+#define MMA8451_TRIG_CFG_TRIG_TRANS_SHIFT 5
+#define MMA8451_TRIG_CFG_TRIG_LNDPRT_MASK 0x10
+#define MMA8451_TRIG_CFG_TRIG_LNDPRT_SHIFT 4
+#define MMA8451_TRIG_CFG_TRIG_PULSE_MASK 0x08
+#define MMA8451_TRIG_CFG_TRIG_PULSE_SHIFT 3
+#define MMA8451_TRIG_CFG_TRIG_FF_MT_MASK 0x04
+#define MMA8451_TRIG_CFG_TRIG_FF_MT_SHIFT 2
+//SYSMOD
+#define MMA8451_SYSMOD_FGERR_MASK 0x80
+#define MMA8451_SYSMOD_FGERR_SHIFT 7
+#define MMA8451_SYSMOD_FGT_MASK 0x7C
+#define MMA8451_SYSMOD_FGT_SHIFT 2
+#define MMA8451_SYSMOD_SYSMOD_MASK 0x03
+#define MMA8451_SYSMOD_SYSMOD_SHIFT 0
+//INT_SOURCE
+#define MMA8451_INT_SOURCE_SRC_ASLP_MASK 0x80
+#define MMA8451_INT_SOURCE_SRC_ASLP_SHIFT 7
+#define MMA8451_INT_SOURCE_SRC_FIFO_MASK 0x40
+#define MMA8451_INT_SOURCE_SRC_FIFO_SHIFT 6
+#define MMA8451_INT_SOURCE_SRC_TRANS_MASK 0x20
+#define MMA8451_INT_SOURCE_SRC_TRANS_SHIFT 5
+#define MMA8451_INT_SOURCE_SRC_LNDPRT_MASK 0x10
+#define MMA8451_INT_SOURCE_SRC_LNDPRT_SHIFT 4
+#define MMA8451_INT_SOURCE_SRC_PULSE_MASK 0x08
+#define MMA8451_INT_SOURCE_SRC_PULSE_SHIFT 3
+#define MMA8451_INT_SOURCE_SRC_FF_MT_MASK 0x04
+#define MMA8451_INT_SOURCE_SRC_FF_MT_SHIFT 2
+#define MMA8451_INT_SOURCE_SRC_DRDY_MASK 0x01
+#define MMA8451_INT_SOURCE_SRC_DRDY_SHIFT 0
+//XYZ_DATA_CFG
+#define MMA8451_XYZ_DATA_CFG_HPF_OUT_MASK 0x10
+#define MMA8451_XYZ_DATA_CFG_HPF_OUT_SHIFT 4
+#define MMA8451_XYZ_DATA_CFG_FS_MASK 0x03
+#define MMA8451_XYZ_DATA_CFG_FS_SHIFT 0
+//HP_FILTER_CUTOFF
+#define MMA8451_HP_FILTER_CUTOFF_PULSE_HPF_BYP_MASK 0x20
+#define MMA8451_HP_FILTER_CUTOFF_PULSE_HPF_BYP_SHIFT 5
+#define MMA8451_HP_FILTER_CUTOFF_PULSE_LPF_EN_MASK 0x10
+#define MMA8451_HP_FILTER_CUTOFF_PULSE_LPF_EN_SHIFT 4
+#define MMA8451_HP_FILTER_CUTOFF_SEL_MASK 0x03
+#define MMA8451_HP_FILTER_CUTOFF_SEL_SHIFT 0
+//PL_STATUS
+#define MMA8451_PL_STATUS_NEWLP_MASK 0x80
+#define MMA8451_PL_STATUS_NEWLP_SHIFT 7
+#define MMA8451_PL_STATUS_LO_MASK 0x40
+#define MMA8451_PL_STATUS_LO_SHIFT 6
+#define MMA8451_PL_STATUS_LAPO_MASK 0x06
+#define MMA8451_PL_STATUS_LAPO_SHIFT 1
+#define MMA8451_PL_STATUS_BAFRO_MASK 0x01
+#define MMA8451_PL_STATUS_BAFRO_SHIFT 0
+//PL_CFG
+#define MMA8451_PL_CFG_DBCNTM_MASK 0x80
+#define MMA8451_PL_CFG_DBCNTM_SHIFT 7
+#define MMA8451_PL_CFG_PL_EN_MASK 0x40
+#define MMA8451_PL_CFG_PL_EN_SHIFT 6
+//PL_BF_ZCOMP
+#define MMA8451_PL_BF_ZCOMP_BKFR_MASK 0xC0
+#define MMA8451_PL_BF_ZCOMP_BKFR_SHIFT 6
+#define MMA8451_PL_BF_ZCOMP_ZLOCK_MASK 0x07
+#define MMA8451_PL_BF_ZCOMP_ZLOCK_SHIFT 0
+//P_L_THS_REG
+#define MMA8451_P_L_THS_REG_P_L_THS_MASK 0xF8
+#define MMA8451_P_L_THS_REG_P_L_THS_SHIFT 3
+#define MMA8451_P_L_THS_REG_HYS_MASK 0x07
+#define MMA8451_P_L_THS_REG_HYS_SHIFT 0
+//FF_MT_CFG
+#define MMA8451_FF_MT_CFG_ELE_MASK 0x80
+#define MMA8451_FF_MT_CFG_ELE_SHIFT 7
+#define MMA8451_FF_MT_CFG_OAE_MASK 0x40
+#define MMA8451_FF_MT_CFG_OAE_SHIFT 6
+#define MMA8451_FF_MT_CFG_ZEFE_MASK 0x20
+#define MMA8451_FF_MT_CFG_ZEFE_SHIFT 5
+#define MMA8451_FF_MT_CFG_YEFE_MASK 0x10
+#define MMA8451_FF_MT_CFG_YEFE_SHIFT 4
+#define MMA8451_FF_MT_CFG_XEFE_MASK 0x08
+#define MMA8451_FF_MT_CFG_XEFE_SHIFT 3
+//FF_MT_SRC
+#define MMA8451_FF_MT_SRC_EA_MASK 0x80
+#define MMA8451_FF_MT_SRC_EA_SHIFT 7
+#define MMA8451_FF_MT_SRC_ZHE_MASK 0x20
+#define MMA8451_FF_MT_SRC_ZHE_SHIFT 5
+#define MMA8451_FF_MT_SRC_ZHP_MASK 0x10
+#define MMA8451_FF_MT_SRC_ZHP_SHIFT 4
+#define MMA8451_FF_MT_SRC_YHE_MASK 0x08
+#define MMA8451_FF_MT_SRC_YHE_SHIFT 3
+#define MMA8451_FF_MT_SRC_YHP_MASK 0x04
+#define MMA8451_FF_MT_SRC_YHP_SHIFT 2
+#define MMA8451_FF_MT_SRC_XHE_MASK 0x02
+#define MMA8451_FF_MT_SRC_XHE_SHIFT 1
+#define MMA8451_FF_MT_SRC_XHP_MASK 0x01
+#define MMA8451_FF_MT_SRC_XHP_SHIFT 0
+//FF_MT_THS
+#define MMA8451_FF_MT_THS_DBCNTM_MASK 0x80
+#define MMA8451_FF_MT_THS_DBCNTM_SHIFT 7
+#define MMA8451_FF_MT_THS_THS_MASK 0x7F
+#define MMA8451_FF_MT_THS_THS_SHIFT 0
+//TRANSIENT_CFG
+#define MMA8451_TRANSIENT_CFG_ELE_MASK 0x10
+#define MMA8451_TRANSIENT_CFG_ELE_SHIFT 4
+#define MMA8451_TRANSIENT_CFG_ZTEFE_MASK 0x08
+#define MMA8451_TRANSIENT_CFG_ZTEFE_SHIFT 3
+#define MMA8451_TRANSIENT_CFG_YTEFE_MASK 0x04
+#define MMA8451_TRANSIENT_CFG_YTEFE_SHIFT 2
+#define MMA8451_TRANSIENT_CFG_XTEFE_MASK 0x02
+#define MMA8451_TRANSIENT_CFG_XTEFE_SHIFT 1
+#define MMA8451_TRANSIENT_CFG_HPF_BYP_MASK 0x01
+#define MMA8451_TRANSIENT_CFG_HPF_BYP_SHIFT 0
+//TRANSIENT_SCR
+#define MMA8451_TRANSIENT_SCR_EA_MASK 0x40
+#define MMA8451_TRANSIENT_SCR_EA_SHIFT 6
+#define MMA8451_TRANSIENT_SCR_ZTRANSE_MASK 0x20
+#define MMA8451_TRANSIENT_SCR_ZTRANSE_SHIFT 5
+#define MMA8451_TRANSIENT_SCR_Z_TRANS_POL_MASK 0x10
+#define MMA8451_TRANSIENT_SCR_Z_TRANS_POL_SHIFT 4
+#define MMA8451_TRANSIENT_SCR_YTRANSE_MASK 0x08
+#define MMA8451_TRANSIENT_SCR_YTRANSE_SHIFT 3
+#define MMA8451_TRANSIENT_SCR_Y_TRANS_POL_MASK 0x04
+#define MMA8451_TRANSIENT_SCR_Y_TRANS_POL_SHIFT 2
+#define MMA8451_TRANSIENT_SCR_XTRANSE_MASK 0x02
+#define MMA8451_TRANSIENT_SCR_XTRANSE_SHIFT 1
+#define MMA8451_TRANSIENT_SCR_X_TRANS_POL_MASK 0x01
+#define MMA8451_TRANSIENT_SCR_X_TRANS_POL_SHIFT 0
+//TRANSIENT_THS
+#define MMA8451_TRANSIENT_THS_DBCNTM_MASK 0x80
+#define MMA8451_TRANSIENT_THS_DBCNTM_SHIFT 7
+#define MMA8451_TRANSIENT_THS_THS_MASK 0x7F
+#define MMA8451_TRANSIENT_THS_THS_SHIFT 0
+//PULSE_CFG
+#define MMA8451_PULSE_CFG_DPA_MASK 0x80
+#define MMA8451_PULSE_CFG_DPA_SHIFT 7
+#define MMA8451_PULSE_CFG_ELE_MASK 0x40
+#define MMA8451_PULSE_CFG_ELE_SHIFT 6
+#define MMA8451_PULSE_CFG_ZDPEFE_MASK 0x20
+#define MMA8451_PULSE_CFG_ZDPEFE_SHIFT 5
+#define MMA8451_PULSE_CFG_ZSPEFE_MASK 0x10
+#define MMA8451_PULSE_CFG_ZSPEFE_SHIFT 4
+#define MMA8451_PULSE_CFG_YDPEFE_MASK 0x08
+#define MMA8451_PULSE_CFG_YDPEFE_SHIFT 3
+#define MMA8451_PULSE_CFG_YSPEFE_MASK 0x04
+#define MMA8451_PULSE_CFG_YSPEFE_SHIFT 2
+#define MMA8451_PULSE_CFG_XDPEFE_MASK 0x02
+#define MMA8451_PULSE_CFG_XDPEFE_SHIFT 1
+#define MMA8451_PULSE_CFG_XSPEFE_MASK 0x01
+#define MMA8451_PULSE_CFG_XSPEFE_SHIFT 0
+//PULSE_SRC
+#define MMA8451_PULSE_SRC_EA_MASK 0x80
+#define MMA8451_PULSE_SRC_EA_SHIFT 7
+#define MMA8451_PULSE_SRC_AXZ_MASK 0x40
+#define MMA8451_PULSE_SRC_AXZ_SHIFT 6
+#define MMA8451_PULSE_SRC_AXY_MASK 0x20
+#define MMA8451_PULSE_SRC_AXY_SHIFT 5
+#define MMA8451_PULSE_SRC_AXX_MASK 0x10
+#define MMA8451_PULSE_SRC_AXX_SHIFT 4
+#define MMA8451_PULSE_SRC_DPE_MASK 0x08
+#define MMA8451_PULSE_SRC_DPE_SHIFT 3
+#define MMA8451_PULSE_SRC_POLZ_MASK 0x04
+#define MMA8451_PULSE_SRC_POLZ_SHIFT 2
+#define MMA8451_PULSE_SRC_POLY_MASK 0x02
+#define MMA8451_PULSE_SRC_POLY_SHIFT 1
+#define MMA8451_PULSE_SRC_POLX_MASK 0x01
+#define MMA8451_PULSE_SRC_POLX_SHIFT 0
+//PULSE_THSX
+#define MMA8451_PULSE_THSX_THS_MASK 0x7F
+#define MMA8451_PULSE_THSX_THS_SHIFT 0
+//PULSE_THSY
+#define MMA8451_PULSE_THSY_THS_MASK 0x7F
+#define MMA8451_PULSE_THSY_THS_SHIFT 0
+//PULSE_THSZ
+#define MMA8451_PULSE_THSZ_THS_MASK 0x7F
+#define MMA8451_PULSE_THSZ_THS_SHIFT 0
+//CTRL_REG1
+#define MMA8451_CTRL_REG1_ASLP_RATE_MASK 0xC0
+#define MMA8451_CTRL_REG1_ASLP_RATE_SHIFT 6
+#define MMA8451_CTRL_REG1_DR_MASK 0x38
+#define MMA8451_CTRL_REG1_DR_SHIFT 3
+#define MMA8451_CTRL_REG1_LNOISE_MASK 0x04
+#define MMA8451_CTRL_REG1_LNOISE_SHIFT 2
+#define MMA8451_CTRL_REG1_F_READ_MASK 0x02
+#define MMA8451_CTRL_REG1_F_READ_SHIFT 1
+#define MMA8451_CTRL_REG1_ACTIVE_MASK 0x01
+#define MMA8451_CTRL_REG1_ACTIVE_SHIFT 0
+//CTRL_REG2
+#define MMA8451_CTRL_REG2_ST_MASK 0x80
+#define MMA8451_CTRL_REG2_ST_SHIFT 7
+#define MMA8451_CTRL_REG2_RST_MASK 0x40
+#define MMA8451_CTRL_REG2_RST_SHIFT 6
+#define MMA8451_CTRL_REG2_SMODS_MASK 0x18
+#define MMA8451_CTRL_REG2_SMODS_SHIFT 3
+#define MMA8451_CTRL_REG2_SLPE_MASK 0x04
+#define MMA8451_CTRL_REG2_SLPE_SHIFT 2
+#define MMA8451_CTRL_REG2_MODS_MASK 0x03
+#define MMA8451_CTRL_REG2_MODS_SHIFT 0
+//CTRL_REG3
+#define MMA8451_CTRL_REG3_FIFO_GATE_MASK 0x80
+#define MMA8451_CTRL_REG3_FIFO_GATE_SHIFT 7
+#define MMA8451_CTRL_REG3_WAKE_TRANS_MASK 0x40
+#define MMA8451_CTRL_REG3_WAKE_TRANS_SHIFT 6
+#define MMA8451_CTRL_REG3_WAKE_LNDPRT_MASK 0x20
+#define MMA8451_CTRL_REG3_WAKE_LNDPRT_SHIFT 5
+#define MMA8451_CTRL_REG3_WAKE_PULSE_MASK 0x10
+#define MMA8451_CTRL_REG3_WAKE_PULSE_SHIFT 4
+#define MMA8451_CTRL_REG3_WAKE_FF_MT_MASK 0x08
+#define MMA8451_CTRL_REG3_WAKE_FF_MT_SHIFT 3
+#define MMA8451_CTRL_REG3_IPOL_MASK 0x02
+#define MMA8451_CTRL_REG3_IPOL_SHIFT 1
+#define MMA8451_CTRL_REG3_PP_OD_MASK 0x01
+#define MMA8451_CTRL_REG3_PP_OD_SHIFT 0
+//CTRL_REG4
+#define MMA8451_CTRL_REG4_INT_EN_ASLP_MASK 0x80
+#define MMA8451_CTRL_REG4_INT_EN_ASLP_SHIFT 7
+#define MMA8451_CTRL_REG4_INT_EN_FIFO_MASK 0x40
+#define MMA8451_CTRL_REG4_INT_EN_FIFO_SHIFT 6
+#define MMA8451_CTRL_REG4_INT_EN_TRANS_MASK 0x20
+#define MMA8451_CTRL_REG4_INT_EN_TRANS_SHIFT 5
+#define MMA8451_CTRL_REG4_INT_EN_LNDPRT_MASK 0x10
+#define MMA8451_CTRL_REG4_INT_EN_LNDPRT_SHIFT 4
+#define MMA8451_CTRL_REG4_INT_EN_PULSE_MASK 0x08
+#define MMA8451_CTRL_REG4_INT_EN_PULSE_SHIFT 3
+#define MMA8451_CTRL_REG4_INT_EN_FF_MT_MASK 0x04
+#define MMA8451_CTRL_REG4_INT_EN_FF_MT_SHIFT 2
+#define MMA8451_CTRL_REG4_INT_EN_DRDY_MASK 0x01
+#define MMA8451_CTRL_REG4_INT_EN_DRDY_SHIFT 0
+//CTRL_REG5
+#define MMA8451_CTRL_REG5_INT_CFG_ASLP_MASK 0x80
+#define MMA8451_CTRL_REG5_INT_CFG_ASLP_SHIFT 7
+#define MMA8451_CTRL_REG5_INT_CFG_FIFO_MASK 0x40
+#define MMA8451_CTRL_REG5_INT_CFG_FIFO_SHIFT 6
+#define MMA8451_CTRL_REG5_INT_CFG_TRANS_MASK 0x20
+#define MMA8451_CTRL_REG5_INT_CFG_TRANS_SHIFT 5
+#define MMA8451_CTRL_REG5_INT_CFG_LNDPRT_MASK 0x10
+#define MMA8451_CTRL_REG5_INT_CFG_LNDPRT_SHIFT 4
+#define MMA8451_CTRL_REG5_INT_CFG_PULSE_MASK 0x08
+#define MMA8451_CTRL_REG5_INT_CFG_PULSE_SHIFT 3
+#define MMA8451_CTRL_REG5_INT_CFG_FF_MT_MASK 0x04
+#define MMA8451_CTRL_REG5_INT_CFG_FF_MT_SHIFT 2
+#define MMA8451_CTRL_REG5_INT_CFG_DRDY_MASK 0x01
+#define MMA8451_CTRL_REG5_INT_CFG_DRDY_SHIFT 0
+
+/**
+ * Extracts a field from a packed register value, e.g.
+ * MMA8451_FIELD_GET(value, MMA8451_CTRL_REG1_DR).
+ */
+#define MMA8451_FIELD_GET(value, field) (((value) & field##_MASK) >> field##_SHIFT)
+/**
+ * Returns a packed register value with a field replaced, e.g.
+ * value = MMA8451_FIELD_SET(value, MMA8451_CTRL_REG1_DR, MMA8451_DATA_RATE_100HZ).
+ */
+#define MMA8451_FIELD_SET(value, field, x) ((unsigned char)(((value) & ~field##_MASK) | (((x) << field##_SHIFT) & field##_MASK)))
+
 /**
  * An enumeration containing the different supported FIFO modes.
  */
@@ -1269,6 +1608,82 @@ typedef struct mma8451_acceleration {
 	double z;
 } mma8451_acceleration;
 
+/**
+ * This structure contains a single XYZ sample in signed counts, as read from the device.
+ */
+typedef struct mma8451_raw_sample {
+	/**
+	 * X axis counts.
+	 */
+	int16_t x;
+	/**
+	 * Y axis counts.
+	 */
+	int16_t y;
+	/**
+	 * Z axis counts.
+	 */
+	int16_t z;
+} mma8451_raw_sample;
+
+/**
+ * Set in mma8451_sample.flags when samples were lost immediately before this one.
+ */
+#define MMA8451_SAMPLE_GAP 0x01
+
+/**
+ * This structure contains a sample read together with the STATUS register.
+ */
+typedef struct mma8451_sample {
+	/**
+	 * The device's sequence number for this sample. Lost samples consume sequence numbers,
+	 * so a jump shows where data is missing.
+	 */
+	uint64_t sequence;
+	/**
+	 * The sample in counts.
+	 */
+	mma8451_raw_sample raw;
+	/**
+	 * The STATUS register read with the sample.
+	 */
+	unsigned char status;
+	/**
+	 * MMA8451_SAMPLE_* flags.
+	 */
+	unsigned char flags;
+} mma8451_sample;
+
+/**
+ * This structure paces reads to the device's output data rate, see mma8451_pacer_wait().
+ */
+typedef struct mma8451_pacer {
+	/**
+	 * The sample period from CTRL_REG1, in nanoseconds.
+	 */
+	uint64_t period_ns;
+	/**
+	 * The device's sample period as measured against CLOCK_MONOTONIC, in nanoseconds.
+	 */
+	uint64_t interval_ns;
+	/**
+	 * CLOCK_MONOTONIC time of the next read, in nanoseconds.
+	 */
+	uint64_t next_ns;
+	/**
+	 * CLOCK_MONOTONIC time the last sample was read, in nanoseconds.
+	 */
+	uint64_t timestamp_ns;
+	/**
+	 * Reads that came before the sample was ready. Each one moves the phase later.
+	 */
+	uint64_t early;
+	/**
+	 * Whether the sample being waited for has already come up empty once.
+	 */
+	int retried;
+} mma8451_pacer;
+
 /**
  * This structure represents a generic register containing eight bits.
  * This is used to inject bits into the other structures.
@@ -1309,13 +1724,176 @@ typedef struct mma8451_register_generic {
 } mma8451_register_generic;
 
 /**
- * This structure contains information about an attached MMA8451 accelerometer.
+ * This structure contains the packed register map, one byte per register indexed by
+ * mma8451_register. Use MMA8451_MAP_GET() / MMA8451_MAP_SET() or the typed accessors below
+ * to work with individual fields.
  */
-typedef struct mma8451 {
+typedef struct mma8451_register_map {
 	/**
-	 * The filesystem path to the device.
+	 * Raw register values.
 	 */
-	char* path;
+	unsigned char regs[MMA8451_REGISTER_COUNT];
+} mma8451_register_map;
+
+/**
+ * Extracts a field from a register map, e.g. MMA8451_MAP_GET(&map, CTRL_REG1, DR).
+ */
+#define MMA8451_MAP_GET(map, reg, field) \
+	MMA8451_FIELD_GET((map)->regs[MMA8451_REGISTER_##reg], MMA8451_##reg##_##field)
+/**
+ * Replaces a field in a register map, e.g. MMA8451_MAP_SET(&map, XYZ_DATA_CFG, FS, MMA8451_RANGE_4G).
+ */
+#define MMA8451_MAP_SET(map, reg, field, x) \
+	((map)->regs[MMA8451_REGISTER_##reg] = MMA8451_FIELD_SET((map)->regs[MMA8451_REGISTER_##reg], MMA8451_##reg##_##field, (x)))
+
+/**
+ * Gets the data rate from a register map.
+ */
+static inline mma8451_data_rate mma8451_map_data_rate(const mma8451_register_map* map) {
+	return (mma8451_data_rate)MMA8451_MAP_GET(map, CTRL_REG1, DR);
+}
+/**
+ * Gets the range scale from a register map.
+ */
+static inline mma8451_range_scale mma8451_map_range(const mma8451_register_map* map) {
+	return (mma8451_range_scale)MMA8451_MAP_GET(map, XYZ_DATA_CFG, FS);
+}
+/**
+ * Gets the output size from a register map.
+ */
+static inline mma8451_output_size mma8451_map_output_size(const mma8451_register_map* map) {
+	return (mma8451_output_size)MMA8451_MAP_GET(map, CTRL_REG1, F_READ);
+}
+/**
+ * Gets the active mode power scheme from a register map.
+ */
+static inline mma8451_power_mode mma8451_map_power_mode(const mma8451_register_map* map) {
+	return (mma8451_power_mode)MMA8451_MAP_GET(map, CTRL_REG2, MODS);
+}
+/**
+ * Gets the FIFO mode from a register map.
+ */
+static inline mma8451_fifo_mode mma8451_map_fifo_mode(const mma8451_register_map* map) {
+	return (mma8451_fifo_mode)MMA8451_MAP_GET(map, F_SETUP, F_MODE);
+}
+/**
+ * Gets the FIFO watermark from a register map.
+ */
+static inline unsigned char mma8451_map_fifo_watermark(const mma8451_register_map* map) {
+	return MMA8451_MAP_GET(map, F_SETUP, F_WMRK);
+}
+
+/**
+ * An enumeration containing the types of I2C transfers tracked by the statistics counters.
+ */
+typedef enum mma8451_stats_op {
+	/**
+	 * A single register read.
+	 */
+	MMA8451_STATS_OP_READ = 0,
+	/**
+	 * A single register write.
+	 */
+	MMA8451_STATS_OP_WRITE = 1,
+	/**
+	 * A multiple register (auto-increment) read.
+	 */
+	MMA8451_STATS_OP_BLOCK_READ = 2,
+	/**
+	 * The number of tracked transfer types.
+	 */
+	MMA8451_STATS_OP_COUNT = 3
+} mma8451_stats_op;
+
+/**
+ * An enumeration containing the ways a device's transfers can be issued, chosen from the
+ * adapter's I2C_FUNCS when the device is opened.
+ */
+typedef enum mma8451_transfer_mode {
+	/**
+	 * I2C_RDWR with repeated start and reads of any length.
+	 */
+	MMA8451_TRANSFER_I2C = 0,
+	/**
+	 * I2C_RDWR with reads split to the adapter's maximum message length. FIFO bursts are split
+	 * on sample boundaries.
+	 */
+	MMA8451_TRANSFER_I2C_CHUNKED = 1,
+	/**
+	 * SMBus I2C-block reads of up to 32 bytes and byte data writes, for SMBus-only adapters.
+	 * The adapter is pointed at the device when this mode is chosen, which fails with EBUSY if
+	 * a kernel driver is bound to the address, and again whenever another handle sharing the
+	 * file pointed it elsewhere. Handles sharing a file must not transfer concurrently.
+	 */
+	MMA8451_TRANSFER_SMBUS = 2
+} mma8451_transfer_mode;
+
+/**
+ * The longest read a SMBus I2C-block transfer can make.
+ */
+#define MMA8451_SMBUS_BLOCK_MAX 32
+
+/**
+ * This structure contains the performance counters for a device. The counters are updated
+ * with relaxed atomics by the transport functions, use mma8451_get_stats() to get a
+ * consistent copy.
+ */
+typedef struct mma8451_stats {
+	/**
+	 * The number of I2C_RDWR or I2C_SMBUS ioctls issued, including retries.
+	 */
+	uint64_t ioctls;
+	/**
+	 * The number of bytes read from the bus (excluding register addresses).
+	 */
+	uint64_t bytes_read;
+	/**
+	 * The number of bytes written to the bus (including register addresses).
+	 */
+	uint64_t bytes_written;
+	/**
+	 * The number of transfers that failed after all retries.
+	 */
+	uint64_t errors;
+	/**
+	 * The number of transfers that were retried.
+	 */
+	uint64_t retries;
+	/**
+	 * The number of times a FIFO overflow was observed in F_STATUS.
+	 */
+	uint64_t fifo_overflows;
+	/**
+	 * The number of acceleration samples delivered to the caller.
+	 */
+	uint64_t samples;
+	/**
+	 * Reads by mma8451_read_sample() that found no new sample (STATUS ZYXDR clear).
+	 */
+	uint64_t duplicates;
+	/**
+	 * Samples overwritten before mma8451_read_sample() could read them (STATUS ZYXOW set).
+	 * Each overwrite counts as one, the lower bound of what was lost.
+	 */
+	uint64_t overruns;
+#if MMA8451_STATS_ERRNO_BUCKETS > 0
+	/**
+	 * Failed ioctls counted by errno.
+	 */
+	uint32_t errors_by_errno[MMA8451_STATS_ERRNO_BUCKETS];
+#endif
+#if MMA8451_STATS_LATENCY_BUCKETS > 0
+	/**
+	 * Log2 latency histograms in microseconds, one per mma8451_stats_op.
+	 */
+	uint32_t latency[MMA8451_STATS_OP_COUNT][MMA8451_STATS_LATENCY_BUCKETS];
+#endif
+} mma8451_stats;
+
+/**
+ * This structure contains information about an attached MMA8451 accelerometer.
+ */
+typedef struct mma8451 {
 	/**
 	 * A file pointer to the device.
 	 */
@@ -1332,12 +1910,80 @@ typedef struct mma8451 {
 	 * The configured data size.
 	 */
 	mma8451_output_size data_size;
+	/**
+	 * How transfers are issued on this device's adapter.
+	 */
+	mma8451_transfer_mode transfer;
+	/**
+	 * The longest read issued in one message, 0 for no limit.
+	 */
+	unsigned int max_read;
+	/**
+	 * The sequence number mma8451_read_sample() gives the next sample.
+	 */
+	uint64_t sequence;
+	/**
+	 * The filesystem path to the device, NULL for handles set up with mma8451_init().
+	 */
+	char* path;
+	/**
+	 * Performance counters for this device.
+	 */
+	mma8451_stats stats;
+#if MMA8451_ERROR_SIZE > 0
 	/**
 	 * The last error message for this device.
 	 */
 	char last_error[MMA8451_ERROR_SIZE];
+#endif
 } mma8451;
 
+/**
+ * The maximum number of devices read by one mma8451_read_bus(), two messages each within the
+ * kernel's limit of 42 per I2C_RDWR.
+ */
+#define MMA8451_BUS_READ_MAX 21
+
+/**
+ * This structure describes one device's part of a mma8451_read_bus() transfer.
+ */
+typedef struct mma8451_bus_read {
+	/**
+	 * Device to read, every device in a transfer must share the same bus file.
+	 */
+	mma8451* device;
+	/**
+	 * Whether the device's FIFO is enabled, which makes the first register F_STATUS.
+	 */
+	unsigned char fifo;
+	/**
+	 * Set to the STATUS or F_STATUS register read with the samples.
+	 */
+	unsigned char status;
+	/**
+	 * Set to MMA8451_SAMPLE_GAP if samples were lost before the first one read.
+	 */
+	unsigned char flags;
+	/**
+	 * The number of samples to read, at most 32. Ignored without the FIFO, where one is read.
+	 * F_STATUS is captured as the read starts, so samples read beyond its count are dropped;
+	 * ask for no more than are known to be queued, e.g. the watermark.
+	 */
+	unsigned int count;
+	/**
+	 * Storage for count samples.
+	 */
+	mma8451_raw_sample* samples;
+	/**
+	 * Set to the number of valid samples read.
+	 */
+	unsigned int valid;
+	/**
+	 * Set to the device sequence number of the first sample.
+	 */
+	uint64_t sequence;
+} mma8451_bus_read;
+
 //High level functions
 /**
  * This function opens an MMA8451 accelerometer.
@@ -1346,6 +1992,37 @@ typedef struct mma8451 {
  * @return Either a MMA8451 structure or NULL if there was an error.
  */
 mma8451* mma8451_open(char* path, unsigned char addr);
+/**
+ * This function sets up an MMA8451 handle in caller provided storage over an already open
+ * I2C bus, without allocating. The transfer mode is chosen from the adapter's I2C_FUNCS.
+ * The caller keeps ownership of both, so the handle must not be passed to mma8451_close().
+ * The fields used on every transfer come first in the structure, align the storage to 64
+ * bytes to keep them on one cache line. Most of the handle is the errno and latency arrays of
+ * its stats and the last_error text that follow, which are compiled out with
+ * MMA8451_STATS_ERRNO_BUCKETS, MMA8451_STATS_LATENCY_BUCKETS and MMA8451_ERROR_SIZE set to 0.
+ * @param device Storage for the handle.
+ * @param fd Open file descriptor for the I2C bus.
+ * @param addr the I2C address of the device.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_init(mma8451* device, int fd, unsigned char addr);
+/**
+ * This function overrides the transfer mode chosen from the adapter's I2C_FUNCS, e.g. to
+ * chunk reads on an adapter with a known message length limit. A length limited adapter that
+ * rejects a read (EOPNOTSUPP) is also switched to chunked reads automatically.
+ * @param device Device to set the mode for.
+ * @param mode How to issue transfers.
+ * @param max_read The longest read per message, 0 for no limit. At least 8 when chunking,
+ *                 at most MMA8451_SMBUS_BLOCK_MAX with SMBus.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_set_transfer(mma8451* device, mma8451_transfer_mode mode, unsigned int max_read);
+/**
+ * This function gets a printable name for a transfer mode.
+ * @param mode The transfer mode.
+ * @return The name, e.g. "i2c", "i2c-chunked" or "smbus".
+ */
+const char* mma8451_transfer_name(mma8451_transfer_mode mode);
 /**
  * This function closes an open reference to an MMA8451 accelerometer.
  * @param device Device to close, also cleans up memory.
@@ -1379,6 +2056,27 @@ int mma8451_set_power_mode(mma8451* device, mma8451_power_mode mode);
  * @return 1 is successful, 0 if failure.
  */
 int mma8451_set_data_rate(mma8451* device, mma8451_data_rate rate);
+/**
+ * This function gets the high-pass filter cutoff for a data rate, power mode and
+ * HP_FILTER_CUTOFF SEL value.
+ * @param rate Data rate.
+ * @param mode Power mode.
+ * @param sel SEL value, 0 to 3.
+ * @return The cutoff in hz.
+ */
+double mma8451_hp_cutoff_hz(mma8451_data_rate rate, mma8451_power_mode mode, unsigned char sel);
+/**
+ * This function sets the high-pass filter cutoff to the SEL value nearest to hz for the
+ * current data rate and power mode. The available cutoffs depend on both, so call this again
+ * after changing either. The device is briefly put in standby if it is active.
+ * @param device Device to change.
+ * @param hz The desired cutoff.
+ * @param output Whether or not the output registers and FIFO deliver high-pass filtered data
+ *        (XYZ_DATA_CFG HPF_OUT). Motion detection functions use the filter either way.
+ * @param actual The cutoff selected, optional.
+ * @return 1 is successful, 0 if failure.
+ */
+int mma8451_set_high_pass(mma8451* device, double hz, unsigned char output, double* actual);
 /**
  * This function sets the configured output size.
  * @param device Device to change.
@@ -1428,6 +2126,147 @@ int mma8451_set_active(mma8451* device, unsigned char active);
  * @return 1 if successful, 0 if failure.
  */
 int mma8451_get_acceleration(mma8451* device, mma8451_acceleration* data);
+/**
+ * This function drains samples from the FIFO in a single transfer. The caller must already
+ * know, e.g. from mma8451_get_f_status(), that at least count samples are queued.
+ * @param device Device to read from.
+ * @param samples Samples to fill.
+ * @param count Number of samples to read, at most 32.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_drain_fifo(mma8451* device, mma8451_raw_sample* samples, unsigned int count);
+/**
+ * This function decodes samples as read from MMA8451_REGISTER_OUT_X_MSB using the device's
+ * current output size.
+ * @param device Device the samples were read from.
+ * @param buf Bytes read, 6 per sample in 14-bit mode and 3 per sample in 8-bit mode.
+ * @param count Number of samples.
+ * @param samples Samples to fill.
+ */
+void mma8451_decode_samples(mma8451* device, const unsigned char* buf, unsigned int count, mma8451_raw_sample* samples);
+/**
+ * This function reads STATUS and the output registers in one transfer starting at 0x00, so
+ * the status always describes the data read with it. Reads that find no new sample are
+ * dropped, overwritten samples are counted and flag the next sample as following a gap. Only
+ * valid with the FIFO disabled, when 0x00 is STATUS rather than F_STATUS.
+ * @param device Device to read from.
+ * @param sample Sample to fill.
+ * @return 1 if a new sample was read, 0 if failure or if there was no new sample (errno EAGAIN).
+ */
+int mma8451_read_sample(mma8451* device, mma8451_sample* sample);
+/**
+ * This function reads the status and samples of several devices on the same bus in one
+ * I2C_RDWR, a register address write and a read from 0x00 per device. Without the FIFO this
+ * matches mma8451_read_sample(), with it F_STATUS is read followed by up to count samples.
+ * The transfer is counted in the first device's stats, samples in each device's.
+ * @param reads The devices to read.
+ * @param count Number of devices, at most MMA8451_BUS_READ_MAX.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_read_bus(mma8451_bus_read* reads, unsigned int count);
+/**
+ * This function gets the sample period of a data rate.
+ * @param rate The data rate.
+ * @return The period in nanoseconds.
+ */
+uint64_t mma8451_data_rate_period_ns(mma8451_data_rate rate);
+/**
+ * This function sets up a pacer from the data rate in CTRL_REG1. Set up the pacer again after
+ * changing the data rate.
+ * @param device Device to pace.
+ * @param pacer Pacer to set up.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_pacer_init(mma8451* device, mma8451_pacer* pacer);
+/**
+ * This function sleeps until the next sample is expected and reads it with
+ * mma8451_read_sample(), so each sample is read once instead of polling the bus. A read that
+ * finds ZYXDR clear retries a sixteenth of a period later and moves the phase later. Each read
+ * that succeeds first time moves the phase slightly earlier. The measured interval is nudged
+ * the same way, so reads settle just after the device's data-ready and follow its clock
+ * within half to twice the nominal period. A change to auto-sleep's lower data rate is
+ * followed through the retries.
+ * @param device Device to read from.
+ * @param pacer Pacer set up with mma8451_pacer_init().
+ * @param sample Sample to fill.
+ * @return 1 if a new sample was read, 0 if failure.
+ */
+int mma8451_pacer_wait(mma8451* device, mma8451_pacer* pacer, mma8451_sample* sample);
+/**
+ * This function makes one paced read without sleeping, for callers with their own wait. Call
+ * it at next_ns, it applies the same phase and interval feedback as mma8451_pacer_wait() and
+ * moves next_ns to the next read, a sixteenth of a period on if the sample wasn't ready.
+ * @param device Device to read from.
+ * @param pacer Pacer set up with mma8451_pacer_init().
+ * @param sample Sample to fill.
+ * @return 1 if a new sample was read, 0 if failure or if there was no new sample (errno EAGAIN).
+ */
+int mma8451_pacer_read(mma8451* device, mma8451_pacer* pacer, mma8451_sample* sample);
+/**
+ * This function gets a snapshot of the performance counters.
+ * @param device Device to get the counters for, or NULL for transfers made directly through
+ *               the low level i2c functions.
+ * @param stats Structure to fill.
+ * @param reset Whether or not to zero the counters after reading them.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_get_stats(mma8451* device, mma8451_stats* stats, unsigned char reset);
+/**
+ * This function reads the whole register map in a single I2C_RDWR transfer. The sample
+ * output registers (0x01 - 0x06) are not read, so FIFO contents aren't consumed, and are
+ * left as zero.
+ * @param device Device to read from.
+ * @param map Register map to fill.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_snapshot(mma8451* device, mma8451_register_map* map);
+/**
+ * This function writes a register map captured with mma8451_snapshot() back to a device.
+ * The device is put into standby, every writable register is written in one I2C_RDWR
+ * transfer using auto-increment runs, and the device is reactivated if the snapshot was
+ * taken while active. The CTRL_REG2 reset bit is never written. A non-zero F_SETUP is
+ * preceded by a write of 0 in the same transfer, since the FIFO can only change mode through
+ * disabled.
+ * @param device Device to write to.
+ * @param map Register map to restore.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_restore(mma8451* device, const mma8451_register_map* map);
+/**
+ * This function starts recording every I2C_RDWR transfer into per-thread ring buffers.
+ * The buffers are allocated on the first call and reused afterwards, recording a transfer
+ * never allocates or formats.
+ * @param events_per_thread Number of events each thread keeps, rounded up to a power of two.
+ *                          Ignored if the buffers have already been allocated.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_trace_start(unsigned int events_per_thread);
+/**
+ * This function stops recording transfers, the recorded events are kept until the next
+ * call to mma8451_trace_start().
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_trace_stop(void);
+/**
+ * This function stops tracing and frees the trace buffers. No transfers may be in progress
+ * on any thread when this is called.
+ */
+void mma8451_trace_free(void);
+/**
+ * This function writes the recorded transfers as Chrome trace JSON (also readable by
+ * Perfetto). Each adapter file descriptor is shown as a process and each device address
+ * as a thread. Only async-signal-safe calls are used.
+ * @param fd File descriptor to write to.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_trace_dump(int fd);
+/**
+ * This function installs a signal handler which writes the recorded transfers to a file.
+ * @param signum Signal to handle, e.g. SIGUSR1.
+ * @param path File to (over)write when the signal is received.
+ * @return 1 if successful, 0 if failure.
+ */
+int mma8451_trace_dump_on_signal(int signum, const char* path);
 
 //Medium level functions (register reads/writes)
 int mma8451_get_status(mma8451* device, mma8451_register_status* data);
@@ -1519,6 +2358,25 @@ int mma8451_get_register(mma8451* device, mma8451_register reg, mma8451_register
  * @return 1 for success, 0 for failure.
  */
 int mma8451_set_register(mma8451* device, mma8451_register reg, mma8451_register_generic* data, unsigned char byteData);
+/**
+ * This function reads consecutive registers from the accelerometer in a single transfer.
+ * Reading from MMA8451_REGISTER_OUT_X_MSB while the FIFO is enabled drains FIFO samples.
+ * @param device Device to read from.
+ * @param reg Register to start reading from.
+ * @param buf Buffer to read into.
+ * @param cnt Number of bytes to read.
+ * @return 1 for success, 0 for failure.
+ */
+int mma8451_get_register_block(mma8451* device, mma8451_register reg, unsigned char* buf, unsigned int cnt);
+/**
+ * This function issues a raw I2C_RDWR transfer on the device's bus. The transfer is retried,
+ * traced and counted in the device's statistics like any other.
+ * @param device Device whose bus and statistics to use.
+ * @param messages Messages to transfer, may address other devices on the same bus.
+ * @param nmsgs Number of messages.
+ * @return 1 for success, 0 for failure.
+ */
+int mma8451_transfer(mma8451* device, struct i2c_msg* messages, unsigned int nmsgs);
 /**
  * This function sets an I2C register.
  * @param file File pointer to I2C bus.
@@ -1546,4 +2404,10 @@ int mma8451_get_i2c_register(int file, unsigned char addr, unsigned char reg, un
  * @param cnt Number of bytes to retrieve.
  * @return 1 for success, 0 for failure.
  */
-int mma8451_get_i2c_register_block(int file, unsigned char addr, unsigned char reg, unsigned char *buf, unsigned int cnt);
\ No newline at end of file
+int mma8451_get_i2c_register_block(int file, unsigned char addr, unsigned char reg, unsigned char *buf, unsigned int cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
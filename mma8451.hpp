@@ -0,0 +1,283 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Header-only C++17 wrapper around mma8451.h. Span overloads are available when compiling
+ * as C++20.
+ */
+#ifndef MMA8451_HPP
+#define MMA8451_HPP
+
+#include "mma8451.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <utility>
+#if __has_include(<span>)
+#include <span>
+#endif
+
+namespace libmma8451 {
+
+/**
+ * The acceleration range, Dynamic uses whatever the device is configured for at runtime.
+ */
+enum class Range : int {
+	G2 = MMA8451_RANGE_2G,
+	G4 = MMA8451_RANGE_4G,
+	G8 = MMA8451_RANGE_8G,
+	Dynamic = -1
+};
+
+/**
+ * The sample resolution, Dynamic uses whatever the device is configured for at runtime.
+ */
+enum class Resolution : int {
+	Bits14 = MMA8451_14BIT_OUTPUT,
+	Bits8 = MMA8451_8BIT_OUTPUT,
+	Dynamic = -1
+};
+
+/**
+ * A single undecoded sample in signed counts.
+ */
+struct RawSample {
+	int16_t x;
+	int16_t y;
+	int16_t z;
+};
+static_assert(sizeof(RawSample) == sizeof(mma8451_raw_sample), "RawSample must match mma8451_raw_sample");
+
+namespace detail {
+
+/**
+ * Counts per g for a range and resolution, 0 if either is Dynamic.
+ */
+constexpr int counts_per_g(Range range, Resolution resolution) {
+	if(range == Range::Dynamic || resolution == Resolution::Dynamic) {
+		return 0;
+	}
+	return (resolution == Resolution::Bits14 ? 0x1000 : 0x40) >> static_cast<int>(range);
+}
+
+/**
+ * Bytes per sample on the bus for a resolution.
+ */
+constexpr unsigned int bytes_per_sample(Resolution resolution) {
+	return resolution == Resolution::Bits8 ? 3 : 6;
+}
+
+[[noreturn]] inline void throw_errno(const char* what) {
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+}
+
+/**
+ * An open MMA8451 accelerometer, closed when destroyed. When Range and Resolution are fixed
+ * the device is configured for them on construction and samples are decoded with constant
+ * scale factors; Device<> decodes using the device's runtime configuration instead.
+ */
+template<Range R = Range::Dynamic, Resolution S = Resolution::Dynamic>
+class Device {
+public:
+	static_assert((R == Range::Dynamic) == (S == Resolution::Dynamic),
+		"Range and Resolution must either both be fixed or both be Dynamic");
+
+	/**
+	 * Whether or not the decode path is fixed at compile time.
+	 */
+	static constexpr bool is_static = (R != Range::Dynamic);
+	/**
+	 * Meters per second squared per count, only meaningful when is_static.
+	 */
+	static constexpr double scale = is_static ? GRAVITY_ACCEL / detail::counts_per_g(R, S) : 0.0;
+	/**
+	 * Bytes per sample on the bus, only meaningful when is_static.
+	 */
+	static constexpr unsigned int sample_bytes = detail::bytes_per_sample(S);
+
+	/**
+	 * Opens a device and, for fixed types, puts it in standby and applies Range and Resolution.
+	 * @param path The path to the I2C bus.
+	 * @param addr The I2C address of the device.
+	 * @throws std::system_error if the device can't be opened or configured.
+	 */
+	Device(const char* path, unsigned char addr) : dev_(mma8451_open(const_cast<char*>(path), addr)) {
+		if(dev_ == nullptr) {
+			detail::throw_errno("mma8451_open");
+		}
+		if constexpr(is_static) {
+			if(!mma8451_set_active(dev_, 0) ||
+			   !mma8451_set_range(dev_, static_cast<mma8451_range_scale>(R)) ||
+			   !mma8451_set_output_size(dev_, static_cast<mma8451_output_size>(S))) {
+				int err = errno;
+				mma8451_close(dev_);
+				dev_ = nullptr;
+				errno = err;
+				detail::throw_errno("mma8451 configure");
+			}
+		}
+	}
+
+	/**
+	 * Takes ownership of a device opened with mma8451_open(). Fixed types trust the caller to
+	 * have configured the device to match.
+	 */
+	explicit Device(mma8451* dev) noexcept : dev_(dev) {}
+
+	~Device() {
+		if(dev_ != nullptr) {
+			mma8451_close(dev_);
+		}
+	}
+
+	Device(const Device&) = delete;
+	Device& operator=(const Device&) = delete;
+
+	Device(Device&& other) noexcept : dev_(std::exchange(other.dev_, nullptr)) {}
+
+	Device& operator=(Device&& other) noexcept {
+		if(this != &other) {
+			if(dev_ != nullptr) {
+				mma8451_close(dev_);
+			}
+			dev_ = std::exchange(other.dev_, nullptr);
+		}
+		return *this;
+	}
+
+	/**
+	 * The underlying C handle, for use with the rest of the mma8451_* API.
+	 */
+	mma8451* get() const noexcept {
+		return dev_;
+	}
+
+	/**
+	 * Gives up ownership of the underlying C handle.
+	 */
+	mma8451* release() noexcept {
+		return std::exchange(dev_, nullptr);
+	}
+
+	/**
+	 * Puts the device in active or standby mode.
+	 */
+	void set_active(bool active) {
+		if(!mma8451_set_active(dev_, active)) {
+			detail::throw_errno("mma8451_set_active");
+		}
+	}
+
+	/**
+	 * Reads the current sample from the output registers.
+	 */
+	RawSample read_raw() {
+		RawSample sample;
+
+		drain_fifo(&sample, 1);
+		return sample;
+	}
+
+	/**
+	 * Reads the current sample and converts it to meters per second squared.
+	 */
+	mma8451_acceleration read() {
+		return to_acceleration(read_raw());
+	}
+
+	/**
+	 * Drains up to max samples from the FIFO straight into out.
+	 * @return The number of samples written to out.
+	 */
+	std::size_t read_fifo(RawSample* out, std::size_t max) {
+		mma8451_register_f_status status;
+		std::size_t count;
+
+		if(!mma8451_get_f_status(dev_, &status)) {
+			detail::throw_errno("mma8451_get_f_status");
+		}
+		count = status.f_cnt < max ? status.f_cnt : max;
+		drain_fifo(out, count);
+		return count;
+	}
+
+	/**
+	 * Drains exactly count samples, at most 32, from the FIFO into out with mma8451_drain_fifo()
+	 * without checking F_STATUS first. The caller must already know that many samples are queued.
+	 */
+	void drain_fifo(RawSample* out, std::size_t count) {
+		if(!mma8451_drain_fifo(dev_, reinterpret_cast<mma8451_raw_sample*>(out), static_cast<unsigned int>(count))) {
+			detail::throw_errno("mma8451_drain_fifo");
+		}
+	}
+
+#ifdef __cpp_lib_span
+	/**
+	 * Drains up to out.size() samples from the FIFO into out.
+	 * @return The filled prefix of out.
+	 */
+	std::span<RawSample> read_fifo(std::span<RawSample> out) {
+		return out.first(read_fifo(out.data(), out.size()));
+	}
+
+	/**
+	 * Converts a span of samples to meters per second squared.
+	 */
+	void to_acceleration(std::span<const RawSample> in, std::span<mma8451_acceleration> out) const noexcept {
+		std::size_t count = in.size() < out.size() ? in.size() : out.size();
+		for(std::size_t i = 0; i < count; i++) {
+			out[i] = to_acceleration(in[i]);
+		}
+	}
+#endif
+
+	/**
+	 * Converts a sample to meters per second squared.
+	 */
+	mma8451_acceleration to_acceleration(const RawSample& sample) const noexcept {
+		double k;
+		if constexpr(is_static) {
+			k = scale;
+		} else {
+			k = GRAVITY_ACCEL / detail::counts_per_g(static_cast<Range>(dev_->range), resolution());
+		}
+		return mma8451_acceleration{ sample.x * k, sample.y * k, sample.z * k };
+	}
+
+	/**
+	 * The sample resolution, fixed for static types.
+	 */
+	Resolution resolution() const noexcept {
+		if constexpr(is_static) {
+			return S;
+		} else {
+			return static_cast<Resolution>(dev_->data_size);
+		}
+	}
+
+private:
+	mma8451* dev_;
+};
+
+}
+
+#endif
@@ -0,0 +1,508 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * Acquisition daemon. Owns one or more accelerometers and streams their samples to clients
+ * over a Unix domain socket using the protocol in mma8451-proto.h. Devices are drained from
+ * the FIFO in ring buffer mode and published in fixed size batches.
+ *
+ * A device path of "fake" generates a synthetic signal instead of opening a bus, which allows
+ * clients to be tested without hardware.
+ */
+#include "mma8451-proto.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+#include <math.h>
+
+#define MAX_CLIENTS 32
+
+typedef struct device {
+    mma8451* dev;
+    char* path;
+    mma8451_msg_config config;
+    mma8451_msg_samples batch;
+    uint64_t sequence;
+    uint64_t fakeNext;
+    uint64_t lastNs;
+    int gap;
+} device;
+
+typedef struct client {
+    int fd;
+    uint32_t subscriptions;
+    uint64_t dropped;
+} client;
+
+static device devices[MMA8451_PROTO_MAX_DEVICES];
+static unsigned int ndevices;
+static client clients[MAX_CLIENTS];
+static unsigned int nclients;
+static unsigned int batchSize = 32;
+static volatile sig_atomic_t stopping;
+
+/**
+ * Prints the usage statement for this application.
+ */
+void printUsage() {
+    printf("Usage: mma8451d [-s socket] [-b batch] [-r rate] [device path] [i2c address] ...\n");
+    printf("  e.g. mma8451d -s /run/mma8451d.sock /dev/i2c-1 0x1c /dev/i2c-1 0x1d\n");
+    printf("  rate is a mma8451_data_rate (0 = 800hz), a device path of \"fake\" simulates a device.\n\n");
+}
+
+static uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void onSignal(int signum) {
+    (void)signum;
+    stopping = 1;
+}
+
+/**
+ * Applies a configuration to a device and leaves it active with the FIFO in ring buffer mode.
+ * @return 1 on success, 0 on failure.
+ */
+static int configureDevice(device* d, const mma8451_msg_config* config) {
+    mma8451_register_f_setup setup;
+
+    if(config->range > MMA8451_RANGE_8G || config->output_size > MMA8451_8BIT_OUTPUT ||
+       config->data_rate > MMA8451_DATA_RATE_1_56HZ || config->power_mode > MMA8451_POWER_MODE_LOW_POWER) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if(d->dev != NULL) {
+        if(!mma8451_set_active(d->dev, 0)) return 0;
+        if(!mma8451_set_range(d->dev, (mma8451_range_scale)config->range)) return 0;
+        if(!mma8451_set_output_size(d->dev, (mma8451_output_size)config->output_size)) return 0;
+        if(!mma8451_set_data_rate(d->dev, (mma8451_data_rate)config->data_rate)) return 0;
+        if(!mma8451_set_power_mode(d->dev, (mma8451_power_mode)config->power_mode)) return 0;
+        if(!mma8451_get_f_setup(d->dev, &setup)) return 0;
+        setup.f_mode = MMA8451_FIFO_MODE_RING_BUFFER;
+        setup.f_wmrk = 0;
+        if(!mma8451_set_f_setup(d->dev, &setup)) return 0;
+        if(!mma8451_set_active(d->dev, 1)) return 0;
+    }
+
+    d->config = *config;
+    d->config.scale = mma8451_proto_scale(config->range, config->output_size);
+    d->config.reserved = 0;
+    d->fakeNext = nowNs();
+    return 1;
+}
+
+/**
+ * Sends a message to one client, dropping sample frames rather than blocking if its socket
+ * is full. Clients that fail otherwise are closed on the next poll.
+ */
+static void sendTo(client* c, uint16_t type, uint16_t index, const void* payload, uint32_t length) {
+    if(c->fd < 0) {
+        return;
+    }
+    if(!mma8451_proto_send(c->fd, type, index, payload, length, MSG_DONTWAIT)) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            c->dropped++;
+        } else {
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+}
+
+/**
+ * Publishes the pending batch of a device to its subscribers.
+ */
+static void flushBatch(unsigned int index) {
+    device* d = &devices[index];
+    uint32_t length;
+    unsigned int i;
+
+    if(d->batch.count == 0) {
+        return;
+    }
+
+    d->batch.sequence = d->sequence;
+    d->batch.period_ns = mma8451_data_rate_period_ns(d->config.data_rate);
+    d->batch.flags = d->gap ? MMA8451_SAMPLES_GAP : 0;
+    length = offsetof(mma8451_msg_samples, data) + d->batch.count * 3 * sizeof(int16_t);
+    for(i = 0; i < nclients; i++) {
+        if(clients[i].subscriptions & (1U << index)) {
+            sendTo(&clients[i], MMA8451_MSG_SAMPLES, index, &d->batch, length);
+        }
+    }
+
+    d->sequence += d->batch.count;
+    d->batch.count = 0;
+    d->gap = 0;
+}
+
+/**
+ * Appends one sample to a device's batch, publishing the batch when it is full.
+ */
+static void appendSample(unsigned int index, int16_t x, int16_t y, int16_t z, uint64_t timestamp) {
+    device* d = &devices[index];
+    int16_t* out;
+
+    if(d->batch.count == 0) {
+        d->batch.timestamp_ns = timestamp;
+    }
+    out = &d->batch.data[d->batch.count * 3];
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+    d->lastNs = timestamp;
+    if(++d->batch.count >= batchSize) {
+        flushBatch(index);
+    }
+}
+
+/**
+ * Generates the samples a fake device would have produced since the last call: a 1g Z axis
+ * with a 5hz sine on X.
+ */
+static void acquireFake(unsigned int index, uint64_t now) {
+    device* d = &devices[index];
+    uint64_t period = mma8451_data_rate_period_ns(d->config.data_rate);
+    double countsPerG = GRAVITY_ACCEL / d->config.scale;
+
+    while(d->fakeNext + period <= now) {
+        double t = (double)(d->sequence + d->batch.count) * period / 1e9;
+        appendSample(index, (int16_t)(countsPerG * 0.25 * sin(2 * M_PI * 5 * t)), 0, (int16_t)countsPerG, d->fakeNext);
+        d->fakeNext += period;
+    }
+}
+
+/**
+ * Drains a device's FIFO into its batch. Timestamps are back-dated from the time of the drain
+ * using the sample period.
+ * @return 1 on success, 0 on failure.
+ */
+static int acquire(unsigned int index) {
+    device* d = &devices[index];
+    mma8451_register_f_status status;
+    mma8451_raw_sample samples[32];
+    unsigned int i;
+    uint64_t now = nowNs(), period;
+
+    if(d->dev == NULL) {
+        acquireFake(index, now);
+        return 1;
+    }
+
+    if(!mma8451_get_f_status(d->dev, &status)) {
+        return 0;
+    }
+    if(status.f_cnt == 0) {
+        return 1;
+    }
+
+    period = mma8451_data_rate_period_ns(d->config.data_rate);
+    if(status.f_ovf) {
+        //Samples before the overflow go out on their own, then the sequence skips the samples
+        //estimated lost between the last one published and the oldest one still queued.
+        uint64_t oldest = now - (status.f_cnt - 1) * period;
+        uint64_t dropped = 1;
+
+        flushBatch(index);
+        if(d->lastNs != 0 && oldest > d->lastNs + period) {
+            dropped = (oldest - d->lastNs + period / 2) / period - 1;
+        }
+        d->sequence += dropped;
+        d->gap = 1;
+    }
+
+    if(!mma8451_drain_fifo(d->dev, samples, status.f_cnt)) {
+        return 0;
+    }
+
+    for(i = 0; i < status.f_cnt; i++) {
+        appendSample(index, samples[i].x, samples[i].y, samples[i].z, now - (status.f_cnt - 1 - i) * period);
+    }
+    return 1;
+}
+
+static void sendError(client* c, uint16_t request, uint16_t index, int error) {
+    mma8451_msg_error msg;
+
+    msg.error = error;
+    msg.request = request;
+    msg.reserved = 0;
+    sendTo(c, MMA8451_MSG_ERROR, index, &msg, sizeof(msg));
+}
+
+/**
+ * Handles one request from a client.
+ */
+static void handleRequest(client* c, const mma8451_frame* frame) {
+    uint16_t index = frame->header.device;
+    mma8451_msg_stats stats;
+    mma8451_stats counters;
+    unsigned int i;
+
+    if(index >= ndevices) {
+        sendError(c, frame->header.type, index, ENODEV);
+        return;
+    }
+
+    switch(frame->header.type) {
+    case MMA8451_MSG_SUBSCRIBE:
+        c->subscriptions |= (1U << index);
+        break;
+    case MMA8451_MSG_UNSUBSCRIBE:
+        c->subscriptions &= ~(1U << index);
+        break;
+    case MMA8451_MSG_GET_CONFIG:
+        sendTo(c, MMA8451_MSG_CONFIG, index, &devices[index].config, sizeof(mma8451_msg_config));
+        break;
+    case MMA8451_MSG_SET_CONFIG:
+        if(frame->header.length != sizeof(mma8451_msg_config)) {
+            sendError(c, frame->header.type, index, EINVAL);
+            break;
+        }
+        //Samples already collected were taken with the old configuration.
+        flushBatch(index);
+        if(!configureDevice(&devices[index], &frame->payload.config)) {
+            sendError(c, frame->header.type, index, errno);
+            break;
+        }
+        for(i = 0; i < nclients; i++) {
+            if(&clients[i] == c || (clients[i].subscriptions & (1U << index))) {
+                sendTo(&clients[i], MMA8451_MSG_CONFIG, index, &devices[index].config, sizeof(mma8451_msg_config));
+            }
+        }
+        break;
+    case MMA8451_MSG_GET_STATS:
+        memset(&stats, 0, sizeof(stats));
+        stats.sequence = devices[index].sequence;
+        stats.dropped_frames = c->dropped;
+        if(devices[index].dev != NULL && mma8451_get_stats(devices[index].dev, &counters, 0)) {
+            mma8451_proto_stats(&stats.device, &counters);
+        }
+        sendTo(c, MMA8451_MSG_STATS, index, &stats, sizeof(stats));
+        break;
+    default:
+        sendError(c, frame->header.type, index, EOPNOTSUPP);
+        break;
+    }
+}
+
+static int openSocket(const char* path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void acceptClient(int listener) {
+    mma8451_msg_hello hello;
+    int fd = accept(listener, NULL, NULL);
+
+    if(fd < 0) {
+        return;
+    }
+    if(nclients >= MAX_CLIENTS) {
+        close(fd);
+        return;
+    }
+
+    clients[nclients].fd = fd;
+    clients[nclients].subscriptions = 0;
+    clients[nclients].dropped = 0;
+
+    hello.version = MMA8451_PROTO_VERSION;
+    hello.devices = ndevices;
+    hello.batch = batchSize;
+    sendTo(&clients[nclients], MMA8451_MSG_HELLO, 0, &hello, sizeof(hello));
+    nclients++;
+}
+
+/**
+ * Removes clients whose connection has failed.
+ */
+static void reapClients() {
+    unsigned int i = 0;
+
+    while(i < nclients) {
+        if(clients[i].fd < 0) {
+            clients[i] = clients[--nclients];
+        } else {
+            i++;
+        }
+    }
+}
+
+/**
+ * Main function, opens the devices and serves clients until interrupted.
+ */
+int main(int argc, char** argv) {
+    const char* socketPath = MMA8451_PROTO_SOCKET;
+    mma8451_msg_config config;
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int listener, opt, tick;
+    unsigned int i;
+
+    memset(&config, 0, sizeof(config));
+    config.range = MMA8451_RANGE_2G;
+    config.output_size = MMA8451_14BIT_OUTPUT;
+    config.data_rate = MMA8451_DATA_RATE_100HZ;
+    config.power_mode = MMA8451_POWER_MODE_HIGH_RES;
+
+    while((opt = getopt(argc, argv, "s:b:r:h")) != -1) {
+        switch(opt) {
+        case 's':
+            socketPath = optarg;
+            break;
+        case 'b':
+            batchSize = (unsigned int)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            config.data_rate = (uint8_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printUsage();
+            return -1;
+        }
+    }
+
+    //Make sure we have pairs of devices and addresses.
+    if(optind >= argc || (argc - optind) % 2 != 0 || (argc - optind) / 2 > MMA8451_PROTO_MAX_DEVICES ||
+       batchSize == 0 || batchSize > MMA8451_PROTO_MAX_BATCH) {
+        printUsage();
+        return -1;
+    }
+
+    for(i = optind; i < (unsigned int)argc; i += 2) {
+        device* d = &devices[ndevices];
+        unsigned char address = (unsigned char)strtol(argv[i + 1], NULL, 0);
+
+        d->path = argv[i];
+        if(strcmp(d->path, "fake") != 0) {
+            d->dev = mma8451_open(d->path, address);
+            if(d->dev == NULL) {
+                fprintf(stderr, "Unable to open %s at 0x%02x: %s\n", d->path, address, strerror(errno));
+                return -1;
+            }
+        }
+        if(!configureDevice(d, &config)) {
+            fprintf(stderr, "Unable to configure %s at 0x%02x: %s\n", d->path, address, strerror(errno));
+            return -2;
+        }
+        ndevices++;
+    }
+
+    listener = openSocket(socketPath);
+    if(listener < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", socketPath, strerror(errno));
+        return -3;
+    }
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    //Drain often enough that the 32 sample FIFO can't overflow, but at most every 10ms.
+    tick = (int)(mma8451_data_rate_period_ns(config.data_rate) * 16 / 1000000);
+    tick = (tick > 10) ? 10 : (tick < 1 ? 1 : tick);
+
+    while(!stopping) {
+        unsigned int nfds = 0;
+
+        fds[nfds].fd = listener;
+        fds[nfds++].events = POLLIN;
+        for(i = 0; i < nclients; i++) {
+            fds[nfds].fd = clients[i].fd;
+            fds[nfds++].events = POLLIN;
+        }
+
+        if(poll(fds, nfds, tick) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        for(i = 0; i < ndevices; i++) {
+            if(!acquire(i)) {
+                fprintf(stderr, "Unable to read %s: %s\n", devices[i].path, strerror(errno));
+            }
+        }
+
+        for(i = 1; i < nfds; i++) {
+            client* c = &clients[i - 1];
+            mma8451_frame frame;
+
+            if(c->fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            if(!mma8451_proto_recv(c->fd, &frame, MSG_DONTWAIT)) {
+                if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                    close(c->fd);
+                    c->fd = -1;
+                }
+                continue;
+            }
+            handleRequest(c, &frame);
+        }
+        reapClients();
+
+        if(fds[0].revents & POLLIN) {
+            acceptClient(listener);
+        }
+    }
+
+    for(i = 0; i < nclients; i++) {
+        close(clients[i].fd);
+    }
+    close(listener);
+    unlink(socketPath);
+    for(i = 0; i < ndevices; i++) {
+        if(devices[i].dev != NULL) {
+            mma8451_close(devices[i].dev);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,610 @@
+/*
+ * libmma8451 - Library for controlling and reading from MMA8451 accelerometers.
+ * Copyright (C) 2017  Michael Powers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/*
+ * CPython extension exposing FIFO bursts as buffer protocol objects, so NumPy can wrap them
+ * without copying:
+ *
+ *   dev = mma8451.Device("/dev/i2c-1", 0x1c)
+ *   dev.set_fifo(mma8451.FIFO_RING_BUFFER, 16)
+ *   dev.set_active(True)
+ *   for batch in dev.batches(16):
+ *       samples = numpy.asarray(batch)    # int16, shape (16, 3)
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <structmember.h>
+#include "mma8451.h"
+#include <errno.h>
+#include <time.h>
+
+/**
+ * The number of samples the FIFO holds.
+ */
+#define FIFO_SIZE 32
+
+typedef struct {
+    PyObject_HEAD
+    mma8451* dev;
+    int busy;
+} DeviceObject;
+
+typedef struct {
+    PyObject_HEAD
+    char* data;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+    Py_ssize_t itemsize;
+    //decoded and overflow are exposed as T_BOOL members, which read a single char.
+    char decoded;
+    int exports;
+    unsigned long long timestamp;
+    char overflow;
+} BatchObject;
+
+typedef struct {
+    PyObject_HEAD
+    DeviceObject* device;
+    PyObject** pool;
+    Py_ssize_t npool;
+    unsigned int batchSize;
+    int decoded;
+    long period;
+} BatchIterObject;
+
+static PyTypeObject DeviceType;
+static PyTypeObject BatchType;
+static PyTypeObject BatchIterType;
+
+static unsigned long long nowNs(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+/* Batch */
+
+static BatchObject* Batch_create(int decoded) {
+    BatchObject* batch = PyObject_New(BatchObject, &BatchType);
+
+    if(batch == NULL) {
+        return NULL;
+    }
+    batch->itemsize = decoded ? sizeof(double) : sizeof(int16_t);
+    batch->data = (char*)PyMem_Malloc(FIFO_SIZE * 3 * batch->itemsize);
+    if(batch->data == NULL) {
+        Py_DECREF(batch);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    batch->shape[0] = 0;
+    batch->shape[1] = 3;
+    batch->strides[0] = 3 * batch->itemsize;
+    batch->strides[1] = batch->itemsize;
+    batch->decoded = decoded;
+    batch->exports = 0;
+    batch->timestamp = 0;
+    batch->overflow = 0;
+    return batch;
+}
+
+static void Batch_dealloc(BatchObject* self) {
+    PyMem_Free(self->data);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int Batch_getbuffer(BatchObject* self, Py_buffer* view, int flags) {
+    if((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "batches are read-only");
+        view->obj = NULL;
+        return -1;
+    }
+
+    view->buf = self->data;
+    view->obj = (PyObject*)self;
+    Py_INCREF(self);
+    view->len = self->shape[0] * 3 * self->itemsize;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) ? (self->decoded ? "d" : "h") : NULL;
+    view->ndim = ((flags & PyBUF_ND) == PyBUF_ND) ? 2 : 1;
+    view->shape = ((flags & PyBUF_ND) == PyBUF_ND) ? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    self->exports++;
+    return 0;
+}
+
+static void Batch_releasebuffer(BatchObject* self, Py_buffer* view) {
+    (void)view;
+    self->exports--;
+}
+
+static Py_ssize_t Batch_length(BatchObject* self) {
+    return self->shape[0];
+}
+
+static PyBufferProcs Batch_as_buffer = {
+    (getbufferproc)Batch_getbuffer,
+    (releasebufferproc)Batch_releasebuffer
+};
+
+static PySequenceMethods Batch_as_sequence = {
+    (lenfunc)Batch_length
+};
+
+static PyMemberDef Batch_members[] = {
+    {"timestamp", T_ULONGLONG, offsetof(BatchObject, timestamp), READONLY,
+        "CLOCK_MONOTONIC time the FIFO was drained, in nanoseconds."},
+    {"overflow", T_BOOL, offsetof(BatchObject, overflow), READONLY,
+        "True if the FIFO overflowed before this batch was read."},
+    {"decoded", T_BOOL, offsetof(BatchObject, decoded), READONLY,
+        "True if samples are float64 m/s^2 rather than int16 counts."},
+    {NULL}
+};
+
+/* Reading */
+
+/**
+ * Drains count samples from the FIFO into a batch. Called with the GIL released.
+ * @return 1 on success, 0 on failure.
+ */
+static int readFifo(mma8451* dev, BatchObject* batch, unsigned int count) {
+    mma8451_raw_sample raw[FIFO_SIZE];
+    unsigned int i;
+
+    //Raw batches have the layout of mma8451_raw_sample, so they're drained into directly.
+    if(!mma8451_drain_fifo(dev, batch->decoded ? raw : (mma8451_raw_sample*)batch->data, count)) {
+        return 0;
+    }
+
+    if(batch->decoded) {
+        double* out = (double*)batch->data;
+        double scale = GRAVITY_ACCEL / (((dev->data_size == MMA8451_14BIT_OUTPUT) ? 0x1000 : 0x40) >> dev->range);
+        for(i = 0; i < count; i++) {
+            out[i * 3] = raw[i].x * scale;
+            out[i * 3 + 1] = raw[i].y * scale;
+            out[i * 3 + 2] = raw[i].z * scale;
+        }
+    }
+
+    batch->shape[0] = count;
+    batch->timestamp = nowNs();
+    return 1;
+}
+
+static int Device_check(DeviceObject* self) {
+    if(self->dev == NULL) {
+        PyErr_SetString(PyExc_ValueError, "device is closed");
+        return 0;
+    }
+    if(self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "device is in use by another thread");
+        return 0;
+    }
+    return 1;
+}
+
+/* Device */
+
+static int Device_init(DeviceObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {"path", "address", NULL};
+    PyObject* pathBytes;
+    unsigned char address;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O&b", kwlist, PyUnicode_FSConverter, &pathBytes, &address)) {
+        return -1;
+    }
+
+    if(self->dev != NULL) {
+        mma8451_close(self->dev);
+    }
+    Py_BEGIN_ALLOW_THREADS
+    self->dev = mma8451_open(PyBytes_AS_STRING(pathBytes), address);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(pathBytes);
+
+    if(self->dev == NULL) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    return 0;
+}
+
+static void Device_dealloc(DeviceObject* self) {
+    if(self->dev != NULL) {
+        mma8451_close(self->dev);
+    }
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* Device_close(DeviceObject* self, PyObject* unused) {
+    (void)unused;
+    if(self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "device is in use by another thread");
+        return NULL;
+    }
+    if(self->dev != NULL) {
+        mma8451_close(self->dev);
+        self->dev = NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Device_enter(DeviceObject* self, PyObject* unused) {
+    (void)unused;
+    Py_INCREF(self);
+    return (PyObject*)self;
+}
+
+static PyObject* Device_exit(DeviceObject* self, PyObject* args) {
+    (void)args;
+    return Device_close(self, NULL);
+}
+
+/**
+ * Runs a setter taking one unsigned char argument with the GIL released.
+ */
+static PyObject* Device_set(DeviceObject* self, PyObject* args, int (*setter)(mma8451*, int), const char* format) {
+    int value, result;
+
+    if(!PyArg_ParseTuple(args, format, &value) || !Device_check(self)) {
+        return NULL;
+    }
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    result = setter(self->dev, value);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+
+    if(!result) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_RETURN_NONE;
+}
+
+static int setActive(mma8451* dev, int value) {
+    return mma8451_set_active(dev, value != 0);
+}
+
+static int setRange(mma8451* dev, int value) {
+    return mma8451_set_range(dev, (mma8451_range_scale)value);
+}
+
+static int setOutputSize(mma8451* dev, int value) {
+    return mma8451_set_output_size(dev, (mma8451_output_size)value);
+}
+
+static int setDataRate(mma8451* dev, int value) {
+    return mma8451_set_data_rate(dev, (mma8451_data_rate)value);
+}
+
+static PyObject* Device_set_active(DeviceObject* self, PyObject* args) {
+    return Device_set(self, args, setActive, "p");
+}
+
+static PyObject* Device_set_range(DeviceObject* self, PyObject* args) {
+    return Device_set(self, args, setRange, "i");
+}
+
+static PyObject* Device_set_output_size(DeviceObject* self, PyObject* args) {
+    return Device_set(self, args, setOutputSize, "i");
+}
+
+static PyObject* Device_set_data_rate(DeviceObject* self, PyObject* args) {
+    return Device_set(self, args, setDataRate, "i");
+}
+
+static PyObject* Device_set_fifo(DeviceObject* self, PyObject* args) {
+    mma8451_register_f_setup setup;
+    int mode, watermark = 0, result;
+
+    if(!PyArg_ParseTuple(args, "i|i", &mode, &watermark) || !Device_check(self)) {
+        return NULL;
+    }
+    if(mode < MMA8451_FIFO_MODE_DISABLED || mode > MMA8451_FIFO_MODE_TRIGGER || watermark < 0 || watermark > FIFO_SIZE) {
+        PyErr_SetString(PyExc_ValueError, "invalid FIFO mode or watermark");
+        return NULL;
+    }
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    result = mma8451_get_f_setup(self->dev, &setup);
+    if(result) {
+        setup.f_mode = mode;
+        setup.f_wmrk = watermark;
+        result = mma8451_set_f_setup(self->dev, &setup);
+    }
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+
+    if(!result) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* Device_read_fifo(DeviceObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {"decoded", NULL};
+    mma8451_register_f_status status;
+    BatchObject* batch;
+    int decoded = 0, result;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|p", kwlist, &decoded) || !Device_check(self)) {
+        return NULL;
+    }
+    batch = Batch_create(decoded);
+    if(batch == NULL) {
+        return NULL;
+    }
+
+    self->busy = 1;
+    Py_BEGIN_ALLOW_THREADS
+    result = mma8451_get_f_status(self->dev, &status) && readFifo(self->dev, batch, status.f_cnt);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+
+    if(!result) {
+        Py_DECREF(batch);
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    batch->overflow = status.f_ovf;
+    return (PyObject*)batch;
+}
+
+static PyObject* Device_batches(DeviceObject* self, PyObject* args, PyObject* kwds) {
+    static char* kwlist[] = {"batch_size", "decoded", "buffers", NULL};
+    mma8451_register_ctrl_reg1 ctrl;
+    BatchIterObject* iter;
+    unsigned int batchSize = FIFO_SIZE;
+    int decoded = 0, buffers = 4, result;
+    Py_ssize_t i;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "|Ipi", kwlist, &batchSize, &decoded, &buffers) || !Device_check(self)) {
+        return NULL;
+    }
+    if(batchSize == 0 || batchSize > FIFO_SIZE || buffers < 1) {
+        PyErr_SetString(PyExc_ValueError, "batch_size must be 1 to 32 and buffers at least 1");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    result = mma8451_get_ctrl_reg1(self->dev, &ctrl);
+    Py_END_ALLOW_THREADS
+    if(!result) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    iter = PyObject_New(BatchIterObject, &BatchIterType);
+    if(iter == NULL) {
+        return NULL;
+    }
+    iter->pool = (PyObject**)PyMem_Calloc(buffers, sizeof(PyObject*));
+    iter->npool = 0;
+    Py_INCREF(self);
+    iter->device = self;
+    iter->batchSize = batchSize;
+    iter->decoded = decoded;
+    iter->period = (long)mma8451_data_rate_period_ns((mma8451_data_rate)ctrl.dr);
+    if(iter->pool == NULL) {
+        Py_DECREF(iter);
+        return PyErr_NoMemory();
+    }
+    for(i = 0; i < buffers; i++) {
+        iter->pool[i] = (PyObject*)Batch_create(decoded);
+        if(iter->pool[i] == NULL) {
+            Py_DECREF(iter);
+            return NULL;
+        }
+        iter->npool++;
+    }
+    return (PyObject*)iter;
+}
+
+static PyMethodDef Device_methods[] = {
+    {"close", (PyCFunction)Device_close, METH_NOARGS, "Closes the device."},
+    {"__enter__", (PyCFunction)Device_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction)Device_exit, METH_VARARGS, NULL},
+    {"set_active", (PyCFunction)Device_set_active, METH_VARARGS, "set_active(active) puts the device in active or standby mode."},
+    {"set_range", (PyCFunction)Device_set_range, METH_VARARGS, "set_range(range) sets the range, one of RANGE_*."},
+    {"set_output_size", (PyCFunction)Device_set_output_size, METH_VARARGS, "set_output_size(size) sets OUTPUT_8BIT or OUTPUT_14BIT."},
+    {"set_data_rate", (PyCFunction)Device_set_data_rate, METH_VARARGS, "set_data_rate(rate) sets the output data rate, one of DATA_RATE_*."},
+    {"set_fifo", (PyCFunction)Device_set_fifo, METH_VARARGS, "set_fifo(mode, watermark=0) configures the FIFO, the device must be in standby."},
+    {"read_fifo", (PyCFunction)Device_read_fifo, METH_VARARGS | METH_KEYWORDS,
+        "read_fifo(decoded=False) drains the FIFO into a new batch."},
+    {"batches", (PyCFunction)Device_batches, METH_VARARGS | METH_KEYWORDS,
+        "batches(batch_size=32, decoded=False, buffers=4) returns an iterator that yields one batch per\n"
+        "batch_size samples. Batches are reused once nothing references them any more."},
+    {NULL}
+};
+
+/* BatchIter */
+
+static void BatchIter_dealloc(BatchIterObject* self) {
+    Py_ssize_t i;
+
+    for(i = 0; i < self->npool; i++) {
+        Py_XDECREF(self->pool[i]);
+    }
+    PyMem_Free(self->pool);
+    Py_XDECREF(self->device);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+/**
+ * Picks a pooled batch that nothing outside the pool refers to, or replaces the oldest one
+ * with a new batch if the caller is still holding all of them.
+ */
+static BatchObject* BatchIter_take(BatchIterObject* self) {
+    Py_ssize_t i;
+    PyObject* batch;
+
+    for(i = 0; i < self->npool; i++) {
+        BatchObject* candidate = (BatchObject*)self->pool[i];
+        if(Py_REFCNT(candidate) == 1 && candidate->exports == 0) {
+            return candidate;
+        }
+    }
+
+    batch = (PyObject*)Batch_create(self->decoded);
+    if(batch == NULL) {
+        return NULL;
+    }
+    Py_DECREF(self->pool[0]);
+    memmove(&self->pool[0], &self->pool[1], (self->npool - 1) * sizeof(PyObject*));
+    self->pool[self->npool - 1] = batch;
+    return (BatchObject*)batch;
+}
+
+static PyObject* BatchIter_next(BatchIterObject* self) {
+    DeviceObject* device = self->device;
+    mma8451_register_f_status status;
+    BatchObject* batch;
+    int result;
+
+    if(!Device_check(device)) {
+        return NULL;
+    }
+    batch = BatchIter_take(self);
+    if(batch == NULL) {
+        return NULL;
+    }
+
+    device->busy = 1;
+    for(;;) {
+        Py_BEGIN_ALLOW_THREADS
+        result = mma8451_get_f_status(device->dev, &status);
+        if(result && status.f_cnt < self->batchSize) {
+            //Sleep until the missing samples should have arrived.
+            struct timespec wait;
+            long long ns = (long long)(self->batchSize - status.f_cnt) * self->period;
+            wait.tv_sec = ns / 1000000000LL;
+            wait.tv_nsec = ns % 1000000000LL;
+            nanosleep(&wait, NULL);
+        } else if(result) {
+            result = readFifo(device->dev, batch, self->batchSize);
+        }
+        Py_END_ALLOW_THREADS
+
+        if(!result) {
+            device->busy = 0;
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        if(status.f_cnt >= self->batchSize) {
+            break;
+        }
+        if(PyErr_CheckSignals() < 0) {
+            device->busy = 0;
+            return NULL;
+        }
+    }
+    device->busy = 0;
+
+    batch->overflow = status.f_ovf;
+    Py_INCREF(batch);
+    return (PyObject*)batch;
+}
+
+/* Module */
+
+static PyTypeObject BatchType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mma8451.Batch",
+    .tp_basicsize = sizeof(BatchObject),
+    .tp_dealloc = (destructor)Batch_dealloc,
+    .tp_as_sequence = &Batch_as_sequence,
+    .tp_as_buffer = &Batch_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "A burst of samples, shape (n, 3), exposed through the buffer protocol.",
+    .tp_members = Batch_members,
+};
+
+static PyTypeObject BatchIterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mma8451.BatchIterator",
+    .tp_basicsize = sizeof(BatchIterObject),
+    .tp_dealloc = (destructor)BatchIter_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)BatchIter_next,
+};
+
+static PyTypeObject DeviceType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mma8451.Device",
+    .tp_basicsize = sizeof(DeviceObject),
+    .tp_dealloc = (destructor)Device_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Device(path, address) opens an MMA8451 on an I2C bus.",
+    .tp_methods = Device_methods,
+    .tp_init = (initproc)Device_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "mma8451",
+    .m_doc = "Bindings for libmma8451 with zero-copy FIFO batches.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_mma8451(void) {
+    PyObject* m;
+
+    if(PyType_Ready(&DeviceType) < 0 || PyType_Ready(&BatchType) < 0 || PyType_Ready(&BatchIterType) < 0) {
+        return NULL;
+    }
+
+    m = PyModule_Create(&module);
+    if(m == NULL) {
+        return NULL;
+    }
+
+    Py_INCREF(&DeviceType);
+    if(PyModule_AddObject(m, "Device", (PyObject*)&DeviceType) < 0) {
+        Py_DECREF(&DeviceType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(&BatchType);
+    PyModule_AddObject(m, "Batch", (PyObject*)&BatchType);
+
+    PyModule_AddIntConstant(m, "RANGE_2G", MMA8451_RANGE_2G);
+    PyModule_AddIntConstant(m, "RANGE_4G", MMA8451_RANGE_4G);
+    PyModule_AddIntConstant(m, "RANGE_8G", MMA8451_RANGE_8G);
+    PyModule_AddIntConstant(m, "OUTPUT_14BIT", MMA8451_14BIT_OUTPUT);
+    PyModule_AddIntConstant(m, "OUTPUT_8BIT", MMA8451_8BIT_OUTPUT);
+    PyModule_AddIntConstant(m, "DATA_RATE_800HZ", MMA8451_DATA_RATE_800HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_400HZ", MMA8451_DATA_RATE_400HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_200HZ", MMA8451_DATA_RATE_200HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_100HZ", MMA8451_DATA_RATE_100HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_50HZ", MMA8451_DATA_RATE_50HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_12_5HZ", MMA8451_DATA_RATE_12_5HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_6_25HZ", MMA8451_DATA_RATE_6_25HZ);
+    PyModule_AddIntConstant(m, "DATA_RATE_1_56HZ", MMA8451_DATA_RATE_1_56HZ);
+    PyModule_AddIntConstant(m, "FIFO_DISABLED", MMA8451_FIFO_MODE_DISABLED);
+    PyModule_AddIntConstant(m, "FIFO_RING_BUFFER", MMA8451_FIFO_MODE_RING_BUFFER);
+    PyModule_AddIntConstant(m, "FIFO_STOP_BUFFER", MMA8451_FIFO_MODE_STOP_BUFFER);
+    PyModule_AddIntConstant(m, "FIFO_TRIGGER", MMA8451_FIFO_MODE_TRIGGER);
+
+    return m;
+}
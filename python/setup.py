@@ -0,0 +1,16 @@
+from setuptools import setup, Extension
+
+setup(
+    name="mma8451",
+    version="1.0",
+    description="Python bindings for libmma8451",
+    ext_modules=[
+        Extension(
+            "mma8451",
+            sources=["mma8451module.c"],
+            include_dirs=[".."],
+            library_dirs=[".."],
+            libraries=["mma8451"],
+        )
+    ],
+)